@@ -128,10 +128,10 @@ int anetTcpKeepAlive(char *err, int fd)
     return ANET_OK;
 }
 
-static int anetCreateSocket(char *err, int domain)
+static int anetCreateSocket(char *err, int domain, int type)
 {
     int s, on = 1;
-    if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
+    if ((s = socket(domain, type, 0)) == -1) {
         anetSetError(err, "creating socket: %s", strerror(errno));
         return ANET_ERR;
     }
@@ -170,7 +170,7 @@ static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags
     }
 
     for (p = gai_result; p != NULL; p = p->ai_next) {
-        if ((s = anetCreateSocket(err, p->ai_family)) == ANET_ERR)
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_STREAM)) == ANET_ERR)
             continue;
 
         if (flags & ANET_CONNECT_NONBLOCK) {
@@ -283,7 +283,7 @@ int anetTcpServer(char *err, char *service, char *bindaddr, int *fds, int nfds)
     }
 
     for (p = gai_result; p != NULL && i < nfds; p = p->ai_next) {
-        if ((s = anetCreateSocket(err, p->ai_family)) == ANET_ERR)
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_STREAM)) == ANET_ERR)
             continue;
 
         if (anetListen(err, s, p->ai_addr, p->ai_addrlen) == ANET_ERR) {
@@ -314,6 +314,124 @@ static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *l
     return fd;
 }
 
+/* Create a UDP socket connected to addr:service, so that plain write()s
+ * send datagrams there. If addr is a multicast group, datagrams are sent
+ * with the given TTL (hop limit). */
+int anetUdpConnect(char *err, char *addr, char *service, int ttl)
+{
+    int s;
+    struct addrinfo gai_hints;
+    struct addrinfo *gai_result, *p;
+    int gai_error;
+
+    memset(&gai_hints, 0, sizeof(gai_hints));
+    gai_hints.ai_family = AF_UNSPEC;
+    gai_hints.ai_socktype = SOCK_DGRAM;
+
+    gai_error = getaddrinfo(addr, service, &gai_hints, &gai_result);
+    if (gai_error != 0) {
+        anetSetError(err, "can't resolve %s: %s", addr, gai_strerror(gai_error));
+        return ANET_ERR;
+    }
+
+    for (p = gai_result; p != NULL; p = p->ai_next) {
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_DGRAM)) == ANET_ERR)
+            continue;
+
+        if (p->ai_family == AF_INET && IN_MULTICAST(ntohl(((struct sockaddr_in *) p->ai_addr)->sin_addr.s_addr))) {
+            unsigned char ttl4 = (unsigned char) ttl;
+            setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl4, sizeof(ttl4));
+        } else if (p->ai_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *) p->ai_addr)->sin6_addr)) {
+            setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+        }
+
+        if (connect(s, p->ai_addr, p->ai_addrlen) >= 0) {
+            freeaddrinfo(gai_result);
+            return s;
+        }
+
+        anetSetError(err, "connect: %s", strerror(errno));
+        close(s);
+    }
+
+    freeaddrinfo(gai_result);
+    return ANET_ERR;
+}
+
+/* Join the multicast group a socket is bound to, if it is one */
+static int anetJoinGroup(char *err, int s, struct sockaddr *sa)
+{
+    if (sa->sa_family == AF_INET && IN_MULTICAST(ntohl(((struct sockaddr_in *) sa)->sin_addr.s_addr))) {
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = ((struct sockaddr_in *) sa)->sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+            anetSetError(err, "setsockopt IP_ADD_MEMBERSHIP: %s", strerror(errno));
+            return ANET_ERR;
+        }
+    } else if (sa->sa_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *) sa)->sin6_addr)) {
+        struct ipv6_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.ipv6mr_multiaddr = ((struct sockaddr_in6 *) sa)->sin6_addr;
+        mreq.ipv6mr_interface = 0;
+        if (setsockopt(s, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == -1) {
+            anetSetError(err, "setsockopt IPV6_JOIN_GROUP: %s", strerror(errno));
+            return ANET_ERR;
+        }
+    }
+    return ANET_OK;
+}
+
+/* Like anetTcpServer, but for UDP sockets. If bindaddr is a multicast
+ * group, the sockets join it (on the default interface) so that they
+ * receive what is sent to the group. */
+int anetUdpServer(char *err, char *service, char *bindaddr, int *fds, int nfds)
+{
+    int s;
+    int i = 0;
+    struct addrinfo gai_hints;
+    struct addrinfo *gai_result, *p;
+    int gai_error;
+
+    memset(&gai_hints, 0, sizeof(gai_hints));
+    gai_hints.ai_family = AF_UNSPEC;
+    gai_hints.ai_socktype = SOCK_DGRAM;
+    gai_hints.ai_flags = AI_PASSIVE;
+
+    gai_error = getaddrinfo(bindaddr, service, &gai_hints, &gai_result);
+    if (gai_error != 0) {
+        anetSetError(err, "can't resolve %s: %s", bindaddr, gai_strerror(gai_error));
+        return ANET_ERR;
+    }
+
+    for (p = gai_result; p != NULL && i < nfds; p = p->ai_next) {
+        if ((s = anetCreateSocket(err, p->ai_family, SOCK_DGRAM)) == ANET_ERR)
+            continue;
+
+        if (p->ai_family == AF_INET6) {
+            int on = 1;
+            setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        }
+
+        if (bind(s, p->ai_addr, p->ai_addrlen) == -1) {
+            anetSetError(err, "bind: %s", strerror(errno));
+            close(s);
+            continue;
+        }
+
+        if (anetJoinGroup(err, s, p->ai_addr) == ANET_ERR) {
+            close(s);
+            continue;
+        }
+
+        fds[i++] = s;
+    }
+
+    freeaddrinfo(gai_result);
+    return (i > 0 ? i : ANET_ERR);
+}
+
 int anetTcpAccept(char *err, int s) {
     int fd;
     struct sockaddr_storage ss;
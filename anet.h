@@ -72,5 +72,7 @@ int anetNonBlock(char *err, int fd);
 int anetTcpNoDelay(char *err, int fd);
 int anetTcpKeepAlive(char *err, int fd);
 int anetSetSendBuffer(char *err, int fd, int buffsize);
+int anetUdpConnect(char *err, char *addr, char *service, int ttl);
+int anetUdpServer(char *err, char *service, char *bindaddr, int *fds, int nfds);
 
 #endif
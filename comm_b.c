@@ -32,17 +32,67 @@ static int decodeBDS40(struct modesMessage *mm, bool store);
 static int decodeBDS50(struct modesMessage *mm, bool store);
 static int decodeBDS60(struct modesMessage *mm, bool store);
 
-static CommBDecoderFn comm_b_decoders[] = {
-    &decodeEmptyResponse,
-    &decodeBDS10,
-    &decodeBDS20,
-    &decodeBDS30,
-    &decodeBDS17,
-    &decodeBDS40,
-    &decodeBDS50,
-    &decodeBDS60
+// Decoders, with an upper bound on the score each can return. The bound is
+// used to stop scoring early once no remaining candidate could equal or beat
+// the best score seen so far.
+static const struct {
+    CommBDecoderFn decode;
+    int max_score;
+} comm_b_decoders[] = {
+    { &decodeEmptyResponse, 56 },
+    { &decodeBDS10, 56 },
+    { &decodeBDS20, 56 },
+    { &decodeBDS30, 56 },
+    { &decodeBDS17, 10 },
+    { &decodeBDS40, 46 },
+    { &decodeBDS50, 56 },
+    { &decodeBDS60, 56 }
 };
 
+// Quick reject: work out which decoders could possibly give a non-zero
+// score, using only the BDS identifier, reserved and status bits that the
+// full decoders would reject on anyway. Bit N corresponds to
+// comm_b_decoders[N].
+static unsigned commBCandidates(unsigned char *msg)
+{
+    unsigned candidates = 0;
+
+    if (!(msg[0] | msg[1] | msg[2] | msg[3] | msg[4] | msg[5] | msg[6]))
+        candidates |= (1 << 0);  // empty response
+    if (msg[0] == 0x10 && !(msg[1] & 0x7C))
+        candidates |= (1 << 1);  // BDS1,0: reserved bits 10-14
+    if (msg[0] == 0x20)
+        candidates |= (1 << 2);  // BDS2,0
+    if (msg[0] == 0x30)
+        candidates |= (1 << 3);  // BDS3,0
+    if (!(msg[3] | msg[4] | msg[5] | msg[6]))
+        candidates |= (1 << 4);  // BDS1,7: reserved bits 25-56
+    if (!(msg[4] & 0x01) && !(msg[5] & 0xFE) && !(msg[6] & 0x18) &&
+        ((msg[0] & 0x80) || (msg[1] & 0x04) || (msg[3] & 0x20) || (msg[5] & 0x01) || (msg[6] & 0x04)))
+        candidates |= (1 << 5);  // BDS4,0: reserved bits 40-47, 52-53; one of the status bits 1, 14, 27, 48, 54
+    if ((msg[0] & 0x80) && (msg[1] & 0x10) && (msg[2] & 0x01) && (msg[5] & 0x04))
+        candidates |= (1 << 6);  // BDS5,0: status bits 1, 12, 24, 46
+    if ((msg[0] & 0x80) && (msg[1] & 0x08) && (msg[2] & 0x01) && ((msg[4] & 0x20) || (msg[5] & 0x04)))
+        candidates |= (1 << 7);  // BDS6,0: status bits 1, 13, 24 and one of 35, 46
+
+    return candidates;
+}
+
+// A small cache, indexed by address, of the registers that recently decoded
+// unambiguously for each aircraft. Those decoders are scored first so that we
+// can usually stop early. A colliding aircraft just replaces the entry.
+#define COMMB_HISTORY_SIZE 1024
+
+static struct {
+    uint32_t addr;
+    unsigned registers;
+} commb_history[COMMB_HISTORY_SIZE];
+
+static unsigned commBHistoryIndex(uint32_t addr)
+{
+    return (addr ^ (addr >> 10) ^ (addr >> 20)) & (COMMB_HISTORY_SIZE - 1);
+}
+
 void decodeCommB(struct modesMessage *mm)
 {
     mm->commb_format = COMMB_UNKNOWN;
@@ -54,28 +104,59 @@ void decodeCommB(struct modesMessage *mm)
         return;
     }
 
-    // This is a bit hairy as we don't know what the requested register was
+    unsigned remaining = commBCandidates(mm->MB);
+    if (!remaining) {
+        return;
+    }
+
+    // This is a bit hairy as we don't know what the requested register was.
+    // Score the plausible decoders, starting with the ones that have worked
+    // for this aircraft recently.
+    unsigned h = commBHistoryIndex(mm->addr);
+    unsigned likely = (commb_history[h].addr == mm->addr ? commb_history[h].registers : 0);
     int bestScore = 0;
-    CommBDecoderFn bestDecoder = NULL;
+    int bestIndex = -1;
     int ambiguous = 0;
 
-    for (unsigned i = 0; i < (sizeof(comm_b_decoders) / sizeof(comm_b_decoders[0])); ++i) {
-        int score = comm_b_decoders[i](mm, false);
+    while (remaining) {
+        unsigned pick = (remaining & likely) ? (remaining & likely) : remaining;
+        unsigned i = __builtin_ctz(pick);
+        remaining &= ~(1U << i);
+
+        int score = comm_b_decoders[i].decode(mm, false);
         if (score > bestScore) {
             bestScore = score;
-            bestDecoder = comm_b_decoders[i];
+            bestIndex = i;
             ambiguous = 0;
         } else if (score == bestScore) {
             ambiguous = 1;
         }
+
+        // Stop once nothing left could tie or beat the best so far
+        if (bestIndex >= 0) {
+            int remainingMax = 0;
+            for (unsigned r = remaining; r; r &= r - 1) {
+                unsigned j = __builtin_ctz(r);
+                if (comm_b_decoders[j].max_score > remainingMax)
+                    remainingMax = comm_b_decoders[j].max_score;
+            }
+            if (bestScore > remainingMax)
+                break;
+        }
     }
 
-    if (bestDecoder) {
+    if (bestIndex >= 0) {
         if (ambiguous) {
             mm->commb_format = COMMB_AMBIGUOUS;
         } else {
             // decode it
-            bestDecoder(mm, true);
+            comm_b_decoders[bestIndex].decode(mm, true);
+
+            if (commb_history[h].addr != mm->addr) {
+                commb_history[h].addr = mm->addr;
+                commb_history[h].registers = 0;
+            }
+            commb_history[h].registers |= (1U << bestIndex);
         }
     }
 }
@@ -63,92 +63,65 @@ static int cprModInt(int a, int b) {
     return res;
 }
 
-static double cprModDouble(double a, double b) {
-    double res = fmod(a, b);
-    if (res < 0) res += b;
-    return res;
-}
-
 //
 //=========================================================================
 //
-// The NL function uses the precomputed table from 1090-WP-9-14
+// The NL function uses the precomputed table from 1090-WP-9-14.
+//
+// cprNLZoneEnd[nl] is the latitude at which zone nl ends (NL drops to nl-1).
+// cprNLByHalfDegree gives the NL at the start of each half-degree band up to
+// 87 degrees. No band contains more than one zone boundary, so a single
+// compare against the end of that zone finishes the lookup.
 //
+static const double cprNLZoneEnd[60] = {
+              0,           0, 87.00000000, 86.53536998, 85.75541621, 84.89166191,   // NL 0..5
+    83.99173563, 83.07199445, 82.13956981, 81.19801349, 80.24923213, 79.29428225,   // NL 6..11
+    78.33374083, 77.36789461, 76.39684391, 75.42056257, 74.43893416, 73.45177442,   // NL 12..17
+    72.45884545, 71.45986473, 70.45451075, 69.44242631, 68.42322022, 67.39646774,   // NL 18..23
+    66.36171008, 65.31845310, 64.26616523, 63.20427479, 62.13216659, 61.04917774,   // NL 24..29
+    59.95459277, 58.84763776, 57.72747354, 56.59318756, 55.44378444, 54.27817472,   // NL 30..35
+    53.09516153, 51.89342469, 50.67150166, 49.42776439, 48.16039128, 46.86733252,   // NL 36..41
+    45.54626723, 44.19454951, 42.80914012, 41.38651832, 39.92256684, 38.41241892,   // NL 42..47
+    36.85025108, 35.22899598, 33.53993436, 31.77209708, 29.91135686, 27.93898710,   // NL 48..53
+    25.82924707, 23.54504487, 21.02939493, 18.18626357, 14.82817437, 10.47047130    // NL 54..59
+};
+
+static const unsigned char cprNLByHalfDegree[174] = {
+    59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59,
+    59, 58, 58, 58, 58, 58, 58, 58, 58, 58, 57, 57, 57, 57, 57, 57, 57, 56, 56, 56,
+    56, 56, 56, 55, 55, 55, 55, 55, 54, 54, 54, 54, 53, 53, 53, 53, 52, 52, 52, 52,
+    51, 51, 51, 51, 50, 50, 50, 50, 49, 49, 49, 48, 48, 48, 47, 47, 47, 46, 46, 46,
+    45, 45, 45, 44, 44, 44, 43, 43, 43, 42, 42, 42, 41, 41, 40, 40, 40, 39, 39, 38,
+    38, 38, 37, 37, 36, 36, 36, 35, 35, 34, 34, 33, 33, 33, 32, 32, 31, 31, 30, 30,
+    29, 29, 29, 28, 28, 27, 27, 26, 26, 25, 25, 24, 24, 23, 23, 22, 22, 21, 21, 20,
+    20, 19, 19, 18, 18, 17, 17, 16, 16, 15, 15, 14, 14, 13, 13, 12, 12, 11, 11, 10,
+    10,  9,  9,  8,  8,  7,  7,  6,  5,  5,  4,  4,  3,  3
+};
+
 static int cprNLFunction(double lat) {
+    int nl;
+
     if (lat < 0) lat = -lat; // Table is simmetric about the equator
-    if (lat < 10.47047130) return 59;
-    if (lat < 14.82817437) return 58;
-    if (lat < 18.18626357) return 57;
-    if (lat < 21.02939493) return 56;
-    if (lat < 23.54504487) return 55;
-    if (lat < 25.82924707) return 54;
-    if (lat < 27.93898710) return 53;
-    if (lat < 29.91135686) return 52;
-    if (lat < 31.77209708) return 51;
-    if (lat < 33.53993436) return 50;
-    if (lat < 35.22899598) return 49;
-    if (lat < 36.85025108) return 48;
-    if (lat < 38.41241892) return 47;
-    if (lat < 39.92256684) return 46;
-    if (lat < 41.38651832) return 45;
-    if (lat < 42.80914012) return 44;
-    if (lat < 44.19454951) return 43;
-    if (lat < 45.54626723) return 42;
-    if (lat < 46.86733252) return 41;
-    if (lat < 48.16039128) return 40;
-    if (lat < 49.42776439) return 39;
-    if (lat < 50.67150166) return 38;
-    if (lat < 51.89342469) return 37;
-    if (lat < 53.09516153) return 36;
-    if (lat < 54.27817472) return 35;
-    if (lat < 55.44378444) return 34;
-    if (lat < 56.59318756) return 33;
-    if (lat < 57.72747354) return 32;
-    if (lat < 58.84763776) return 31;
-    if (lat < 59.95459277) return 30;
-    if (lat < 61.04917774) return 29;
-    if (lat < 62.13216659) return 28;
-    if (lat < 63.20427479) return 27;
-    if (lat < 64.26616523) return 26;
-    if (lat < 65.31845310) return 25;
-    if (lat < 66.36171008) return 24;
-    if (lat < 67.39646774) return 23;
-    if (lat < 68.42322022) return 22;
-    if (lat < 69.44242631) return 21;
-    if (lat < 70.45451075) return 20;
-    if (lat < 71.45986473) return 19;
-    if (lat < 72.45884545) return 18;
-    if (lat < 73.45177442) return 17;
-    if (lat < 74.43893416) return 16;
-    if (lat < 75.42056257) return 15;
-    if (lat < 76.39684391) return 14;
-    if (lat < 77.36789461) return 13;
-    if (lat < 78.33374083) return 12;
-    if (lat < 79.29428225) return 11;
-    if (lat < 80.24923213) return 10;
-    if (lat < 81.19801349) return 9;
-    if (lat < 82.13956981) return 8;
-    if (lat < 83.07199445) return 7;
-    if (lat < 83.99173563) return 6;
-    if (lat < 84.89166191) return 5;
-    if (lat < 85.75541621) return 4;
-    if (lat < 86.53536998) return 3;
-    if (lat < 87.00000000) return 2;
-    else return 1;
+    if (!(lat < 87.0)) return 1;
+
+    nl = cprNLByHalfDegree[(int) (lat * 2)];
+    if (lat >= cprNLZoneEnd[nl])
+        --nl;
+    return nl;
 }
 //
 //=========================================================================
 //
-static int cprNFunction(double lat, int fflag) {
-    int nl = cprNLFunction(lat) - (fflag ? 1 : 0);
+static int cprNFunction(int nl, int fflag) {
+    nl -= (fflag ? 1 : 0);
     if (nl < 1) nl = 1;
     return nl;
 }
 //
 //=========================================================================
 //
-static double cprDlonFunction(double lat, int fflag, int surface) {
-    return (surface ? 90.0 : 360.0) / cprNFunction(lat, fflag);
+static double cprDlonFunction(int nl, int fflag, int surface) {
+    return (surface ? 90.0 : 360.0) / cprNFunction(nl, fflag);
 }
 //
 //=========================================================================
@@ -172,6 +145,7 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
     double lon1 = odd_cprlon;
 
     double rlat, rlon;
+    int nl;
 
     // Compute the Latitude Index "j"
     int    j     = (int) floor(((59*lat0 - 60*lat1) / 131072) + 0.5);
@@ -186,21 +160,22 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1,1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1)-1)) -
-                              (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 0) * (cprModInt(m, ni)+lon1/131072);
+        int ni = cprNFunction(nl,1);
+        int m = (int) floor((((lon0 * (nl-1)) -
+                              (lon1 * nl)) / 131072.0) + 0.5);
+        rlon = cprDlonFunction(nl, 1, 0) * (cprModInt(m, ni)+lon1/131072);
         rlat = rlat1;
     } else {     // Use even packet.
-        int ni = cprNFunction(rlat0,0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0)-1)) -
-                              (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 0) * (cprModInt(m, ni)+lon0/131072);
+        int ni = cprNFunction(nl,0);
+        int m = (int) floor((((lon0 * (nl-1)) -
+                              (lon1 * nl)) / 131072) + 0.5);
+        rlon = cprDlonFunction(nl, 0, 0) * (cprModInt(m, ni)+lon0/131072);
         rlat = rlat0;
     }
 
@@ -226,6 +201,7 @@ int decodeCPRsurface(double reflat, double reflon,
     double lon0 = even_cprlon;
     double lon1 = odd_cprlon;
     double rlon, rlat;
+    int nl;
 
     // Compute the Latitude Index "j"
     int    j     = (int) floor(((59*lat0 - 60*lat1) / 131072) + 0.5);
@@ -278,21 +254,22 @@ int decodeCPRsurface(double reflat, double reflon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1,1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1)-1)) -
-                              (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 1) * (cprModInt(m, ni)+lon1/131072);
+        int ni = cprNFunction(nl,1);
+        int m = (int) floor((((lon0 * (nl-1)) -
+                              (lon1 * nl)) / 131072.0) + 0.5);
+        rlon = cprDlonFunction(nl, 1, 1) * (cprModInt(m, ni)+lon1/131072);
         rlat = rlat1;
     } else {     // Use even packet.
-        int ni = cprNFunction(rlat0,0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0)-1)) -
-                              (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 1) * (cprModInt(m, ni)+lon0/131072);
+        int ni = cprNFunction(nl,0);
+        int m = (int) floor((((lon0 * (nl-1)) -
+                              (lon1 * nl)) / 131072) + 0.5);
+        rlon = cprDlonFunction(nl, 0, 1) * (cprModInt(m, ni)+lon0/131072);
         rlat = rlat0;
     }
 
@@ -332,13 +309,18 @@ int decodeCPRrelative(double reflat, double reflon,
     double fractional_lat = cprlat / 131072.0;
     double fractional_lon = cprlon / 131072.0;
     double rlon, rlat;
+    double cell;
     int j,m;
 
     AirDlat = (surface ? 90.0 : 360.0) / (fflag ? 59.0 : 60.0);
 
     // Compute the Latitude Index "j"
-    j = (int) (floor(reflat/AirDlat) +
-               floor(0.5 + cprModDouble(reflat, AirDlat)/AirDlat - fractional_lat));
+    // (cell = floor(reflat/AirDlat); reflat/AirDlat - cell is the position
+    // of the reference within its cell, i.e. the always-positive MOD scaled
+    // to 0..1, without a separate fmod call)
+    cell = floor(reflat/AirDlat);
+    j = (int) (cell +
+               floor(0.5 + (reflat/AirDlat - cell) - fractional_lat));
     rlat = AirDlat * (j + fractional_lat);
     if (rlat >= 270) rlat -= 360;
 
@@ -353,9 +335,10 @@ int decodeCPRrelative(double reflat, double reflon,
     }
 
     // Compute the Longitude Index "m"
-    AirDlon = cprDlonFunction(rlat, fflag, surface);
-    m = (int) (floor(reflon/AirDlon) +
-               floor(0.5 + cprModDouble(reflon, AirDlon)/AirDlon - fractional_lon));
+    AirDlon = cprDlonFunction(cprNLFunction(rlat), fflag, surface);
+    cell = floor(reflon/AirDlon);
+    m = (int) (cell +
+               floor(0.5 + (reflon/AirDlon - cell) - fractional_lon));
     rlon = AirDlon * (m + fractional_lon);
     if (rlon > 180) rlon -= 360;
 
@@ -20,6 +20,9 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "cpr.h"
 
@@ -300,8 +303,121 @@ static int testCPRRelative() {
     return ok;
 }
 
-int main(int __attribute__ ((unused)) argc, char __attribute__ ((unused)) **argv) {
+// Throughput benchmark, run with --benchmark (see "make benchmarks")
+//
+// Sample results (x86-64, ns/decode):
+//                             airborne  surface  relative
+//   NL comparison chain, fmod:    82.4     86.0     137.9
+//   NL lookup table:              47.1     54.4      43.8
+
+#define BENCHMARK_POSITIONS 100000
+#define BENCHMARK_ROUNDS 20
+
+struct benchmark_cpr {
+    int even_cprlat, even_cprlon;
+    int odd_cprlat, odd_cprlon;
+};
+
+static struct {
+    double lat, lon;                // reference location, near the encoded position
+    struct benchmark_cpr airborne;
+    struct benchmark_cpr surface;
+} benchmarkData[BENCHMARK_POSITIONS];
+
+// CPR encoding, used only to build realistic benchmark input. Airborne
+// positions use 360 degree zones, surface positions 90 degree zones; both
+// are sent as 17-bit fractions of a zone. NL here uses the closed form from
+// 1090-WP-9-14 rather than the table.
+static void encodeCPR(double span, double lat, double lon, int fflag, int *out_cprlat, int *out_cprlon) {
+    double dlat = span / (fflag ? 59 : 60);
+    double yz = floor(131072 * (lat - dlat * floor(lat / dlat)) / dlat + 0.5);
+    double rlat = dlat * (yz / 131072 + floor(lat / dlat));
+    double c = cos(M_PI * rlat / 180.0);
+    int nl = (fabs(rlat) >= 87.0 ? 1 : (int) floor(2 * M_PI / acos(1 - (1 - cos(M_PI / 30)) / (c * c))));
+    int ni = (nl - fflag < 1 ? 1 : nl - fflag);
+    double dlon = span / ni;
+    double xz = floor(131072 * (lon - dlon * floor(lon / dlon)) / dlon + 0.5);
+
+    *out_cprlat = (int) yz & 0x1FFFF;
+    *out_cprlon = (int) xz & 0x1FFFF;
+}
+
+static double benchmarkElapsed(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void benchmarkCPR() {
+    struct timespec start;
+    double lat, lon, nanos;
+    double decodes = (double) BENCHMARK_POSITIONS * BENCHMARK_ROUNDS;
+    unsigned i, round;
+    int failed = 0;
+
+    srand(1);
+    for (i = 0; i < BENCHMARK_POSITIONS; ++i) {
+        lat = rand() * 170.0 / RAND_MAX - 85.0;
+        lon = rand() * 360.0 / RAND_MAX - 180.0;
+        encodeCPR(360.0, lat, lon, 0, &benchmarkData[i].airborne.even_cprlat, &benchmarkData[i].airborne.even_cprlon);
+        encodeCPR(360.0, lat, lon, 1, &benchmarkData[i].airborne.odd_cprlat, &benchmarkData[i].airborne.odd_cprlon);
+        encodeCPR(90.0, lat, lon, 0, &benchmarkData[i].surface.even_cprlat, &benchmarkData[i].surface.even_cprlon);
+        encodeCPR(90.0, lat, lon, 1, &benchmarkData[i].surface.odd_cprlat, &benchmarkData[i].surface.odd_cprlon);
+        benchmarkData[i].lat = lat + rand() * 1.0 / RAND_MAX - 0.5;
+        benchmarkData[i].lon = lon + rand() * 1.0 / RAND_MAX - 0.5;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        for (i = 0; i < BENCHMARK_POSITIONS; ++i) {
+            failed += (decodeCPRairborne(benchmarkData[i].airborne.even_cprlat, benchmarkData[i].airborne.even_cprlon,
+                                         benchmarkData[i].airborne.odd_cprlat, benchmarkData[i].airborne.odd_cprlon,
+                                         round & 1, &lat, &lon) != 0);
+        }
+    }
+    nanos = benchmarkElapsed(&start);
+    fprintf(stderr, "decodeCPRairborne:  %6.1f ns/decode\n", nanos / decodes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        for (i = 0; i < BENCHMARK_POSITIONS; ++i) {
+            failed += (decodeCPRsurface(benchmarkData[i].lat, benchmarkData[i].lon,
+                                        benchmarkData[i].surface.even_cprlat, benchmarkData[i].surface.even_cprlon,
+                                        benchmarkData[i].surface.odd_cprlat, benchmarkData[i].surface.odd_cprlon,
+                                        round & 1, &lat, &lon) != 0);
+        }
+    }
+    nanos = benchmarkElapsed(&start);
+    fprintf(stderr, "decodeCPRsurface:   %6.1f ns/decode\n", nanos / decodes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        for (i = 0; i < BENCHMARK_POSITIONS; ++i) {
+            if (round & 1)
+                failed += (decodeCPRrelative(benchmarkData[i].lat, benchmarkData[i].lon,
+                                             benchmarkData[i].airborne.odd_cprlat, benchmarkData[i].airborne.odd_cprlon,
+                                             1, 0, &lat, &lon) != 0);
+            else
+                failed += (decodeCPRrelative(benchmarkData[i].lat, benchmarkData[i].lon,
+                                             benchmarkData[i].airborne.even_cprlat, benchmarkData[i].airborne.even_cprlon,
+                                             0, 0, &lat, &lon) != 0);
+        }
+    }
+    nanos = benchmarkElapsed(&start);
+    fprintf(stderr, "decodeCPRrelative:  %6.1f ns/decode\n", nanos / decodes);
+
+    // keeps the decodes from being optimized away, and is a useful sanity check
+    fprintf(stderr, "(%d decodes did not produce a position)\n", failed);
+}
+
+int main(int argc, char **argv) {
     int ok = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        benchmarkCPR();
+        return 0;
+    }
+
     ok = testCPRGlobalAirborne() && ok;
     ok = testCPRGlobalSurface() && ok;
     ok = testCPRRelative() && ok;
@@ -58,14 +58,35 @@ static inline int slice_phase4(uint16_t *m) {
     return m[0] + 5 * m[1] - 5 * m[2] - m[3];
 }
 
+// Accepted messages are collected into a fixed arena of message slots and
+// handed to useModesMessages() in batches, rather than one at a time. Only
+// the small message header needs clearing between uses (see resetModesMessage)
+// so we avoid copying a whole zeroed struct modesMessage for every candidate.
+#define DEMOD_BATCH_SIZE 64
+
+static struct modesMessage demod_batch[DEMOD_BATCH_SIZE];
+static unsigned demod_batch_used;
+
+static void flushDemodBatch(void)
+{
+    unsigned i;
+
+    if (!demod_batch_used)
+        return;
+
+    useModesMessages(demod_batch, demod_batch_used);
+    for (i = 0; i < demod_batch_used; ++i)
+        resetModesMessage(&demod_batch[i]);
+    demod_batch_used = 0;
+}
+
 //
 // Given 'mlen' magnitude samples in 'm', sampled at 2.4MHz,
 // try to demodulate some Mode S messages.
 //
 void demodulate2400(struct mag_buf *mag)
 {
-    static struct modesMessage zeroMessage;
-    struct modesMessage mm;
+    struct modesMessage *mm;
     unsigned char msg1[MODES_LONG_MSG_BYTES], msg2[MODES_LONG_MSG_BYTES], *msg;
     uint32_t j;
 
@@ -305,30 +326,31 @@ void demodulate2400(struct mag_buf *mag)
 
         msglen = modesMessageLenByType(bestmsg[0] >> 3);
 
-        // Set initial mm structure details
-        mm = zeroMessage;
+        // Set initial mm structure details; the next free arena slot already has a clear header
+        mm = &demod_batch[demod_batch_used];
 
         // For consistency with how the Beast / Radarcape does it,
         // we report the timestamp at the end of bit 56 (even if
         // the frame is a 112-bit frame)
-        mm.timestampMsg = mag->sampleTimestamp + j*5 + (8 + 56) * 12 + bestphase;
+        mm->timestampMsg = mag->sampleTimestamp + j*5 + (8 + 56) * 12 + bestphase;
 
         // compute message receive time as block-start-time + difference in the 12MHz clock
-        mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+        mm->sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm->timestampMsg);
 
-        mm.score = bestscore;
+        mm->score = bestscore;
 
         // Decode the received message
         {
-            int result = decodeModesMessage(&mm, bestmsg);
+            int result = decodeModesMessage(mm, bestmsg);
             if (result < 0) {
                 if (result == -1)
                     Modes.stats_current.demod_rejected_unknown_icao++;
                 else
                     Modes.stats_current.demod_rejected_bad++;
+                resetModesMessage(mm);
                 continue;
             } else {
-                Modes.stats_current.demod_accepted[mm.correctedbits]++;
+                Modes.stats_current.demod_accepted[mm->correctedbits]++;
             }
         }
 
@@ -345,14 +367,14 @@ void demodulate2400(struct mag_buf *mag)
             }
 
             signal_power = scaled_signal_power / 65535.0 / 65535.0;
-            mm.signalLevel = signal_power / signal_len;
+            mm->signalLevel = signal_power / signal_len;
             Modes.stats_current.signal_power_sum += signal_power;
             Modes.stats_current.signal_power_count += signal_len;
             sum_scaled_signal_power += scaled_signal_power;
 
-            if (mm.signalLevel > Modes.stats_current.peak_signal_power)
-                Modes.stats_current.peak_signal_power = mm.signalLevel;
-            if (mm.signalLevel > 0.50119)
+            if (mm->signalLevel > Modes.stats_current.peak_signal_power)
+                Modes.stats_current.peak_signal_power = mm->signalLevel;
+            if (mm->signalLevel > 0.50119)
                 Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
         }
 
@@ -364,10 +386,14 @@ void demodulate2400(struct mag_buf *mag)
         //  overlap)
         j += msglen*12/5;
 
-        // Pass data to the next layer
-        useModesMessage(&mm);
+        // Queue for the next layer
+        if (++demod_batch_used == DEMOD_BATCH_SIZE)
+            flushDemodBatch();
     }
 
+    // Pass any remaining data to the next layer
+    flushDemodBatch();
+
     /* update noise power */
     {
         double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
@@ -477,7 +503,7 @@ void demodulate2400AC(struct mag_buf *mag)
     uint32_t mlen = mag->validLength - mag->overlap;
     unsigned f1_sample;
 
-    memset(&mm, 0, sizeof(mm));
+    resetModesMessage(&mm);
 
     double noise_stddev = sqrt(mag->mean_power - mag->mean_level * mag->mean_level); // Var(X) = E[(X-E[X])^2] = E[X^2] - (E[X])^2
     unsigned noise_level = (unsigned) ((mag->mean_power + noise_stddev) * 65535 + 0.5);
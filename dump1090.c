@@ -113,6 +113,9 @@ static void modesInitConfig(void) {
     Modes.freq                    = MODES_DEFAULT_FREQ;
     Modes.check_crc               = 1;
     Modes.net_heartbeat_interval  = MODES_NET_HEARTBEAT_INTERVAL;
+    Modes.net_output_backlog      = MODES_NET_OUTPUT_BACKLOG;
+    Modes.net_read_buffer         = MODES_NET_READ_BUFFER;
+    Modes.net_udp_ttl             = 1;
     Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
     Modes.json_interval           = 1000;
     Modes.json_location_accuracy  = 1;
@@ -169,6 +172,11 @@ static void modesInit(void) {
       {Modes.net_output_flush_interval = MODES_OUT_FLUSH_INTERVAL;}
     if (Modes.net_sndbuf_size > (MODES_NET_SNDBUF_MAX))
       {Modes.net_sndbuf_size = MODES_NET_SNDBUF_MAX;}
+    // A client must be able to fall at least two output segments behind
+    if (Modes.net_output_backlog < (2 * MODES_OUT_SEGMENT_SIZE))
+      {Modes.net_output_backlog = 2 * MODES_OUT_SEGMENT_SIZE;}
+    if (Modes.net_read_buffer < MODES_CLIENT_BUF_SIZE)
+      {Modes.net_read_buffer = MODES_CLIENT_BUF_SIZE;}
 
     // Prepare the log10 lookup table: 100log10(x)
     Modes.log10lut[0] = 0; // poorly defined..
@@ -258,6 +266,9 @@ static void showVersion()
 #ifdef ENABLE_LIMESDR
            "ENABLE_LIMESDR "
 #endif
+#ifdef ENABLE_ZLIB
+           "ENABLE_ZLIB "
+#endif
 #ifdef SC16Q11_TABLE_BITS
     // This is a little silly, but that's how the preprocessor works..
 #define _stringize(x) #x
@@ -296,10 +307,31 @@ static void showHelp(void)
 "--net-bi-port <ports>    TCP Beast input listen ports  (default: 30004,30104)\n"
 "--net-bo-port <ports>    TCP Beast output listen ports (default: 30005)\n"
 "--net-stratux-port <ports>   TCP Stratux output listen ports (default: disabled)\n"
+"--net-udp-bo <host:port>[,...]  Also send Beast output as UDP datagrams to these\n"
+"                         unicast or multicast destinations (default: none)\n"
+"--net-udp-ro <host:port>[,...]  Same, for raw output\n"
+"--net-udp-bi <[addr:]port>[,...]  Receive Beast datagrams on these UDP ports; with a\n"
+"                         multicast group as addr, join that group (default: none)\n"
+"--net-udp-ri <[addr:]port>[,...]  Same, for raw datagrams\n"
+"--net-udp-ttl <n>        TTL of multicast output datagrams (default: 1)\n"
 "--net-ro-size <size>     TCP output minimum size (default: 0)\n"
 "--net-ro-interval <rate> TCP output memory flush rate in seconds (default: 0)\n"
 "--net-heartbeat <rate>   TCP heartbeat rate in seconds (default: 60 sec; 0 to disable)\n"
 "--net-buffer <n>         TCP buffer size 64Kb * (2^n) (default: n=0, 64Kb)\n"
+"--net-backlog <kbytes>   Output queued per client when its socket is full (default: 256)\n"
+"--net-read-buffer <kbytes>  Read buffer for each network input connection (default: 64)\n"
+"--net-ro-overflow <p>    What to do when a raw output client's backlog is full:\n"
+"                         drop-oldest, drop-newest or disconnect (default: drop-oldest)\n"
+"--net-sbs-overflow <p>   Same, for BaseStation output clients\n"
+"--net-bo-overflow <p>    Same, for Beast output clients\n"
+"--net-stratux-overflow <p>   Same, for Stratux output clients\n"
+"--net-filter <port>:<filter>  Only send clients of this output port the messages\n"
+"                         matching <filter>, made up of any of: icao=<hex>[-<hex>][,...]\n"
+"                         df=<n>[,...] adsb bbox=<s>,<w>,<n>,<e> (e.g. \"30105:df=17,18;adsb\")\n"
+"--net-thread             Do network I/O in a separate thread\n"
+"--net-uring              Use io_uring for network I/O (Linux 6.0+, falls back to epoll)\n"
+"--net-compress <ports>   Compress the connections to these listen ports with zlib\n"
+"                         (output ports: what we send; input ports: what we receive)\n"
 "--net-verbatim           Make Beast-format output connections default to verbatim mode\n"
 "                         (forward all messages, without applying CRC corrections)\n"
 "--forward-mlat           Allow forwarding of received mlat results to output ports\n"
@@ -322,6 +354,8 @@ static void showHelp(void)
 "--show-only <addr>       Show only messages from the given ICAO on stdout\n"
 "--write-json <dir>       Periodically write json output to <dir> (for serving by a separate webserver)\n"
 "--write-json-every <t>   Write json output every t seconds (default 1)\n"
+"--write-json-region <s>,<w>,<n>,<e>  Also write aircraft_region.json, holding only\n"
+"                         the aircraft inside this box\n"
 "--json-location-accuracy <n>  Accuracy of receiver location in json metadata: 0=no location, 1=approximate, 2=exact\n"
 "--dcfilter               Apply a 1Hz DC filter to input data (requires more CPU)\n"
 "--version                Show version and build options\n"
@@ -417,6 +451,8 @@ static void backgroundTasks(void) {
 
     if (Modes.json_dir && now >= next_json) {
         writeJsonToFile("aircraft.json", generateAircraftJson);
+        if (Modes.json_region)
+            writeJsonToFile("aircraft_region.json", generateRegionJson);
         next_json = now + Modes.json_interval;
     }
 
@@ -449,6 +485,23 @@ static void backgroundTasks(void) {
 //=========================================================================
 //
 
+static overflow_policy_t parseOverflowPolicy(const char *policy)
+{
+    if (!strcmp(policy, "drop-oldest"))
+        return OVERFLOW_DROP_OLDEST;
+    if (!strcmp(policy, "drop-newest"))
+        return OVERFLOW_DROP_NEWEST;
+    if (!strcmp(policy, "disconnect"))
+        return OVERFLOW_DISCONNECT;
+
+    fprintf(stderr, "Unknown overflow policy '%s' (expected drop-oldest, drop-newest or disconnect)\n", policy);
+    exit(1);
+}
+
+//
+//=========================================================================
+//
+
 static void applyNetDefaults()
 {
     if (!Modes.net_input_raw_ports)
@@ -538,6 +591,24 @@ int main(int argc, char **argv) {
             Modes.net = 1;
             free(Modes.net_input_beast_ports);
             Modes.net_input_beast_ports = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-udp-bo") && more) {
+            Modes.net = 1;
+            free(Modes.net_udp_beast_out);
+            Modes.net_udp_beast_out = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-udp-ro") && more) {
+            Modes.net = 1;
+            free(Modes.net_udp_raw_out);
+            Modes.net_udp_raw_out = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-udp-bi") && more) {
+            Modes.net = 1;
+            free(Modes.net_udp_beast_in);
+            Modes.net_udp_beast_in = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-udp-ri") && more) {
+            Modes.net = 1;
+            free(Modes.net_udp_raw_in);
+            Modes.net_udp_raw_in = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-udp-ttl") && more) {
+            Modes.net_udp_ttl = atoi(argv[++j]);
         } else if (!strcmp(argv[j],"--net-bind-address") && more) {
             free(Modes.net_bind_address);
             Modes.net_bind_address = strdup(argv[++j]);
@@ -555,6 +626,33 @@ int main(int argc, char **argv) {
             Modes.net_output_stratux_ports = strdup(argv[++j]);
         } else if (!strcmp(argv[j],"--net-buffer") && more) {
             Modes.net_sndbuf_size = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-backlog") && more) {
+            Modes.net_output_backlog = 1024 * atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-read-buffer") && more) {
+            Modes.net_read_buffer = 1024 * atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-ro-overflow") && more) {
+            Modes.raw_out.overflow = parseOverflowPolicy(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-sbs-overflow") && more) {
+            Modes.sbs_out.overflow = parseOverflowPolicy(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-bo-overflow") && more) {
+            Modes.beast_cooked_out.overflow = Modes.beast_verbatim_out.overflow = parseOverflowPolicy(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-stratux-overflow") && more) {
+            Modes.stratux_out.overflow = parseOverflowPolicy(argv[++j]);
+        } else if (!strcmp(argv[j],"--net-filter") && more) {
+            if (netAddPortFilter(argv[++j]) < 0)
+                exit(1);
+        } else if (!strcmp(argv[j],"--net-thread")) {
+            Modes.net_thread = 1;
+        } else if (!strcmp(argv[j],"--net-uring")) {
+            Modes.net_uring = 1;
+        } else if (!strcmp(argv[j],"--net-compress") && more) {
+#ifdef ENABLE_ZLIB
+            free(Modes.net_compress_ports);
+            Modes.net_compress_ports = strdup(argv[++j]);
+#else
+            ++j;
+            fprintf(stderr, "warning: --net-compress not supported in this build, option ignored.\n");
+#endif
         } else if (!strcmp(argv[j],"--net-verbatim")) {
             Modes.net_verbatim = 1;
         } else if (!strcmp(argv[j],"--forward-mlat")) {
@@ -610,6 +708,9 @@ int main(int argc, char **argv) {
             Modes.json_interval = (uint64_t)(1000 * atof(argv[++j]));
             if (Modes.json_interval < 100) // 0.1s
                 Modes.json_interval = 100;
+        } else if (!strcmp(argv[j], "--write-json-region") && more) {
+            if (netSetJsonRegion(argv[++j]) < 0)
+                exit(1);
         } else if (!strcmp(argv[j], "--json-location-accuracy") && more) {
             Modes.json_location_accuracy = atoi(argv[++j]);
         } else if (sdrHandleOption(argc, argv, &j)) {
@@ -661,6 +762,8 @@ int main(int argc, char **argv) {
     writeJsonToFile("receiver.json", generateReceiverJson);
     writeJsonToFile("stats.json", generateStatsJson);
     writeJsonToFile("aircraft.json", generateAircraftJson);
+    if (Modes.json_region)
+        writeJsonToFile("aircraft_region.json", generateRegionJson);
 
     interactiveInit();
 
@@ -669,13 +772,13 @@ int main(int argc, char **argv) {
     if (Modes.sdr_type == SDR_NONE) {
         while (!Modes.exit) {
             struct timespec start_time;
-            struct timespec slp = { 0, 100 * 1000 * 1000};
 
             start_cpu_timing(&start_time);
             backgroundTasks();
             end_cpu_timing(&start_time, &Modes.stats_current.background_cpu);
 
-            nanosleep(&slp, NULL);
+            // sleep until there's network input or output is due
+            modesNetWait(100);
         }
     } else {
         int watchdogCounter = 10; // about 1 second
@@ -685,7 +788,8 @@ int main(int argc, char **argv) {
 
         while (!Modes.exit) {
             // get the next sample buffer off the FIFO; wait only up to 100ms
-            // this is fairly aggressive as all our network I/O runs out of the background work!
+            // this is fairly aggressive as all our network I/O runs out of the background work
+            // (unless it has a thread of its own)!
             struct mag_buf *buf = fifo_dequeue(100 /* milliseconds */);
             struct timespec start_time;
 
@@ -725,6 +829,10 @@ int main(int argc, char **argv) {
         pthread_join(Modes.reader_thread,NULL);     // Wait on reader thread exit
     }
 
+    if (Modes.net) {
+        modesNetShutdown();
+    }
+
     interactiveCleanup();
 
     // If --stats were given, print statistics
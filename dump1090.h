@@ -122,6 +122,7 @@
 #define MODES_OUT_BUF_SIZE         (1500)
 #define MODES_OUT_FLUSH_SIZE       (MODES_OUT_BUF_SIZE - 256)
 #define MODES_OUT_FLUSH_INTERVAL   (60000)
+#define MODES_OUT_SEGMENT_SIZE     (16*1024)    // output is shared between clients in segments of this size
 
 #define MODES_USER_LATLON_VALID (1<<0)
 
@@ -237,9 +238,11 @@ typedef enum {
 
 #define MODES_NET_HEARTBEAT_INTERVAL 60000      // milliseconds
 
-#define MODES_CLIENT_BUF_SIZE  1024
+#define MODES_CLIENT_BUF_SIZE  1024          // read buffer for clients that only send us commands
+#define MODES_NET_READ_BUFFER  (64*1024)     // default read buffer for network input clients, bytes
 #define MODES_NET_SNDBUF_SIZE (1024*64)
 #define MODES_NET_SNDBUF_MAX  (7)
+#define MODES_NET_OUTPUT_BACKLOG (256*1024)     // per-client pending output limit, bytes
 
 #define HISTORY_SIZE 120
 #define HISTORY_INTERVAL 30000
@@ -293,7 +296,7 @@ struct _Modes {                             // Internal state
 
     // Networking
     char           aneterr[ANET_ERR_LEN];
-    struct net_service *services;    // Active services
+    _Atomic(struct net_service *) services; // Active services
     struct client *clients;          // Our clients
 
     struct net_service *beast_verbatim_service;  // Beast-format output service, verbatim mode
@@ -315,7 +318,7 @@ struct _Modes {                             // Internal state
     int   nfix_crc;                  // Number of crc bit error(s) to correct
     int   check_crc;                 // Only display messages with good CRC
     int   raw;                       // Raw output format
-    int   mode_ac;                   // Enable decoding of SSR Modes A & C
+    atomic_int mode_ac;              // Enable decoding of SSR Modes A & C (may be set by the network thread)
     int   mode_ac_auto;              // allow toggling of A/C by Beast commands
     int   net;                       // Enable networking
     int   net_only;                  // Enable just networking
@@ -328,8 +331,18 @@ struct _Modes {                             // Internal state
     char *net_output_stratux_ports;  // List of Stratux output TCP ports
     char *net_input_beast_ports;     // List of Beast input TCP ports
     char *net_output_beast_ports;    // List of Beast output TCP ports
+    char *net_udp_beast_out;         // List of <host>:<port> to send Beast output datagrams to
+    char *net_udp_raw_out;           // List of <host>:<port> to send raw output datagrams to
+    char *net_udp_beast_in;          // List of [<address>:]<port> to receive Beast datagrams on
+    char *net_udp_raw_in;            // List of [<address>:]<port> to receive raw datagrams on
+    int   net_udp_ttl;               // TTL (hop limit) for multicast output datagrams
     char *net_bind_address;          // Bind address
     int   net_sndbuf_size;           // TCP output buffer size (64Kb * 2^n)
+    int   net_output_backlog;        // Maximum output queued per client when its socket is full (bytes)
+    int   net_read_buffer;           // Read buffer size for network input clients (bytes)
+    int   net_thread;                // if true, network I/O runs in its own thread
+    int   net_uring;                 // if true, use io_uring for network I/O when the kernel supports it
+    char *net_compress_ports;        // listen ports whose connections are zlib-compressed
     int   net_verbatim;              // if true, Beast output connections default to verbatim mode
     int   forward_mlat;              // allow forwarding of mlat messages to output ports
     int   quiet;                     // Suppress stdout
@@ -345,6 +358,8 @@ struct _Modes {                             // Internal state
     char *json_dir;                  // Path to json base directory, or NULL not to write json.
     uint64_t json_interval;          // Interval between rewriting the json aircraft file, in milliseconds; also the advertised map refresh interval
     int   json_location_accuracy;    // Accuracy of location metadata: 0=none, 1=approx, 2=exact
+    int   json_region;               // Also write aircraft_region.json for the aircraft inside this box:
+    double json_region_south, json_region_west, json_region_north, json_region_east;
 
     int   json_aircraft_history_next;
     struct {
@@ -375,27 +390,32 @@ extern struct _Modes Modes;
 
 // The struct we use to store information about a decoded message.
 struct modesMessage {
-    // Generic fields
+    // Generic fields. These form a small header that is filled in by the
+    // demodulator / network readers and the CRC checks; it is the only part
+    // that must be cleared before decoding (see resetModesMessage)
     unsigned char msg[MODES_LONG_MSG_BYTES];      // Binary message.
     unsigned char verbatim[MODES_LONG_MSG_BYTES]; // Binary message, as originally received before correction
+    uint64_t      timestampMsg;                   // Timestamp of the message (12MHz clock)
+    uint64_t      sysTimestampMsg;                // Timestamp of the message (system time)
+    double        signalLevel;                    // RSSI, in the range [0..1], as a fraction of full-scale power
     int           msgbits;                        // Number of bits in message
     int           msgtype;                        // Downlink format #
     uint32_t      crc;                            // Message CRC
     int           correctedbits;                  // No. of bits corrected
     uint32_t      addr;                           // Address Announced
     addrtype_t    addrtype;                       // address format / source
-    uint64_t      timestampMsg;                   // Timestamp of the message (12MHz clock)
-    uint64_t      sysTimestampMsg;                // Timestamp of the message (system time)
     int           remote;                         // If set this message is from a remote station
-    double        signalLevel;                    // RSSI, in the range [0..1], as a fraction of full-scale power
     int           score;                          // Scoring from scoreModesMessage, if used
     int           reliable;                       // is this a "reliable" message (uncorrected DF11/DF17/DF18)?
-
     datasource_t  source;                         // Characterizes the overall message source
+    unsigned      IID;                            // extracted from CRC of DF11s
+    int           decoded;                        // Set once the fields below have been decoded
+
+    // Everything from here on is only populated on demand, once the message
+    // has passed the CRC checks (see decodeModesMessageFields)
 
     // Raw data, just extracted directly from the message
     // The names reflect the field names in Annex 4
-    unsigned IID; // extracted from CRC of DF11s
     unsigned AA;
     unsigned AC;
     unsigned CA;
@@ -485,7 +505,6 @@ struct modesMessage {
     cpr_type_t cpr_type;       // The encoding type used (surface, airborne, coarse TIS-B)
     unsigned   cpr_lat;        // Non decoded latitude.
     unsigned   cpr_lon;        // Non decoded longitude.
-    unsigned   cpr_nucp;       // NUCp/NIC value implied by message type
 
     airground_t airground;     // air/ground state
 
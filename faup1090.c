@@ -73,6 +73,11 @@ static void faupInitConfig(void) {
     Modes.check_crc               = 1;
     Modes.net                     = 1;
     Modes.net_heartbeat_interval  = MODES_NET_HEARTBEAT_INTERVAL;
+    Modes.net_output_backlog      = MODES_NET_OUTPUT_BACKLOG;
+    Modes.net_read_buffer         = MODES_NET_READ_BUFFER;
+    // FATSV output only sends what changed, so dropping part of it would
+    // leave the consumer with a wrong picture; make it reconnect instead
+    Modes.fatsv_out.overflow      = OVERFLOW_DISCONNECT;
     Modes.maxRange                = 1852 * 360; // 360NM default max range; this also disables receiver-relative positions
     Modes.quiet                   = 1;
     Modes.net_output_flush_size   = MODES_OUT_FLUSH_SIZE;
@@ -209,9 +214,8 @@ int main(int argc, char **argv) {
 
     // Run it until we've lost either connection
     while (!Modes.exit && beast_input->connections && fatsv_output->connections) {
-        struct timespec r = { 0, 100 * 1000 * 1000};
         backgroundTasks();
-        nanosleep(&r, NULL);
+        modesNetWait(100);
     }
 
     return 0;
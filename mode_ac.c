@@ -122,6 +122,9 @@ static int internalModeAToModeC(unsigned int ModeA)
 //
 void decodeModeAMessage(struct modesMessage *mm, int ModeA)
 {
+    resetModesMessageDecoded(mm);
+    mm->decoded = 1;
+
     mm->source = SOURCE_MODE_AC;
     mm->addrtype = ADDR_MODE_A;
     mm->msgtype = 32; // Valid Mode S DF's are DF-00 to DF-31.
@@ -530,11 +530,50 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg)
         return -2;
     }
 
-    // decode the bulk of the message
+    // Address announced
+    if (mm->msgtype == 11 || mm->msgtype == 17 || mm->msgtype == 18) {
+        mm->addr = getbits(msg, 9, 32);
+    }
+
+    if (!mm->correctedbits && (mm->msgtype == 17 || (mm->msgtype == 11 && mm->IID == 0))) {
+        // No CRC errors seen, and either it was an DF17 extended squitter
+        // or a DF11 acquisition squitter with II = 0. We probably have the right address.
+
+        // Don't do this for DF18, as a DF18 transmitter doesn't necessarily have a
+        // Mode S transponder.
+
+        // NB this is the only place that adds addresses!
+        icaoFilterAdd(mm->addr);
+    }
+
+    // MLAT overrides all other sources
+    if (mm->remote && mm->timestampMsg == MAGIC_MLAT_TIMESTAMP)
+        mm->source = SOURCE_MLAT;
+
+    // The rest of the message is decoded on demand by decodeModesMessageFields()
+    return 0;
+}
+
+//
+// Decode the bulk of a message that has already passed decodeModesMessage().
+// This is done on demand by consumers that need more than the raw bits,
+// address and reliability (the tracker, message display, and the decoded
+// output formats) so that a forward-only node never pays for it.
+// Safe to call more than once.
+//
+void decodeModesMessageFields(struct modesMessage *mm)
+{
+    unsigned char *msg = mm->msg;
+
+    if (mm->decoded)
+        return;
+    mm->decoded = 1;
+
+    resetModesMessageDecoded(mm);
 
     // AA (Address announced)
     if (mm->msgtype == 11 || mm->msgtype == 17 || mm->msgtype == 18) {
-        mm->AA = mm->addr = getbits(msg, 9, 32);
+        mm->AA = mm->addr;
     }
 
     // AC (Altitude Code)
@@ -690,30 +729,18 @@ int decodeModesMessage(struct modesMessage *mm, unsigned char *msg)
             mm->airground = AG_UNCERTAIN;
     }
 
-    if (!mm->correctedbits && (mm->msgtype == 17 || (mm->msgtype == 11 && mm->IID == 0))) {
-        // No CRC errors seen, and either it was an DF17 extended squitter
-        // or a DF11 acquisition squitter with II = 0. We probably have the right address.
-
-        // Don't do this for DF18, as a DF18 transmitter doesn't necessarily have a
-        // Mode S transponder.
-
-        // NB this is the only place that adds addresses!
-        icaoFilterAdd(mm->addr);
-    }
-
-    // MLAT overrides all other sources
+    // MLAT overrides all other sources, including TIS-B / ADS-R set by the ES decoding
     if (mm->remote && mm->timestampMsg == MAGIC_MLAT_TIMESTAMP)
         mm->source = SOURCE_MLAT;
-
-    // all done
-    return 0;
 }
 
-static void decodeESIdentAndCategory(struct modesMessage *mm)
+static void decodeESIdentAndCategory(struct modesMessage *mm, int check_imf)
 {
     // Aircraft Identification and Category
     unsigned char *me = mm->ME;
 
+    MODES_NOTUSED(check_imf);
+
     mm->mesub = getbits(me, 6, 8);
 
     mm->callsign[0] = ais_charset[getbits(me, 9, 14)];
@@ -883,7 +910,6 @@ static void decodeESSurfacePosition(struct modesMessage *mm, int check_imf)
 
     mm->airground = AG_GROUND; // definitely.
     mm->cpr_valid = 1;
-    mm->cpr_type = CPR_SURFACE;
 
     // 6-12: Movement
     unsigned movement = getbits(me, 6, 12);
@@ -978,7 +1004,6 @@ static void decodeESAirbornePosition(struct modesMessage *mm, int check_imf)
         } else {
             // Otherwise, assume it's valid.
             mm->cpr_valid = 1;
-            mm->cpr_type = CPR_AIRBORNE;
             mm->cpr_odd = getbit(me, 22);
         }
     }
@@ -1000,10 +1025,12 @@ static void decodeESAirbornePosition(struct modesMessage *mm, int check_imf)
     }
 }
 
-static void decodeESTestMessage(struct modesMessage *mm)
+static void decodeESTestMessage(struct modesMessage *mm, int check_imf)
 {
     unsigned char *me = mm->ME;
 
+    MODES_NOTUSED(check_imf);
+
     mm->mesub = getbits(me, 6, 8);
 
     if (mm->mesub == 7) {               // (see 1090-WP-15-20)
@@ -1353,6 +1380,52 @@ static void decodeESOperationalStatus(struct modesMessage *mm, int check_imf)
     }
 }
 
+//
+// Extended squitter dispatch table, indexed by ME type. Each entry gives the
+// decoder for that type (which interprets the subtype itself, if any) and,
+// for position types, the CPR encoding. Types with no entry are not known
+// to be valid and mark the message as unreliable.
+//
+typedef void (*ESDecoderFn)(struct modesMessage *mm, int check_imf);
+
+struct es_type_info {
+    unsigned known : 1;
+    ESDecoderFn decode;
+    cpr_type_t cpr_type;
+};
+
+static const struct es_type_info es_types[32] = {
+    [0]  = { 1, decodeESAirbornePosition,  CPR_AIRBORNE }, // Airborne position, baro altitude only
+    [1]  = { 1, decodeESIdentAndCategory,  CPR_AIRBORNE },
+    [2]  = { 1, decodeESIdentAndCategory,  CPR_AIRBORNE },
+    [3]  = { 1, decodeESIdentAndCategory,  CPR_AIRBORNE },
+    [4]  = { 1, decodeESIdentAndCategory,  CPR_AIRBORNE },
+    [5]  = { 1, decodeESSurfacePosition,   CPR_SURFACE },
+    [6]  = { 1, decodeESSurfacePosition,   CPR_SURFACE },
+    [7]  = { 1, decodeESSurfacePosition,   CPR_SURFACE },
+    [8]  = { 1, decodeESSurfacePosition,   CPR_SURFACE },
+    [9]  = { 1, decodeESAirbornePosition,  CPR_AIRBORNE }, // Airborne position, baro
+    [10] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [11] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [12] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [13] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [14] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [15] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [16] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [17] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [18] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [19] = { 1, decodeESAirborneVelocity,  CPR_AIRBORNE },
+    [20] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE }, // Airborne position, geometric altitude (HAE or MSL)
+    [21] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [22] = { 1, decodeESAirbornePosition,  CPR_AIRBORNE },
+    [23] = { 1, decodeESTestMessage,       CPR_AIRBORNE },
+    [24] = { 1, NULL,                      CPR_AIRBORNE }, // Reserved for Surface System Status
+    [28] = { 1, decodeESAircraftStatus,    CPR_AIRBORNE },
+    [29] = { 1, decodeESTargetStatus,      CPR_AIRBORNE },
+    [30] = { 1, NULL,                      CPR_AIRBORNE }, // Aircraft Operational Coordination
+    [31] = { 1, decodeESOperationalStatus, CPR_AIRBORNE },
+};
+
 static void decodeExtendedSquitter(struct modesMessage *mm)
 {
     unsigned char *me = mm->ME;
@@ -1411,52 +1484,20 @@ static void decodeExtendedSquitter(struct modesMessage *mm)
         }
     }
 
-    switch (metype) {
-    case 1: case 2: case 3: case 4:
-        decodeESIdentAndCategory(mm);
-        break;
-
-    case 19:
-        decodeESAirborneVelocity(mm, check_imf);
-        break;
-
-    case 5: case 6: case 7: case 8:
-        decodeESSurfacePosition(mm, check_imf);
-        break;
-
-    case 0: // Airborne position, baro altitude only
-    case 9: case 10: case 11: case 12: case 13: case 14: case 15: case 16: case 17: case 18: // Airborne position, baro
-    case 20: case 21: case 22: // Airborne position, geometric altitude (HAE or MSL)
-        decodeESAirbornePosition(mm, check_imf);
-        break;
-
-    case 23:
-        decodeESTestMessage(mm);
-        break;
-
-    case 24: // Reserved for Surface System Status
-        break;
-
-    case 28:
-        decodeESAircraftStatus(mm, check_imf);
-        break;
-
-    case 29:
-        decodeESTargetStatus(mm, check_imf);
-        break;
-
-    case 30: // Aircraft Operational Coordination
-        break;
-
-    case 31:
-        decodeESOperationalStatus(mm, check_imf);
-        break;
+    const struct es_type_info *info = &es_types[metype];
 
-    default:
+    ++Modes.stats_current.es_type[metype];
+    if (!info->known) {
         // Dubious.
         mm->reliable = 0;
-        break;
+        return;
     }
+
+    if (info->decode)
+        info->decode(mm, check_imf);
+
+    if (mm->cpr_valid)
+        mm->cpr_type = info->cpr_type;
 }
 
 static const char *df_names[33] = {
@@ -1768,6 +1809,8 @@ static const char *esTypeName(unsigned metype, unsigned mesub)
 void displayModesMessage(struct modesMessage *mm) {
     int j;
 
+    decodeModesMessageFields(mm);
+
     // Handle only addresses mode first.
     if (Modes.onlyaddr) {
         printf("%06x\n", mm->addr);
@@ -2138,13 +2181,27 @@ void displayModesMessage(struct modesMessage *mm) {
 // Basically this function passes a raw message to the upper layers for further
 // processing and visualization
 //
+//
+// Does anything currently consume tracked aircraft state? If not, e.g. on a
+// forward-only node whose only clients want verbatim Beast data, we skip
+// tracking, and with it decodeModesMessageFields(), entirely.
+//
+static int trackingNeeded(void)
+{
+    if (!Modes.net || !Modes.quiet || Modes.interactive || Modes.json_dir || Modes.stats)
+        return 1;
+
+    return modesNetNeedsTracking();
+}
+
 void useModesMessage(struct modesMessage *mm) {
-    struct aircraft *a;
+    struct aircraft *a = NULL;
 
     ++Modes.stats_current.messages_total;
 
     // Track aircraft state
-    a = trackUpdateFromMessage(mm);
+    if (trackingNeeded())
+        a = trackUpdateFromMessage(mm);
 
     // In non-interactive non-quiet mode, display messages on standard output
     if (!Modes.interactive && !Modes.quiet && (!Modes.show_only || mm->addr == Modes.show_only)) {
@@ -2157,6 +2214,37 @@ void useModesMessage(struct modesMessage *mm) {
     }
 }
 
+//
+// Pass a batch of decoded messages to the next layer. This is equivalent to
+// calling useModesMessage() on each message in turn, but the output mode
+// and tracking checks are done once per batch rather than once per message.
+//
+void useModesMessages(struct modesMessage *mms, unsigned count) {
+    int display = !Modes.interactive && !Modes.quiet;
+    int net = Modes.net;
+    int track = trackingNeeded();
+    unsigned i;
+
+    Modes.stats_current.messages_total += count;
+
+    for (i = 0; i < count; ++i) {
+        struct modesMessage *mm = &mms[i];
+        struct aircraft *a = NULL;
+
+        // Track aircraft state
+        if (track)
+            a = trackUpdateFromMessage(mm);
+
+        if (display && (!Modes.show_only || mm->addr == Modes.show_only)) {
+            displayModesMessage(mm);
+        }
+
+        if (net) {
+            modesQueueOutput(mm, a);
+        }
+    }
+}
+
 //
 // ===================== Mode S detection and decoding  ===================
 //
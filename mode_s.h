@@ -22,6 +22,8 @@
 #define MODE_S_H
 
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
 
 //
 // Functions exported from mode_s.c
@@ -29,8 +31,27 @@
 int modesMessageLenByType(int type);
 int scoreModesMessage(unsigned char *msg, int validbits);
 int decodeModesMessage (struct modesMessage *mm, unsigned char *msg);
+void decodeModesMessageFields(struct modesMessage *mm);
 void displayModesMessage(struct modesMessage *mm);
 void useModesMessage    (struct modesMessage *mm);
+void useModesMessages   (struct modesMessage *mms, unsigned count);
+
+// struct modesMessage is split into a small generic header and a much larger
+// decoded section that starts at AA. Only the header needs clearing before a
+// message is decoded; decodeModesMessageFields / decodeModeAMessage clear the
+// rest when they populate it, so rejected candidates never pay for the full
+// structure.
+#define MODES_MESSAGE_HEADER_SIZE offsetof(struct modesMessage, AA)
+
+static inline void resetModesMessage(struct modesMessage *mm)
+{
+    memset(mm, 0, MODES_MESSAGE_HEADER_SIZE);
+}
+
+static inline void resetModesMessageDecoded(struct modesMessage *mm)
+{
+    memset((unsigned char *) mm + MODES_MESSAGE_HEADER_SIZE, 0, sizeof(*mm) - MODES_MESSAGE_HEADER_SIZE);
+}
 
 // datafield extraction helpers
 
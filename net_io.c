@@ -47,6 +47,9 @@
 //   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 //   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+// we want sendmmsg if available
+#define _GNU_SOURCE
+
 #include "dump1090.h"
 
 /* for PRIX64 */
@@ -54,6 +57,23 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <poll.h>
+#include "net_uring.h"
+#endif
+
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
 
 //
 // ============================= Networking =============================
@@ -61,18 +81,104 @@
 // Note: here we disregard any kind of good coding practice in favor of
 // extreme simplicity, that is:
 //
-// 1) We only rely on the kernel buffers for our I/O without any kind of
-//    user space buffering.
-// 2) We don't register any kind of event handler, from time to time a
-//    function gets called and we accept new connections. All the rest is
-//    handled via non-blocking I/O and manually polling clients to see if
-//    they have something new to share with us when reading is needed.
+// 1) Output is buffered in user space only to share it between clients
+//    and to ride out clients that are briefly slow (see "Output streams").
+// 2) Listening sockets and input clients are registered with the kernel
+//    (epoll where available, poll otherwise) and we only accept or read
+//    when a descriptor is reported ready. All I/O is non-blocking. With
+//    --net-uring, io_uring does the accepting, reading and sending for us
+//    instead (see "io_uring backend").
+// 3) With --net-thread, all of that happens on a thread of its own (see
+//    "Network thread"); decoding and output formatting stay on the main
+//    thread, so the tracker and writers are only ever touched from there.
 
 static int handleBeastCommand(struct client *c, char *p);
 static int decodeBinMessage(struct client *c, char *p);
 static int decodeHexMessage(struct client *c, char *hex);
 
+// One block of a service's output stream, see "Output streams" below
+struct net_segment {
+    _Atomic(struct net_segment *) next; // following segment, once this one is full
+    atomic_uint refs;
+    atomic_int len;             // bytes published so far
+    uint64_t base;              // stream position of data[0]
+    char data[MODES_OUT_SEGMENT_SIZE];
+};
+
+// One parsed network input message, see decodeNetFrame
+struct net_frame {
+    char type;                  // Beast message type: '1' Mode A/C, '2'/'3' Mode S, '5' Radarcape position
+    unsigned char signal;       // Beast signal level byte
+    uint64_t timestamp;         // 12MHz receiver timestamp
+    uint64_t sysTimestamp;      // when we read it
+    unsigned char msg[21];      // message data, or the Radarcape position record
+};
+
+#define NET_FRAME_RING_SIZE 8192 // must be a power of two
+
+static struct net_frame *net_frame_ring;  // NULL unless there is a network thread
+static atomic_uint net_frame_head;        // next record to decode, advanced by the main thread
+static atomic_uint net_frame_tail;        // next record to fill, advanced by the network thread
+
+#ifdef ENABLE_ZLIB
+#define NET_ZBUF_SIZE 65536
+
+// A client's --net-compress state, see "Compression" below
+struct net_zstream {
+    z_stream zs;
+    int output;                 // compressing our output, rather than decompressing input
+    int flushed;                // output: everything compressed so far has been flushed..
+    int flushing;               // ..or a flush is under way
+    uint64_t pending_since;     // output: when the oldest unflushed data was compressed (ns)
+    int start, len;             // output: compressed data not yet sent is buf[start] .. buf[len-1]
+    unsigned char buf[NET_ZBUF_SIZE];
+};
+#endif
+
+static struct net_segment *segmentCreate(uint64_t base);
+static void decodeNetFrame(struct net_frame *frame);
 static void moveNetClient(struct client *c, struct net_service *new_service);
+static void modesReadFromClient(struct client *c);
+static int clientProcessInput(struct client *c);
+static int clientBufferRoom(struct client *c);
+static void segmentRelease(struct net_segment *seg);
+static void clientResume(struct client *c);
+static void clientSkipFullSegments(struct client *c);
+static unsigned clientGatherOutput(struct client *c, struct iovec *iov, ssize_t *total);
+static void clientAdvance(struct client *c, ssize_t sent);
+static uint64_t clientBacklog(struct client *c);
+static void clientOverflow(struct client *c);
+static void modesCloseClient(struct client *c);
+static void netAccept(int listen_fd, int fd);
+static int portCompressed(const char *port);
+static void udpOutputInit(struct net_service *service, const char *spec);
+static void udpListen(struct net_service *service, const char *spec);
+static void udpQueue(struct net_udp_output *udp, struct net_segment *seg, int offset, int len);
+static void netSendDatagrams(void);
+static int clientDatagram(struct client *c, const char *data, int len);
+static void clientReadDatagrams(struct client *c);
+#ifdef ENABLE_ZLIB
+static void clientStartCompression(struct client *c);
+static void clientFreeCompression(struct client *c);
+static unsigned clientGatherCompressed(struct client *c, struct iovec *iov);
+static void clientSendCompressed(struct client *c);
+static void clientReadCompressed(struct client *c);
+static int clientInflate(struct client *c, const char *data, int len);
+static void netCompressStats(struct stats *st);
+#endif
+
+static void netEventInit(void);
+static void netEventAdd(int fd, struct net_service *service, struct client *c);
+static void netEventUpdate(struct client *c);
+static void netEventRemove(int fd);
+static void netEventCompress(int fd);
+static void clientSendPending(struct client *c);
+static void clientAttachStream(struct client *c);
+static void clientDetachStream(struct client *c);
+static void netSendAll(void);
+static void netPruneClients(void);
+static void netUpdateBacklogs(void);
+static void netThreadStart(void);
 
 static void send_raw_heartbeat(struct net_service *service);
 static void send_beast_heartbeat(struct net_service *service);
@@ -81,6 +187,11 @@ static void send_stratux_heartbeat(struct net_service *service);
 
 static void writeBeastMessage(struct net_writer *writer, uint64_t timestamp, double signalLevel, unsigned char *msg, int msgLen);
 
+static struct net_filter *portFilter(const char *port);
+static struct net_service *filteredService(struct net_service *service, struct net_filter *filter);
+static void filteredServiceRelease(struct net_service *service);
+static void filteredServicesFree(void);
+
 static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a);
 static void writeFATSVPositionUpdate(float lat, float lon, float alt);
 
@@ -108,9 +219,6 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
         exit(1);
     }
 
-    service->next = Modes.services;
-    Modes.services = service;
-
     service->descr = descr;
     service->listener_count = 0;
     service->connections = 0;
@@ -120,10 +228,8 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
     service->read_handler = handler;
 
     if (service->writer) {
-        if (! (service->writer->data = malloc(MODES_OUT_BUF_SIZE)) ) {
-            fprintf(stderr, "Out of memory allocating output buffer for service %s\n", descr);
-            exit(1);
-        }
+        service->writer->tail = segmentCreate(0);
+        service->writer->data = service->writer->tail->data;
 
         service->writer->service = service;
         service->writer->dataUsed = 0;
@@ -131,6 +237,11 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
         service->writer->send_heartbeat = hb;
     }
 
+    // Filtered services can be created by the network thread while the
+    // main thread walks this list, so only link it in once it's set up
+    service->next = Modes.services;
+    Modes.services = service;
+
     return service;
 }
 
@@ -153,14 +264,43 @@ struct client *createGenericClient(struct net_service *service, int fd)
         exit(1);
     }
 
+    // Input clients get a big read buffer so that they can be read in
+    // large chunks; clients that just send the odd command don't need one
+    if (service->read_mode == READ_MODE_BEAST || service->read_mode == READ_MODE_ASCII)
+        c->bufsize = (Modes.net_read_buffer > MODES_CLIENT_BUF_SIZE ? Modes.net_read_buffer : MODES_CLIENT_BUF_SIZE);
+    else
+        c->bufsize = MODES_CLIENT_BUF_SIZE;
+
+    if (!(c->buf = malloc(c->bufsize + 1))) {
+        fprintf(stderr, "Out of memory allocating a new %s network client\n", service->descr);
+        exit(1);
+    }
+
     c->service    = NULL;
     c->next       = Modes.clients;
     c->fd         = fd;
+    c->bufstart   = 0;
     c->buflen     = 0;
     c->modeac_requested = 0;
+    c->filter_spec = NULL;
+    c->filter_len = 0;
+    c->out_seg    = NULL;
+    c->out_offset = 0;
+    c->stop_seg   = NULL;
+    c->resume_seg = NULL;
+    c->blocked    = 0;
+    c->dropped    = 0;
+    c->io_pending = 0;
+    c->io_sending = 0;
+    c->io_send = NULL;
+    c->zstream = NULL;
+    c->udp = 0;
+    c->udp_synced = 0;
+    c->udp_seq = 0;
     Modes.clients = c;
 
     moveNetClient(c, service);
+    netEventAdd(fd, NULL, c);
 
     return c;
 }
@@ -201,7 +341,8 @@ void serviceListen(struct net_service *service, char *bind_addr, char *bind_port
     p = bind_ports;
     while (p && *p) {
         int newfds[16];
-        int nfds, i;
+        int nfds, i, compress;
+        struct net_service *target = service;
 
         end = strpbrk(p, ", ");
         if (!end) {
@@ -230,8 +371,17 @@ void serviceListen(struct net_service *service, char *bind_addr, char *bind_port
             exit(1);
         }
 
+        // Clients of a port with a --net-filter go straight to the
+        // filtered variant of the service
+        if (service->writer)
+            target = filteredService(service, portFilter(buf));
+        compress = portCompressed(buf);
+
         for (i = 0; i < nfds; ++i) {
             anetNonBlock(Modes.aneterr, newfds[i]);
+            netEventAdd(newfds[i], target, NULL);
+            if (compress)
+                netEventCompress(newfds[i]);
             fds[n++] = newfds[i];
         }
     }
@@ -257,19 +407,25 @@ void modesInitNet(void) {
     Modes.clients = NULL;
     Modes.services = NULL;
 
+    netEventInit();
+
     // set up listeners
     s = serviceInit("Raw TCP output", &Modes.raw_out, send_raw_heartbeat, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(s, Modes.net_bind_address, Modes.net_output_raw_ports);
+    udpOutputInit(s, Modes.net_udp_raw_out);
 
     // we maintain two output services, one producing a stream of verbatim messages, one producing a stream of cooked messages
     // and switch clients between them if they request a change in mode
     Modes.beast_cooked_service = serviceInit("Beast TCP output (cooked mode)", &Modes.beast_cooked_out, send_beast_heartbeat, READ_MODE_BEAST_COMMAND, NULL, handleBeastCommand);
     Modes.beast_verbatim_service = serviceInit("Beast TCP output (verbatim mode)", &Modes.beast_verbatim_out, send_beast_heartbeat, READ_MODE_BEAST_COMMAND, NULL, handleBeastCommand);
 
-    if (Modes.net_verbatim)
+    if (Modes.net_verbatim) {
         serviceListen(Modes.beast_verbatim_service, Modes.net_bind_address, Modes.net_output_beast_ports);
-    else
+        udpOutputInit(Modes.beast_verbatim_service, Modes.net_udp_beast_out);
+    } else {
         serviceListen(Modes.beast_cooked_service, Modes.net_bind_address, Modes.net_output_beast_ports);
+        udpOutputInit(Modes.beast_cooked_service, Modes.net_udp_beast_out);
+    }
 
     s = serviceInit("Basestation TCP output", &Modes.sbs_out, send_sbs_heartbeat, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(s, Modes.net_bind_address, Modes.net_output_sbs_ports);
@@ -282,215 +438,2213 @@ void modesInitNet(void) {
 
     s = makeBeastInputService();
     serviceListen(s, Modes.net_bind_address, Modes.net_input_beast_ports);
-}
-//
-//=========================================================================
-//
-// This function gets called from time to time when the decoding thread is
-// awakened by new data arriving. This usually happens a few times every second
-//
-static struct client * modesAcceptClients(void) {
-    int fd;
-    struct net_service *s;
 
-    for (s = Modes.services; s; s = s->next) {
-        int i;
-        for (i = 0; i < s->listener_count; ++i) {
-            while ((fd = anetTcpAccept(Modes.aneterr, s->listener_fds[i])) >= 0) {
-                createSocketClient(s, fd);
-            }
-        }
+    if (Modes.net_udp_raw_in) {
+        s = serviceInit("Raw UDP input", NULL, NULL, READ_MODE_ASCII, "\n", decodeHexMessage);
+        udpListen(s, Modes.net_udp_raw_in);
+    }
+
+    if (Modes.net_udp_beast_in) {
+        s = serviceInit("Beast UDP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessage);
+        udpListen(s, Modes.net_udp_beast_in);
     }
 
-    return Modes.clients;
+    if (Modes.net_thread)
+        netThreadStart();
 }
 //
 //=========================================================================
 //
-// On error free the client, collect the structure, adjust maxfd if needed.
+// Readiness notification. Every listening socket and every client that we
+// read from is registered here; we only touch a descriptor when the kernel
+// says there is something to accept or read, so an idle connection costs
+// nothing per pass. Registrations are level-triggered: anything we leave
+// unread is reported again on the next wait.
 //
-static void modesCloseClient(struct client *c) {
-    if (!c->service) {
-        fprintf(stderr, "warning: double close of net client\n");
+
+// What a registered descriptor belongs to, indexed by fd
+struct net_fd_entry {
+    struct net_service *service; // listener: owning service
+    struct client *client;       // client connection (NULL for listeners)
+    unsigned events;             // events currently asked for
+    int compress;                // listener: its connections are compressed (--net-compress)
+#ifdef HAVE_EPOLL
+    uint32_t generation;         // distinguishes reuses of the same fd
+#else
+    unsigned poll_index;         // slot in poll_fds
+#endif
+};
+
+static struct net_fd_entry *net_fds;
+static int net_fds_size;
+
+#define NET_MAX_EVENTS 64
+#define NET_MAX_IOV 64
+
+#ifdef HAVE_EPOLL
+#define NET_EVENT_READ  EPOLLIN
+#define NET_EVENT_WRITE EPOLLOUT
+#define NET_EVENT_ERROR (EPOLLERR | EPOLLHUP)
+
+static int net_epoll_fd = -1;
+static uint32_t net_generation;
+#else
+#define NET_EVENT_READ  POLLIN
+#define NET_EVENT_WRITE POLLOUT
+#define NET_EVENT_ERROR (POLLERR | POLLHUP | POLLNVAL)
+
+static struct pollfd *poll_fds;
+static unsigned poll_used;
+static unsigned poll_size;
+static int poll_dirty;          // some poll_fds slots were released
+#endif
+
+#ifdef HAVE_IO_URING
+#define URING_ENTRIES     1024
+#define URING_BUFFERS     32    // receive buffers, a power of two. Like a socket's receive buffer with
+                                // epoll, these limit how far input gets ahead of output in one pass
+#define URING_BUFFER_SIZE 4096
+
+static int net_uring;           // the io_uring backend is in use
+
+static void uringArmAccept(int fd);
+static void uringArmRecv(struct client *c);
+static void uringArmWakeup(int fd);
+static void uringCancelClient(struct client *c);
+static void uringSendPending(struct client *c);
+static void uringCancelSend(struct client *c);
+static int uringPoll(int timeout_ms);
+#endif
+
+static void netEventInit(void)
+{
+#ifdef HAVE_EPOLL
+    if (net_epoll_fd >= 0)
         return;
+
+    if ((net_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+        exit(1);
     }
+#endif
 
-    // Clean up, but defer removing from the list until modesNetCleanup().
-    // This is because there may be stackframes still pointing at this
-    // client (unpredictably: reading from client A may cause client B to
-    // be freed)
+#ifdef HAVE_IO_URING
+    if (Modes.net_uring) {
+        if (uringInit(URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE) == 0)
+            net_uring = 1;
+        else
+            fprintf(stderr, "warning: io_uring networking not available (%s), --net-uring ignored\n", strerror(errno));
+    }
+#else
+    if (Modes.net_uring)
+        fprintf(stderr, "warning: --net-uring not supported in this build, option ignored.\n");
+#endif
+}
 
-    close(c->fd);
-    c->service->connections--;
+// Which events we need to hear about for a client: input if we read from
+// it, writability while it has output queued
+static unsigned clientWantedEvents(struct client *c)
+{
+    unsigned events = 0;
 
-    // mark it as inactive and ready to be freed
-    c->fd = -1;
-    c->service = NULL;
-    c->modeac_requested = 0;
+    if (c->service && c->service->read_handler)
+        events |= NET_EVENT_READ;
+    if (c->blocked)
+        events |= NET_EVENT_WRITE;
 
-    autoset_modeac();
+    return events;
 }
-//
-//=========================================================================
-//
-// Send the write buffer for the specified writer to all connected clients
-//
-static void flushWrites(struct net_writer *writer) {
-    struct client *c;
 
-    for (c = Modes.clients; c; c = c->next) {
-        if (!c->service)
-            continue;
-        if (c->service == writer->service) {
-#ifndef _WIN32
-            int nwritten = write(c->fd, writer->data, writer->dataUsed);
-#else
-            int nwritten = send(c->fd, writer->data, writer->dataUsed, 0 );
+static void netEventAdd(int fd, struct net_service *service, struct client *c)
+{
+    if (fd >= net_fds_size) {
+        int newsize = net_fds_size ? net_fds_size : 64;
+        while (newsize <= fd)
+            newsize *= 2;
+        if (!(net_fds = realloc(net_fds, newsize * sizeof(*net_fds)))) {
+            fprintf(stderr, "Out of memory allocating network event table\n");
+            exit(1);
+        }
+        memset(net_fds + net_fds_size, 0, (newsize - net_fds_size) * sizeof(*net_fds));
+        net_fds_size = newsize;
+    }
+
+    net_fds[fd].service = service;
+    net_fds[fd].client = c;
+    net_fds[fd].events = (c ? clientWantedEvents(c) : NET_EVENT_READ);
+    net_fds[fd].compress = 0;
+
+#ifdef HAVE_IO_URING
+    if (net_uring) {
+        if (c && (net_fds[fd].events & NET_EVENT_READ))
+            uringArmRecv(c);
+        else if (!c && service)
+            uringArmAccept(fd);
+        else if (!c)
+            uringArmWakeup(fd);
+        return;
+    }
 #endif
-            if (nwritten != writer->dataUsed) {
-                modesCloseClient(c);
-            }
+
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = net_fds[fd].events;
+    net_fds[fd].generation = ++net_generation;
+    ev.data.u64 = ((uint64_t) net_fds[fd].generation << 32) | (unsigned) fd;
+    if (epoll_ctl(net_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        // Output to a plain file (faup1090 --stdout > file) can't be
+        // watched, but never blocks either, so only complain if we needed it
+        if (!c || (net_fds[fd].events & NET_EVENT_READ))
+            fprintf(stderr, "warning: can't watch fd %d for %s: %s\n",
+                    fd, service ? service->descr : c ? c->service->descr : "the network thread", strerror(errno));
+        net_fds[fd].service = NULL;
+        net_fds[fd].client = NULL;
+    }
+#else
+    if (poll_used >= poll_size) {
+        poll_size = poll_size ? poll_size * 2 : 64;
+        if (!(poll_fds = realloc(poll_fds, poll_size * sizeof(*poll_fds)))) {
+            fprintf(stderr, "Out of memory allocating network poll table\n");
+            exit(1);
         }
     }
 
-    writer->dataUsed = 0;
-    writer->lastWrite = mstime();
+    poll_fds[poll_used].fd = fd;
+    poll_fds[poll_used].events = net_fds[fd].events;
+    poll_fds[poll_used].revents = 0;
+    net_fds[fd].poll_index = poll_used++;
+#endif
 }
 
-// Prepare to write up to 'len' bytes to the given net_writer.
-// Returns a pointer to write to, or NULL to skip this write.
-static void *prepareWrite(struct net_writer *writer, int len) {
-    if (!writer ||
-        !writer->service ||
-        !writer->service->connections ||
-        !writer->data)
-        return NULL;
+// Make the connections accepted on a listener compressed (--net-compress)
+static void netEventCompress(int fd)
+{
+    net_fds[fd].compress = 1;
+}
 
-    if (len > MODES_OUT_BUF_SIZE)
-        return NULL;
+// Bring a client's registration up to date after its queue or service changed
+static void netEventUpdate(struct client *c)
+{
+    unsigned events;
 
-    if (writer->dataUsed + len >= MODES_OUT_BUF_SIZE) {
-        // Flush now to free some space
-        flushWrites(writer);
-    }
+#ifdef HAVE_IO_URING
+    if (net_uring)
+        return; // what we ask for never depends on the client's state
+#endif
 
-    return writer->data + writer->dataUsed;
+    if (c->fd < 0 || c->fd >= net_fds_size || net_fds[c->fd].client != c)
+        return; // not being watched
+
+    events = clientWantedEvents(c);
+    if (net_fds[c->fd].events == events)
+        return;
+    net_fds[c->fd].events = events;
+
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = ((uint64_t) net_fds[c->fd].generation << 32) | (unsigned) c->fd;
+    epoll_ctl(net_epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+#else
+    poll_fds[net_fds[c->fd].poll_index].events = events;
+#endif
 }
 
-// Complete a write previously begun by prepareWrite.
-// endptr should point one byte past the last byte written
-// to the buffer returned from prepareWrite.
-static void completeWrite(struct net_writer *writer, void *endptr) {
-    writer->dataUsed = endptr - writer->data;
+static void netEventRemove(int fd)
+{
+    if (fd < 0 || fd >= net_fds_size || (!net_fds[fd].service && !net_fds[fd].client))
+        return;
 
-    if (writer->dataUsed >= Modes.net_output_flush_size) {
-        flushWrites(writer);
-    }
-}
+#ifdef HAVE_IO_URING
+    if (net_uring && net_fds[fd].client)
+        uringCancelClient(net_fds[fd].client);
+#endif
 
-//
-//=========================================================================
-//
-// Write raw output in Beast Binary format with Timestamp to TCP clients
-//
-static void modesSendBeastVerbatimOutput(struct modesMessage *mm, struct aircraft __attribute__((unused)) *a) {
-    // Don't forward mlat messages, unless --forward-mlat is set
-    if (mm->source == SOURCE_MLAT && !Modes.forward_mlat)
+    net_fds[fd].service = NULL;
+    net_fds[fd].client = NULL;
+
+#ifdef HAVE_IO_URING
+    if (net_uring)
         return;
+#endif
 
-    // Do verbatim output for all messages
-    writeBeastMessage(&Modes.beast_verbatim_out, mm->timestampMsg, mm->signalLevel, mm->verbatim, mm->msgbits / 8);
+#ifdef HAVE_EPOLL
+    epoll_ctl(net_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#else
+    // poll() ignores negative fds; the slot is reclaimed before the next wait
+    poll_fds[net_fds[fd].poll_index].fd = -1;
+    poll_dirty = 1;
+#endif
 }
 
-static void modesSendBeastCookedOutput(struct modesMessage *mm, struct aircraft *a) {
-    // Don't forward mlat messages, unless --forward-mlat is set
-    if (mm->source == SOURCE_MLAT && !Modes.forward_mlat)
-        return;
+static int net_wakeup_pipe[2] = { -1, -1 };
+static void netWakeupReceived(void);
 
-    // Filter some messages from cooked output
-    // Don't forward 2-bit-corrected messages
-    if (mm->correctedbits >= 2)
+// Handle one descriptor reported as ready
+static void netEventDispatch(int fd, unsigned revents)
+{
+    struct net_fd_entry *entry;
+    struct client *c;
+    int newfd;
+
+    if (fd < 0 || fd >= net_fds_size)
         return;
 
-    // Don't forward unreliable messages
-    if ((a && !a->reliable) && !mm->reliable)
+    if (fd == net_wakeup_pipe[0]) {
+        netWakeupReceived();
         return;
+    }
 
-    writeBeastMessage(&Modes.beast_cooked_out, mm->timestampMsg, mm->signalLevel, mm->msg, mm->msgbits / 8);
-}
+    entry = &net_fds[fd];
+    if ((c = entry->client)) {
+        if ((revents & NET_EVENT_WRITE) && c->out_seg)
+            clientSendPending(c);
 
-static void writeBeastMessage(struct net_writer *writer, uint64_t timestamp, double signalLevel, unsigned char *msg, int msgLen) {
-    char ch;
-    int  j;
-    int sig;
+        // may have been closed while handling an earlier event
+        if (!c->service)
+            return;
 
-    char *p = prepareWrite(writer, 2 + 2 * (7 + msgLen));
-    if (!p)
-        return;
+        if (c->service->read_handler) {
+            if (revents & (NET_EVENT_READ | NET_EVENT_ERROR))
+                modesReadFromClient(c);
+        } else if (revents & NET_EVENT_ERROR) {
+            modesCloseClient(c);
+        }
+    } else if (entry->service) {
+        while ((newfd = anetTcpAccept(Modes.aneterr, fd)) >= 0) {
+            netAccept(fd, newfd);
+        }
+    }
+}
 
-    *p++ = 0x1a;
-    if      (msgLen == MODES_SHORT_MSG_BYTES)
-      {*p++ = '2';}
-    else if (msgLen == MODES_LONG_MSG_BYTES)
-      {*p++ = '3';}
-    else if (msgLen == MODEAC_MSG_BYTES)
-      {*p++ = '1';}
-    else
-      {return;}
+// Set up a client for a connection accepted on one of our listeners
+static void netAccept(int listen_fd, int fd)
+{
+    // nb: creating the client can move net_fds
+    struct client *c = createSocketClient(net_fds[listen_fd].service, fd);
 
-    /* timestamp, big-endian */
-    *p++ = (ch = (timestamp >> 40));
-    if (0x1A == ch) {*p++ = ch; }
-    *p++ = (ch = (timestamp >> 32));
-    if (0x1A == ch) {*p++ = ch; }
-    *p++ = (ch = (timestamp >> 24));
-    if (0x1A == ch) {*p++ = ch; }
-    *p++ = (ch = (timestamp >> 16));
-    if (0x1A == ch) {*p++ = ch; }
-    *p++ = (ch = (timestamp >> 8));
-    if (0x1A == ch) {*p++ = ch; }
-    *p++ = (ch = (timestamp));
-    if (0x1A == ch) {*p++ = ch; }
+#ifdef ENABLE_ZLIB
+    if (net_fds[listen_fd].compress)
+        clientStartCompression(c);
+#else
+    MODES_NOTUSED(c);
+#endif
+}
 
-    sig = round(sqrt(signalLevel) * 255);
-    if (signalLevel > 0 && sig < 1)
-        sig = 1;
-    if (sig > 255)
-        sig = 255;
-    *p++ = ch = (char)sig;
-    if (0x1A == ch) {*p++ = ch; }
+#ifndef HAVE_EPOLL
+static void netEventCompact(void)
+{
+    unsigned i, j;
 
-    for (j = 0; j < msgLen; j++) {
-        *p++ = (ch = msg[j]);
-        if (0x1A == ch) {*p++ = ch; }
+    for (i = 0, j = 0; i < poll_used; ++i) {
+        if (poll_fds[i].fd < 0)
+            continue;
+        poll_fds[j] = poll_fds[i];
+        net_fds[poll_fds[j].fd].poll_index = j;
+        ++j;
     }
 
-    completeWrite(writer, p);
+    poll_used = j;
+    poll_dirty = 0;
 }
+#endif
 
-static void send_beast_heartbeat(struct net_service *service)
+// Wait up to timeout_ms for network activity and handle everything that is
+// ready. Returns nonzero if the event buffer filled up, i.e. there may be
+// more descriptors ready than we handled.
+static int netEventPoll(int timeout_ms)
 {
-    static char heartbeat_message[] = { 0x1a, '1', 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    char *data;
+    int i, n;
 
-    if (!service->writer)
-        return;
+#ifdef HAVE_IO_URING
+    if (net_uring)
+        return uringPoll(timeout_ms);
+#endif
 
-    data = prepareWrite(service->writer, sizeof(heartbeat_message));
-    if (!data)
-        return;
+#ifdef HAVE_EPOLL
+    struct epoll_event events[NET_MAX_EVENTS];
 
-    memcpy(data, heartbeat_message, sizeof(heartbeat_message));
-    completeWrite(service->writer, data + sizeof(heartbeat_message));
+    n = epoll_wait(net_epoll_fd, events, NET_MAX_EVENTS, timeout_ms);
+    if (n < 0)
+        return 0; // EINTR, most likely; we'll be back shortly
+
+    for (i = 0; i < n; ++i) {
+        int fd = (int) (events[i].data.u64 & 0xFFFFFFFF);
+
+        // skip events for a descriptor that was closed and reused since
+        if (fd < net_fds_size && net_fds[fd].generation == (uint32_t) (events[i].data.u64 >> 32))
+            netEventDispatch(fd, events[i].events);
+    }
+
+    return (n == NET_MAX_EVENTS);
+#else
+    unsigned count;
+
+    if (poll_dirty)
+        netEventCompact();
+
+    n = poll(poll_fds, poll_used, timeout_ms);
+    if (n <= 0)
+        return 0;
+
+    // dispatching may append new listeners' clients; only look at the
+    // slots that were part of this poll
+    count = poll_used;
+    for (i = 0; i < (int) count; ++i) {
+        if (poll_fds[i].fd >= 0 && poll_fds[i].revents) {
+            unsigned revents = poll_fds[i].revents;
+            poll_fds[i].revents = 0;
+            netEventDispatch(poll_fds[i].fd, revents);
+        }
+    }
+
+    return 0; // poll() reports everything at once
+#endif
 }
 
+#ifdef HAVE_IO_URING
 //
 //=========================================================================
 //
-// Write raw output to TCP clients
+// io_uring backend (--net-uring).
 //
-static void modesSendRawOutput(struct modesMessage *mm, struct aircraft *a) {
-    // Don't ever forward mlat messages via raw output.
+// Rather than waiting for readiness and then making a syscall for each
+// descriptor, we keep requests queued in the kernel: a multishot accept
+// on each listener, a multishot receive into kernel-chosen buffers on each
+// input client, and a send for each output client that has something
+// pending. A single io_uring_enter() per wait submits whatever is new and
+// collects the results.
+//
+// Completions say what they belong to through user_data: a listener fd or
+// a client pointer, with the kind of request in the low bits. A closed
+// client is only freed once all of its requests have completed.
+//
+// An output client has at most one send in flight, covering everything it
+// has pending just like the writev() in clientSendPending() would. Its
+// cursor only moves when the send completes, so to deal with an overflow
+// the send is cancelled first.
+//
+
+enum { URING_ACCEPT = 1, URING_RECV, URING_SEND, URING_WAKEUP, URING_CANCEL };
+#define URING_KIND_MASK 7
+
+static inline uint64_t uringClientData(struct client *c, int kind)
+{
+    return (uint64_t) (uintptr_t) c | kind;
+}
+
+static void uringArmAccept(int fd)
+{
+    struct io_uring_sqe *sqe = uringGetSqe();
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = ((uint64_t) fd << 3) | URING_ACCEPT;
+}
+
+static void uringArmRecv(struct client *c)
+{
+    struct io_uring_sqe *sqe = uringGetSqe();
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = uringClientData(c, URING_RECV);
+    c->io_pending++;
+}
+
+// The network thread's wakeup pipe
+static void uringArmWakeup(int fd)
+{
+    struct io_uring_sqe *sqe = uringGetSqe();
+    uint32_t events = POLLIN;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    events = (events << 16) | (events >> 16); // the kernel expects halfword-swapped events here
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_WAKEUP;
+}
+
+static void uringCancel(struct client *c, int kind)
+{
+    struct io_uring_sqe *sqe = uringGetSqe();
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = uringClientData(c, kind);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = URING_CANCEL;
+}
+
+// The client is being closed; finish off its outstanding requests
+static void uringCancelClient(struct client *c)
+{
+    if (c->io_pending > c->io_sending)
+        uringCancel(c, URING_RECV);
+    if (c->io_sending)
+        uringCancel(c, URING_SEND);
+}
+
+// State of a client's send; the kernel may look at the message header
+// and iovecs at any time until the send completes
+struct net_uring_send {
+    struct msghdr msg;
+    struct iovec iov[NET_MAX_IOV];
+    struct net_segment *seg;    // the client's cursor when the send started, with a reference
+    int offset;
+    int cancelled;
+};
+
+// Gather what a client should send next into iov; returns the number of
+// entries used, or 0 if it has caught up
+static unsigned uringGatherOutput(struct client *c, struct iovec *iov)
+{
+    ssize_t total;
+    unsigned n;
+
+#ifdef ENABLE_ZLIB
+    if (c->zstream)
+        return clientGatherCompressed(c, iov);
+#endif
+
+    for (;;) {
+        clientSkipFullSegments(c);
+        n = clientGatherOutput(c, iov, &total);
+        if (total)
+            return n;
+        if (!c->stop_seg)
+            return 0; // caught up
+        clientResume(c);
+    }
+}
+
+// Start sending a client's pending output, unless a send is already in flight
+static void uringSendPending(struct client *c)
+{
+    struct net_uring_send *send;
+    struct io_uring_sqe *sqe;
+    unsigned n;
+
+    if (c->io_sending)
+        return;
+
+    if (!c->io_send && !(c->io_send = malloc(sizeof(*c->io_send)))) {
+        fprintf(stderr, "Out of memory allocating io_uring send state\n");
+        exit(1);
+    }
+    send = c->io_send;
+
+    if (!(n = uringGatherOutput(c, send->iov)))
+        return;
+
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = n;
+    // compressed output is sent from the client's own buffer rather than
+    // from the stream, so there's no cursor to pin
+    send->seg = (c->zstream ? NULL : c->out_seg);
+    if (send->seg)
+        send->seg->refs++;
+    send->offset = c->out_offset;
+    send->cancelled = 0;
+
+    sqe = uringGetSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &send->msg;
+    sqe->user_data = uringClientData(c, URING_SEND);
+    c->io_sending = 1;
+    c->io_pending++;
+}
+
+// The client's cursor can't move while a send is in flight, so to deal
+// with an overflow we first stop the send; the backlog is looked at again
+// when it completes
+static void uringCancelSend(struct client *c)
+{
+    if (c->io_send->cancelled)
+        return;
+
+    uringCancel(c, URING_SEND);
+    c->io_send->cancelled = 1;
+}
+
+static void uringSendComplete(struct client *c, int res)
+{
+    struct net_uring_send *send = c->io_send;
+    int moved = (send->seg && (c->out_seg != send->seg || c->out_offset != send->offset));
+
+    c->io_sending = 0;
+    c->io_pending--;
+    segmentRelease(send->seg);
+    send->seg = NULL;
+
+    if (!c->service || moved)
+        return; // closed, or moved to another stream, while the send was in flight
+
+    if (res < 0 && res != -EAGAIN && res != -EINTR && res != -ECANCELED) {
+        modesCloseClient(c);
+        return;
+    }
+
+    if (res > 0) {
+#ifdef ENABLE_ZLIB
+        if (c->zstream)
+            c->zstream->start += res;
+        else
+#endif
+            clientAdvance(c, res);
+    }
+
+    if (clientBacklog(c) > (uint64_t) Modes.net_output_backlog) {
+        clientOverflow(c);
+        if (!c->service)
+            return;
+    }
+
+    uringSendPending(c);
+}
+
+// Add received data to a client's buffer and process it
+static void clientReceived(struct client *c, const char *data, int len)
+{
+    if (c->udp) {
+        clientDatagram(c, data, len); // each receive is one datagram
+        return;
+    }
+
+#ifdef ENABLE_ZLIB
+    if (c->zstream && !c->zstream->output) {
+        clientInflate(c, data, len);
+        return;
+    }
+#endif
+
+    while (len > 0) {
+        int left = clientBufferRoom(c);
+        int n = (len < left ? len : left);
+
+        memcpy(c->buf + c->buflen, data, n);
+        c->buflen += n;
+        data += n;
+        len -= n;
+
+        if (clientProcessInput(c) < 0)
+            return; // closed
+    }
+}
+
+static void uringRecvComplete(struct client *c, int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+        c->io_pending--; // this was the request's last completion
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (res > 0 && c->service)
+            clientReceived(c, uringBuffer(bid), res);
+        uringRecycleBuffer(bid);
+    }
+
+    if (!c->service)
+        return; // closed meanwhile
+
+    if ((res == 0 && !c->udp) || (res < 0 && res != -ENOBUFS)) {
+        modesCloseClient(c); // end of file, or an error
+        return;
+    }
+
+    if (!(flags & IORING_CQE_F_MORE))
+        uringArmRecv(c); // ran out of buffers, or the kernel stopped for some other reason
+}
+
+static void uringComplete(uint64_t user_data, int res, unsigned flags)
+{
+    struct client *c = (struct client *) (uintptr_t) (user_data & ~(uint64_t) URING_KIND_MASK);
+    int fd = (int) (user_data >> 3);
+
+    switch (user_data & URING_KIND_MASK) {
+    case URING_ACCEPT:
+        if (res >= 0)
+            netAccept(fd, res);
+        if (!(flags & IORING_CQE_F_MORE))
+            uringArmAccept(fd);
+        break;
+
+    case URING_RECV:
+        uringRecvComplete(c, res, flags);
+        break;
+
+    case URING_SEND:
+        uringSendComplete(c, res);
+        break;
+
+    case URING_WAKEUP:
+        netWakeupReceived();
+        if (!(flags & IORING_CQE_F_MORE))
+            uringArmWakeup(net_wakeup_pipe[0]);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// netEventPoll() for io_uring. This handles what has completed so far,
+// which is never much as the buffer pool limits how far receives can run
+// ahead. New completions turn up while we work, so we don't carry on until
+// the queue is empty: input could then starve output indefinitely.
+static int uringPoll(int timeout_ms)
+{
+    struct io_uring_cqe *cqe;
+    unsigned n;
+
+    uringWait(timeout_ms);
+
+    for (n = uringCqReady(); n > 0 && (cqe = uringPeekCqe()); --n) {
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        uringCqeSeen();
+        uringComplete(user_data, res, flags);
+    }
+
+    // re-arms and follow-on sends
+    uringSubmit();
+    return 0;
+}
+#endif
+
+// Milliseconds until the next timed output job (a pending flush or a
+// heartbeat), capped at max_ms
+static int netTimerTimeout(uint64_t now, int max_ms)
+{
+    struct net_service *s;
+    uint64_t deadline = now + max_ms;
+
+    for (s = Modes.services; s; s = s->next) {
+        if (!s->writer || !s->connections)
+            continue;
+        if (s->writer->dataUsed && s->writer->lastWrite + Modes.net_output_flush_interval < deadline)
+            deadline = s->writer->lastWrite + Modes.net_output_flush_interval;
+        if (Modes.net_heartbeat_interval && s->writer->send_heartbeat && s->writer->lastWrite + Modes.net_heartbeat_interval < deadline)
+            deadline = s->writer->lastWrite + Modes.net_heartbeat_interval;
+    }
+
+    return (deadline > now ? (int) (deadline - now) : 0);
+}
+
+static int net_thread_running;
+static void netThreadWait(int timeout_ms);
+
+//
+// Block until there is network activity or until the next output timer is
+// due, whichever is sooner, but no longer than max_ms. Anything that becomes
+// readable meanwhile is read and queued, to be processed by the next call to
+// modesNetPeriodicWork(). This replaces a fixed sleep in loops that have
+// nothing else to wait on.
+//
+void modesNetWait(int max_ms)
+{
+    if (net_thread_running) {
+        netThreadWait(netTimerTimeout(mstime(), max_ms));
+        return;
+    }
+
+#ifdef HAVE_EPOLL
+    if (net_epoll_fd < 0) {
+        // networking was never set up, nothing to wait on
+        struct timespec slp = { max_ms / 1000, (max_ms % 1000) * 1000 * 1000 };
+        nanosleep(&slp, NULL);
+        return;
+    }
+#endif
+
+    netEventPoll(netTimerTimeout(mstime(), max_ms));
+}
+
+//
+//=========================================================================
+//
+// Network thread.
+//
+// With --net-thread, accepting, reading, parsing and sending all happen on
+// a thread of its own, so that a burst of network traffic or a crowd of
+// clients doesn't hold up demodulation, and the main thread never waits on
+// a socket. The two threads share only:
+//
+//  * parsed input records, passed to the main thread through the frame
+//    ring (see decodeNetFrame);
+//  * output, which the main thread writes and publishes into the shared
+//    segments (see "Output streams") and the network thread sends; the
+//    main thread pokes it through a pipe when there is something new;
+//  * service connection counts, which are atomic;
+//  * Modes.mode_ac, which the network thread sets when Beast clients ask
+//    for Mode A/C (unless --no-modeac-auto) and the demodulator reads; it
+//    is also atomic.
+//
+// Clients and the event table belong to the network thread once it has
+// started.
+//
+
+static pthread_t net_thread;
+static atomic_int net_wakeup_pending;  // a wakeup is in the pipe
+static int net_send_needed;             // network thread: new output was published
+
+static pthread_mutex_t net_input_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t net_input_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int net_input_waiting;   // the main thread is in netThreadWait
+
+// Network thread: the main thread poked us
+static void netWakeupReceived(void)
+{
+    char buf[64];
+
+    while (read(net_wakeup_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    net_wakeup_pending = 0;
+    net_send_needed = 1;
+}
+
+// Main thread: tell the network thread there is new output to send
+static void netThreadWakeup(void)
+{
+    if (!atomic_exchange(&net_wakeup_pending, 1)) {
+        if (write(net_wakeup_pipe[1], "", 1) < 0) {
+            // the pipe is full, so a wakeup is on its way anyway
+        }
+    }
+}
+
+// Network thread: wake the main thread if it's idle, as there is input for it
+static void netThreadSignalInput(void)
+{
+    if (net_input_waiting) {
+        pthread_mutex_lock(&net_input_lock);
+        pthread_cond_signal(&net_input_cond);
+        pthread_mutex_unlock(&net_input_lock);
+    }
+}
+
+// Main thread: wait for input from the network thread, up to timeout_ms
+static void netThreadWait(int timeout_ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&net_input_lock);
+    net_input_waiting = 1;
+    while (net_frame_head == net_frame_tail && !Modes.exit) {
+        if (pthread_cond_timedwait(&net_input_cond, &net_input_lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    net_input_waiting = 0;
+    pthread_mutex_unlock(&net_input_lock);
+}
+
+static void *netThreadEntryPoint(void *arg)
+{
+    MODES_NOTUSED(arg);
+
+    while (!Modes.exit) {
+        unsigned tail = net_frame_tail;
+
+        netEventPoll(1000);
+
+        if (net_send_needed) {
+            net_send_needed = 0;
+            netSendDatagrams();
+            netSendAll();
+        }
+        netPruneClients();
+        netUpdateBacklogs();
+
+        if (net_frame_tail != tail)
+            netThreadSignalInput();
+    }
+
+    return NULL;
+}
+
+static void netThreadStart(void)
+{
+    if (pipe(net_wakeup_pipe) < 0) {
+        fprintf(stderr, "Failed to create network thread wakeup pipe: %s\n", strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(Modes.aneterr, net_wakeup_pipe[0]);
+    anetNonBlock(Modes.aneterr, net_wakeup_pipe[1]);
+    netEventAdd(net_wakeup_pipe[0], NULL, NULL);
+
+    if (!(net_frame_ring = malloc(NET_FRAME_RING_SIZE * sizeof(*net_frame_ring)))) {
+        fprintf(stderr, "Out of memory allocating network input queue\n");
+        exit(1);
+    }
+
+    net_thread_running = 1;
+    if (pthread_create(&net_thread, NULL, netThreadEntryPoint, NULL) != 0) {
+        fprintf(stderr, "Failed to start the network thread\n");
+        exit(1);
+    }
+}
+
+//
+// Stop the network thread, if there is one. Modes.exit must already be set.
+//
+void modesNetShutdown(void)
+{
+    if (!net_thread_running)
+        return;
+
+    netThreadWakeup();
+    pthread_join(net_thread, NULL);
+    net_thread_running = 0;
+}
+
+//
+//=========================================================================
+//
+// On error free the client, collect the structure, adjust maxfd if needed.
+//
+static void modesCloseClient(struct client *c) {
+    if (!c->service) {
+        fprintf(stderr, "warning: double close of net client\n");
+        return;
+    }
+
+    // Clean up, but defer removing from the list until modesNetCleanup().
+    // This is because there may be stackframes still pointing at this
+    // client (unpredictably: reading from client A may cause client B to
+    // be freed)
+
+    netEventRemove(c->fd);
+    close(c->fd);
+    c->service->connections--;
+    clientDetachStream(c);
+    filteredServiceRelease(c->service);
+
+    // mark it as inactive and ready to be freed
+    c->fd = -1;
+    c->service = NULL;
+    c->modeac_requested = 0;
+
+    autoset_modeac();
+}
+//
+//=========================================================================
+//
+// Output streams.
+//
+// Each writer formats its output directly into a chain of large refcounted
+// segments that is shared by every client of the service; nothing is copied
+// per client. A client only holds a cursor (segment + offset) into the
+// chain, and once per pass everything between its cursor and the end of the
+// stream is sent with a single writev(). Clients whose socket is full wait
+// for epoll to report it writable and then catch up from their cursor.
+//
+// A segment is referenced by the clients positioned in it, by the segment
+// before it, and (while it is being filled) by its writer; segments nobody
+// can reach any more are freed, so memory depends on how far the slowest
+// client is behind, not on how many clients there are.
+//
+// Segments start and the published data ends on message boundaries, so
+// jumping a cursor to either never breaks the framing of the stream. A
+// client that has to skip data but is part way through a message first
+// finishes its current segment (its "stop" point) and then carries on from
+// its "resume" point.
+//
+// With --net-thread the main thread writes and publishes while the network
+// thread sends. A segment's length is published before its successor is
+// linked, so a segment that has a successor is complete; references are
+// atomic; and writer->tail only changes, and is only read by the network
+// thread, under net_stream_lock.
+//
+
+static pthread_mutex_t net_stream_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ullong net_output_dropped;    // folded into the stats once per pass
+static atomic_uint net_output_disconnects;
+
+static struct net_segment *segmentCreate(uint64_t base)
+{
+    struct net_segment *seg;
+
+    if (!(seg = malloc(sizeof(*seg)))) {
+        fprintf(stderr, "Out of memory allocating output segment\n");
+        exit(1);
+    }
+
+    seg->next = NULL;
+    seg->refs = 1;
+    seg->len = 0;
+    seg->base = base;
+    return seg;
+}
+
+static void segmentRelease(struct net_segment *seg)
+{
+    while (seg && --seg->refs == 0) {
+        struct net_segment *next = seg->next;
+        free(seg);
+        seg = next;
+    }
+}
+
+static inline uint64_t streamPosition(struct net_segment *seg, int offset)
+{
+    return seg->base + offset;
+}
+
+// Current end of a writer's published output
+static uint64_t writerEnd(struct net_writer *writer)
+{
+    uint64_t end;
+
+    pthread_mutex_lock(&net_stream_lock);
+    end = streamPosition(writer->tail, writer->tail->len);
+    pthread_mutex_unlock(&net_stream_lock);
+    return end;
+}
+
+// The segment a writer is filling, with a reference for the caller, and
+// how much of it has been published so far
+static struct net_segment *writerTail(struct net_writer *writer, int *offset)
+{
+    struct net_segment *seg;
+
+    pthread_mutex_lock(&net_stream_lock);
+    seg = writer->tail;
+    seg->refs++;
+    *offset = seg->len;
+    pthread_mutex_unlock(&net_stream_lock);
+    return seg;
+}
+
+// Set when output is published, cleared once clients have been told about it
+static int net_output_pending;
+
+// Make the data written since the last call available to clients, and move
+// on to a new segment if there's no longer room for a full write buffer
+static void writerPublish(struct net_writer *writer)
+{
+    struct net_segment *tail = writer->tail;
+    int len;
+
+    if (writer->dataUsed) {
+        net_output_pending = 1;
+        if (writer->udp)
+            udpQueue(writer->udp, tail, tail->len, writer->dataUsed);
+    }
+    len = (tail->len += writer->dataUsed);
+    writer->dataUsed = 0;
+
+    if (MODES_OUT_SEGMENT_SIZE - len < MODES_OUT_BUF_SIZE) {
+        struct net_segment *seg = segmentCreate(streamPosition(tail, len)); // the writer's reference
+
+        seg->refs++;            // the link from the previous segment
+        pthread_mutex_lock(&net_stream_lock);
+        tail->next = seg;
+        writer->tail = seg;
+        pthread_mutex_unlock(&net_stream_lock);
+        segmentRelease(tail);   // drop the writer's reference to the old tail
+        tail = seg;
+        len = 0;
+    }
+
+    writer->data = tail->data + len;
+}
+
+// Place a client's cursor at the current end of its service's stream
+static void clientAttachStream(struct client *c)
+{
+    struct net_writer *writer = (c->service ? c->service->writer : NULL);
+
+    if (!writer)
+        return;
+
+    c->out_seg = writerTail(writer, &c->out_offset);
+}
+
+static void clientDetachStream(struct client *c)
+{
+    segmentRelease(c->out_seg);
+    segmentRelease(c->resume_seg);
+    c->out_seg = c->resume_seg = NULL;
+    c->stop_seg = NULL;
+    c->blocked = 0;
+}
+
+// Bytes of output a client has yet to send
+static uint64_t clientBacklog(struct client *c)
+{
+    uint64_t backlog;
+
+    if (!c->out_seg)
+        return 0;
+
+    if (!c->stop_seg)
+        return writerEnd(c->service->writer) - streamPosition(c->out_seg, c->out_offset);
+
+    backlog = streamPosition(c->stop_seg, c->stop_offset) - streamPosition(c->out_seg, c->out_offset);
+    if (c->resume_seg)
+        backlog += writerEnd(c->service->writer) - streamPosition(c->resume_seg, c->resume_offset);
+    return backlog;
+}
+
+static void clientDropped(struct client *c, uint64_t bytes)
+{
+    c->dropped += bytes;
+    c->service->dropped += bytes;
+    net_output_dropped += bytes;
+}
+
+// Refresh the backlog figures of each output service (whichever thread
+// sends). This walks every client for every service, so only do it once
+// a second.
+static void netUpdateBacklogs(void)
+{
+    static uint64_t next_update;
+    uint64_t now = mstime();
+    struct net_service *s;
+    struct client *c;
+
+    if (now < next_update)
+        return;
+    next_update = now + 1000;
+
+    for (s = Modes.services; s; s = s->next) {
+        uint64_t backlog = 0, backlog_max = 0;
+        int dropping = 0;
+
+        if (!s->writer)
+            continue;
+
+        for (c = Modes.clients; c; c = c->next) {
+            uint64_t pending;
+
+            if (c->service != s)
+                continue;
+
+            pending = clientBacklog(c);
+            backlog += pending;
+            if (pending > backlog_max)
+                backlog_max = pending;
+            if (c->dropped)
+                ++dropping;
+        }
+
+        s->backlog = backlog;
+        s->backlog_max = backlog_max;
+        s->dropping = dropping;
+    }
+}
+
+void netDisplayBacklogs(void)
+{
+    struct net_service *s;
+
+    for (s = Modes.services; s; s = s->next) {
+        if (!s->writer || (!s->connections && !s->dropped))
+            continue;
+
+        printf("  %s: %d connections, %llu bytes queued (at most %llu for one client)\n",
+               s->descr, (int) s->connections,
+               (unsigned long long) s->backlog, (unsigned long long) s->backlog_max);
+        if (s->dropped)
+            printf("    %llu bytes dropped since startup, %d connected clients have had output dropped\n",
+                   (unsigned long long) s->dropped, (int) s->dropping);
+    }
+}
+
+// The client has reached its stop point: carry on from the resume point,
+// or from the current end of the stream if there isn't one
+static void clientResume(struct client *c)
+{
+    segmentRelease(c->out_seg);
+    if (c->resume_seg) {
+        c->out_seg = c->resume_seg;  // takes over the reference
+        c->out_offset = c->resume_offset;
+    } else {
+        c->out_seg = writerTail(c->service->writer, &c->out_offset);
+        clientDropped(c, streamPosition(c->out_seg, c->out_offset) - c->skip_from);
+    }
+
+    c->stop_seg = c->resume_seg = NULL;
+}
+
+// Make a client skip everything before the given segment start (in the
+// current stream). It stops at the end of whatever it's part way through.
+static void clientSkipTo(struct client *c, struct net_segment *seg)
+{
+    seg->refs++;
+
+    if (c->stop_seg) {
+        // already heading for a stop point; move the resume point on
+        if (c->resume_seg) {
+            clientDropped(c, seg->base - streamPosition(c->resume_seg, c->resume_offset));
+            segmentRelease(c->resume_seg);
+        } else {
+            clientDropped(c, seg->base - c->skip_from);
+        }
+    } else if (c->out_offset == 0) {
+        // at a segment start, so we can jump straight away
+        clientDropped(c, seg->base - c->out_seg->base);
+        segmentRelease(c->out_seg);
+        c->out_seg = seg;
+        return;
+    } else {
+        clientDropped(c, seg->base - (c->out_seg->base + c->out_seg->len));
+        c->stop_seg = c->out_seg;
+        c->stop_offset = c->out_seg->len;
+    }
+
+    c->resume_seg = seg;
+    c->resume_offset = 0;
+}
+
+// A client has more output pending than --net-backlog allows
+static void clientOverflow(struct client *c)
+{
+    struct net_writer *writer = c->service->writer;
+    struct net_segment *seg;
+    uint64_t end = writerEnd(writer);
+    uint64_t keep;
+
+#ifdef HAVE_IO_URING
+    if (c->io_sending && !c->zstream) {
+        uringCancelSend(c);
+        return;
+    }
+#endif
+
+    switch (writer->overflow) {
+    case OVERFLOW_DISCONNECT:
+        net_output_disconnects++;
+        modesCloseClient(c);
+        return;
+
+    case OVERFLOW_DROP_NEWEST:
+        // Keep what fits, up to the last segment boundary, and then skip
+        // to wherever the stream is when the client gets there
+        if (c->stop_seg) {
+            if (c->resume_seg) {
+                c->skip_from = streamPosition(c->resume_seg, c->resume_offset);
+                segmentRelease(c->resume_seg);
+                c->resume_seg = NULL;
+            }
+            return;
+        }
+
+        keep = streamPosition(c->out_seg, c->out_offset) + Modes.net_output_backlog;
+        for (seg = c->out_seg; seg->next && seg->next->base <= keep; seg = seg->next)
+            ;
+        if (seg == c->out_seg) // can't happen while the backlog is at least two segments
+            return;
+
+        c->stop_seg = seg;
+        c->stop_offset = 0;
+        c->skip_from = seg->base;
+        return;
+
+    case OVERFLOW_DROP_OLDEST:
+        // Skip to the oldest segment that leaves the backlog within bounds
+        if (c->stop_seg) {
+            if (!c->resume_seg)
+                return; // the backlog can't grow until the client reaches its stop point
+            keep = streamPosition(c->stop_seg, c->stop_offset) - streamPosition(c->out_seg, c->out_offset);
+            seg = c->resume_seg->next;
+        } else if (c->out_offset == 0) {
+            keep = 0;
+            seg = c->out_seg->next;
+        } else {
+            keep = c->out_seg->len - c->out_offset;
+            seg = c->out_seg->next;
+        }
+
+        while (seg && seg->next && keep + (end - seg->base) > (uint64_t) Modes.net_output_backlog)
+            seg = seg->next;
+        if (seg)
+            clientSkipTo(c, seg);
+        return;
+    }
+}
+
+// Move a client's cursor over the end of any segments it has finished
+static void clientSkipFullSegments(struct client *c)
+{
+    struct net_segment *next;
+
+    // look for a successor before looking at the length: only then is the
+    // length final
+    while ((next = c->out_seg->next) && c->out_offset == c->out_seg->len &&
+           !(c->stop_seg == c->out_seg && c->stop_offset == c->out_offset)) {
+        next->refs++;
+        segmentRelease(c->out_seg);
+        c->out_seg = next;
+        c->out_offset = 0;
+    }
+}
+
+// Gather a client's pending output, up to its stop point or the end of the
+// stream, into iov (NET_MAX_IOV entries at most). Returns the number of
+// entries used; *total is set to the number of bytes.
+static unsigned clientGatherOutput(struct client *c, struct iovec *iov, ssize_t *total)
+{
+    struct net_segment *seg, *next;
+    unsigned n = 0;
+    int offset;
+
+    *total = 0;
+    for (seg = c->out_seg, offset = c->out_offset; seg && n < NET_MAX_IOV; seg = next, offset = 0) {
+        int end;
+
+        next = seg->next;
+        end = (seg == c->stop_seg ? c->stop_offset : seg->len);
+
+        if (end > offset) {
+            iov[n].iov_base = seg->data + offset;
+            iov[n].iov_len = end - offset;
+            *total += iov[n].iov_len;
+            ++n;
+        }
+
+        if (seg == c->stop_seg)
+            break;
+    }
+
+    return n;
+}
+
+// Move a client's cursor on by the given number of bytes sent
+static void clientAdvance(struct client *c, ssize_t sent)
+{
+    struct net_segment *seg;
+
+    for (;;) {
+        int avail = (c->out_seg == c->stop_seg ? c->stop_offset : c->out_seg->len) - c->out_offset;
+
+        if (sent <= avail) {
+            c->out_offset += sent;
+            return;
+        }
+
+        sent -= avail;
+        seg = c->out_seg->next;
+        seg->refs++;
+        segmentRelease(c->out_seg);
+        c->out_seg = seg;
+        c->out_offset = 0;
+    }
+}
+
+// Send as much of a client's pending output as its socket will take
+static void clientSendPending(struct client *c)
+{
+#ifdef HAVE_IO_URING
+    if (net_uring) {
+        uringSendPending(c);
+        return;
+    }
+#endif
+
+#ifdef ENABLE_ZLIB
+    if (c->zstream) {
+        clientSendCompressed(c);
+        return;
+    }
+#endif
+
+    for (;;) {
+        struct iovec iov[NET_MAX_IOV];
+        unsigned n;
+        ssize_t total, nwritten;
+
+        clientSkipFullSegments(c);
+
+        n = clientGatherOutput(c, iov, &total);
+        if (!total) {
+            if (c->stop_seg) {
+                clientResume(c);
+                continue;
+            }
+            c->blocked = 0;
+            break; // caught up
+        }
+
+        nwritten = writev(c->fd, iov, n);
+        if (nwritten < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                c->blocked = 1;
+                break;
+            }
+            modesCloseClient(c);
+            return;
+        }
+
+        clientAdvance(c, nwritten);
+
+        if (nwritten < total) {
+            c->blocked = 1; // the socket is full
+            break;
+        }
+
+        c->blocked = 0;
+    }
+
+    netEventUpdate(c);
+}
+
+//
+//=========================================================================
+//
+// Compression (--net-compress). Connections to the listed ports carry a
+// zlib stream instead of plain data: output clients compress what we send
+// them, input clients decompress what they send us. Commands sent back by
+// Beast output clients are not compressed.
+//
+// Output is compressed from the client's cursor, so a client still shares
+// the service's stream and can skip data when it falls behind like any
+// other (the compressed stream just never contains the skipped part). The
+// compressor is flushed whenever it catches up with the published stream,
+// so each flush of the writer (see --net-ro-size and --net-ro-interval)
+// reaches the client as something it can decode straight away; batching
+// more per flush compresses better at the cost of latency.
+//
+
+// Is this listening port one of the --net-compress ones?
+static int portCompressed(const char *port)
+{
+    const char *p = Modes.net_compress_ports;
+    size_t len = strlen(port);
+
+    while (p && *p) {
+        size_t n = strcspn(p, ", ");
+
+        if (n == len && !strncmp(p, port, len))
+            return 1;
+        p += n;
+        p += strspn(p, ", ");
+    }
+
+    return 0;
+}
+
+#ifdef ENABLE_ZLIB
+
+// Each compressed client has a compressor of its own, so CPU use matters
+// more than the last few percent: on Beast output, level 1 takes about half
+// the CPU of the default level for about a fifth more output
+#define NET_ZLIB_LEVEL 1
+
+// folded into the stats once per pass
+static atomic_ullong net_compress_in;
+static atomic_ullong net_compress_out;
+static atomic_uint net_compress_flushes;
+static atomic_ullong net_compress_latency_ns;
+static atomic_ullong net_compress_cpu_ns;
+static atomic_ullong net_decompress_in;
+static atomic_ullong net_decompress_out;
+static atomic_ullong net_decompress_cpu_ns;
+
+static uint64_t clockNanos(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void clientStartCompression(struct client *c)
+{
+    struct net_zstream *z;
+    int ret;
+
+    if (!(z = calloc(1, sizeof(*z)))) {
+        fprintf(stderr, "Out of memory allocating compression state\n");
+        exit(1);
+    }
+
+    z->output = (c->service->writer != NULL);
+    z->flushed = 1;
+    if (z->output)
+        ret = deflateInit(&z->zs, NET_ZLIB_LEVEL);
+    else
+        ret = inflateInit(&z->zs);
+
+    if (ret != Z_OK) {
+        fprintf(stderr, "Failed to set up zlib for a %s client: %s\n", c->service->descr, z->zs.msg ? z->zs.msg : zError(ret));
+        exit(1);
+    }
+
+    c->zstream = z;
+}
+
+static void clientFreeCompression(struct client *c)
+{
+    struct net_zstream *z = c->zstream;
+
+    if (!z)
+        return;
+
+    if (z->output)
+        deflateEnd(&z->zs);
+    else
+        inflateEnd(&z->zs);
+    free(z);
+    c->zstream = NULL;
+}
+
+// Carry on with a flush of the compressor; returns 1 once it is complete
+static int zstreamFlush(struct net_zstream *z)
+{
+    z->flushing = 1;
+    deflate(&z->zs, Z_SYNC_FLUSH);
+    if (!z->zs.avail_out)
+        return 0; // there may be more to come
+
+    z->flushing = 0;
+    z->flushed = 1;
+    net_compress_flushes++;
+    net_compress_latency_ns += clockNanos(CLOCK_MONOTONIC) - z->pending_since;
+    return 1;
+}
+
+// Refill a client's (empty) compression buffer from its pending output,
+// and flush the compressor if that catches it up. The buffer is left
+// empty only if there is nothing more to send.
+static void clientDeflate(struct client *c)
+{
+    struct net_zstream *z = c->zstream;
+    uint64_t cpu_start = clockNanos(CLOCK_THREAD_CPUTIME_ID);
+    ssize_t total = 0;
+
+    z->zs.next_out = z->buf;
+    z->zs.avail_out = NET_ZBUF_SIZE;
+
+    // a flush that didn't fit last time has to finish before we add more
+    if (z->flushing && !zstreamFlush(z))
+        goto done;
+
+    while (z->zs.avail_out) {
+        struct iovec iov[NET_MAX_IOV];
+        unsigned i, n;
+        ssize_t used = 0;
+
+        clientSkipFullSegments(c);
+        n = clientGatherOutput(c, iov, &total);
+        if (!total) {
+            if (c->stop_seg) {
+                clientResume(c);
+                continue;
+            }
+            break; // caught up
+        }
+
+        if (z->flushed) {
+            z->flushed = 0;
+            z->pending_since = clockNanos(CLOCK_MONOTONIC);
+        }
+
+        // deflate only stops short of the end of its input when the
+        // output buffer is full
+        for (i = 0; i < n && z->zs.avail_out; ++i) {
+            z->zs.next_in = iov[i].iov_base;
+            z->zs.avail_in = iov[i].iov_len;
+            deflate(&z->zs, Z_NO_FLUSH);
+            used += iov[i].iov_len - z->zs.avail_in;
+        }
+
+        z->zs.avail_in = 0;
+        clientAdvance(c, used);
+        net_compress_in += used;
+    }
+
+    if (!total && !z->flushed)
+        zstreamFlush(z);
+
+ done:
+    z->start = 0;
+    z->len = NET_ZBUF_SIZE - z->zs.avail_out;
+    net_compress_out += z->len;
+    net_compress_cpu_ns += clockNanos(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+}
+
+// clientGatherOutput() for a compressed client: the rest of its
+// compression buffer, refilled first if it is empty. Returns 0 if there
+// is nothing to send.
+static unsigned clientGatherCompressed(struct client *c, struct iovec *iov)
+{
+    struct net_zstream *z = c->zstream;
+
+    if (z->start == z->len)
+        clientDeflate(c);
+    if (z->start == z->len)
+        return 0;
+
+    iov[0].iov_base = z->buf + z->start;
+    iov[0].iov_len = z->len - z->start;
+    return 1;
+}
+
+// clientSendPending() for a compressed client
+static void clientSendCompressed(struct client *c)
+{
+    struct net_zstream *z = c->zstream;
+    struct iovec iov;
+
+    while (clientGatherCompressed(c, &iov)) {
+        ssize_t nwritten = write(c->fd, iov.iov_base, iov.iov_len);
+
+        if (nwritten < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                c->blocked = 1;
+                goto done;
+            }
+            modesCloseClient(c);
+            return;
+        }
+
+        z->start += nwritten;
+        if (z->start < z->len) {
+            c->blocked = 1; // the socket is full
+            goto done;
+        }
+    }
+
+    c->blocked = 0; // caught up
+
+ done:
+    netEventUpdate(c);
+}
+
+// Decompress data received from a client into its read buffer, and
+// process it as it arrives. Returns -1 if the client was closed.
+static int clientInflate(struct client *c, const char *data, int len)
+{
+    struct net_zstream *z = c->zstream;
+    uint64_t cpu_ns = 0;
+
+    z->zs.next_in = (unsigned char *) data;
+    z->zs.avail_in = len;
+    net_decompress_in += len;
+
+    // keep going while there is input left, or inflate may have more
+    // output than there was room for
+    do {
+        int room = clientBufferRoom(c);
+        uint64_t cpu_start = clockNanos(CLOCK_THREAD_CPUTIME_ID);
+        int ret, produced;
+
+        z->zs.next_out = (unsigned char *) c->buf + c->buflen;
+        z->zs.avail_out = room;
+        ret = inflate(&z->zs, Z_NO_FLUSH);
+        produced = room - z->zs.avail_out;
+        cpu_ns += clockNanos(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+        c->buflen += produced;
+        net_decompress_out += produced;
+
+        if (ret == Z_STREAM_END) {
+            // the sender finished its stream; another may follow
+            inflateReset(&z->zs);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "%s: bad compressed data from client: %s\n", c->service->descr, z->zs.msg ? z->zs.msg : zError(ret));
+            modesCloseClient(c);
+            len = -1;
+            break;
+        }
+
+        if (produced && clientProcessInput(c) < 0) {
+            len = -1;
+            break;
+        }
+
+        if (ret == Z_BUF_ERROR && !produced)
+            break; // no progress possible
+    } while (z->zs.avail_in || !z->zs.avail_out);
+
+    net_decompress_cpu_ns += cpu_ns;
+    return (len < 0 ? -1 : 0);
+}
+
+// modesReadFromClient() for a compressed client
+static void clientReadCompressed(struct client *c)
+{
+    struct net_zstream *z = c->zstream;
+
+    for (;;) {
+        ssize_t nread = read(c->fd, z->buf, NET_ZBUF_SIZE);
+
+        if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            modesCloseClient(c); // end of file, or an error
+            return;
+        }
+
+        if (nread < 0)
+            return; // nothing more for now
+
+        if (clientInflate(c, (char *) z->buf, nread) < 0)
+            return;
+
+        if (nread < NET_ZBUF_SIZE)
+            return; // we've probably had everything there is
+    }
+}
+
+static void addNanos(struct timespec *ts, uint64_t ns)
+{
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec += ns % 1000000000;
+    normalize_timespec(ts);
+}
+
+// Fold the compression counters into the stats
+static void netCompressStats(struct stats *st)
+{
+    st->net_compress_in += atomic_exchange(&net_compress_in, 0);
+    st->net_compress_out += atomic_exchange(&net_compress_out, 0);
+    st->net_compress_flushes += atomic_exchange(&net_compress_flushes, 0);
+    st->net_compress_latency_ns += atomic_exchange(&net_compress_latency_ns, 0);
+    addNanos(&st->net_compress_cpu, atomic_exchange(&net_compress_cpu_ns, 0));
+    st->net_decompress_in += atomic_exchange(&net_decompress_in, 0);
+    st->net_decompress_out += atomic_exchange(&net_decompress_out, 0);
+    addNanos(&st->net_decompress_cpu, atomic_exchange(&net_decompress_cpu_ns, 0));
+}
+
+#endif
+
+//
+//=========================================================================
+//
+// UDP (--net-udp-*). Beast and raw output can also be sent as datagrams to
+// a list of unicast or multicast destinations; one send then serves every
+// receiver on the LAN, with no per-receiver sockets or buffers here.
+//
+// Each datagram is a 4-byte big-endian sequence number followed by whole
+// messages, so receivers can tell when they have missed some. What a writer
+// publishes during a pass is queued (consecutive flushes merged while they
+// fit) and sent at the end of the pass, by the network thread if there is
+// one; datagrams are kept small enough to avoid IP fragmentation on an
+// Ethernet LAN. Each batch goes to each destination with one sendmmsg()
+// where we have it. If the queue fills up before the sender gets to it,
+// the main thread sends it itself; batches are taken and sent under
+// send_lock, so they still go out in sequence.
+//
+// The UDP input services take datagrams in the same format, check their
+// sequence numbers and count what was lost. A multicast group should have
+// only one sender.
+//
+
+#define NET_UDP_HEADER 4
+#define NET_UDP_MAX_DATAGRAM 1452   // 1500-byte MTU less the IPv6 and UDP headers
+#define NET_UDP_MAX_PAYLOAD (NET_UDP_MAX_DATAGRAM - NET_UDP_HEADER)
+#define NET_UDP_QUEUE 64
+#define NET_UDP_MAX_READS 64        // datagrams read from a socket before moving on
+
+// A datagram's payload: part of a segment, with a reference
+struct net_udp_datagram {
+    struct net_segment *seg;
+    int offset;
+    int len;
+};
+
+// UDP destinations of one writer
+struct net_udp_output {
+    int ndest;
+    int *fds;                   // a connected socket per destination
+    pthread_mutex_t send_lock;  // held while a batch is taken and sent..
+    uint32_t seq;               // ..as is this, the sequence number of the next datagram
+    pthread_mutex_t queue_lock; // protects the queue, filled by the main thread
+    unsigned queued;            // datagrams to send at the end of this pass
+    struct net_udp_datagram queue[NET_UDP_QUEUE];
+};
+
+static atomic_uint net_udp_received; // folded into the stats once per pass
+static atomic_uint net_udp_lost;
+static atomic_uint net_udp_sent;
+static atomic_uint net_udp_send_errors;
+
+// Split n bytes of "host:port", "[host]:port" or (if that's acceptable to
+// the caller) "port" into its parts; host is left empty if there isn't
+// one. Returns -1 if it doesn't look like any of these.
+static int splitHostPort(const char *p, size_t n, char *host, size_t hostsize, char *port, size_t portsize)
+{
+    const char *end = p + n, *colon = NULL, *q;
+    const char *hstart = p, *hend = p;
+
+    if (n && *p == '[') {
+        if (!(q = memchr(p, ']', n)) || q + 1 >= end || q[1] != ':')
+            return -1;
+        hstart = p + 1;
+        hend = q;
+        colon = q + 1;
+    } else {
+        for (q = p; q < end; ++q) {
+            if (*q == ':') {
+                if (colon)
+                    return -1; // IPv6 addresses need brackets
+                colon = q;
+            }
+        }
+        if (colon)
+            hend = colon;
+    }
+
+    if ((size_t) (hend - hstart) >= hostsize || (colon ? (size_t) (end - colon - 1) : n) >= portsize)
+        return -1;
+
+    memcpy(host, hstart, hend - hstart);
+    host[hend - hstart] = '\0';
+    if (colon) {
+        memcpy(port, colon + 1, end - colon - 1);
+        port[end - colon - 1] = '\0';
+    } else {
+        memcpy(port, p, n);
+        port[n] = '\0';
+    }
+
+    return (port[0] ? 0 : -1);
+}
+
+// Send a service's output as datagrams to the comma-separated list of
+// <host>:<port> destinations in spec, too. _exits_ on failure!
+static void udpOutputInit(struct net_service *service, const char *spec)
+{
+    struct net_udp_output *udp;
+    char host[128], port[32];
+    const char *p;
+
+    if (!spec || !*spec)
+        return;
+
+    if (!(udp = calloc(1, sizeof(*udp)))) {
+        fprintf(stderr, "Out of memory allocating UDP output state\n");
+        exit(1);
+    }
+    pthread_mutex_init(&udp->send_lock, NULL);
+    pthread_mutex_init(&udp->queue_lock, NULL);
+
+    for (p = spec; *p; p += strspn(p, ", ")) {
+        size_t n = strcspn(p, ", ");
+        int fd;
+
+        if (!n)
+            continue;
+
+        if (splitHostPort(p, n, host, sizeof(host), port, sizeof(port)) < 0 || !host[0]) {
+            fprintf(stderr, "Bad UDP destination '%.*s' for %s (expected <host>:<port>)\n", (int) n, p, service->descr);
+            exit(1);
+        }
+        p += n;
+
+        if ((fd = anetUdpConnect(Modes.aneterr, host, port, Modes.net_udp_ttl)) == ANET_ERR) {
+            fprintf(stderr, "Error setting up UDP output to %s port %s (%s): %s\n",
+                    host, port, service->descr, Modes.aneterr);
+            exit(1);
+        }
+        anetNonBlock(Modes.aneterr, fd);
+
+        if (!(udp->fds = realloc(udp->fds, (udp->ndest + 1) * sizeof(int)))) {
+            fprintf(stderr, "Out of memory allocating UDP output state\n");
+            exit(1);
+        }
+        udp->fds[udp->ndest++] = fd;
+    }
+
+    service->writer->udp = udp;
+    service->connections += udp->ndest; // so that output is generated for them
+}
+
+// Receive datagrams on the comma-separated list of [<address>:]<port> in
+// spec; a multicast address is joined. _exits_ on failure!
+static void udpListen(struct net_service *service, const char *spec)
+{
+    char host[128], port[32];
+    const char *p;
+
+    if (!spec)
+        return;
+
+    for (p = spec; *p; p += strspn(p, ", ")) {
+        size_t n = strcspn(p, ", ");
+        int fds[16];
+        int nfds, i;
+
+        if (!n)
+            continue;
+
+        if (splitHostPort(p, n, host, sizeof(host), port, sizeof(port)) < 0) {
+            fprintf(stderr, "Bad UDP input port '%.*s' for %s (expected [<address>:]<port>)\n", (int) n, p, service->descr);
+            exit(1);
+        }
+        p += n;
+
+        nfds = anetUdpServer(Modes.aneterr, port, host[0] ? host : Modes.net_bind_address, fds, sizeof(fds) / sizeof(fds[0]));
+        if (nfds == ANET_ERR) {
+            fprintf(stderr, "Error opening the UDP port %s (%s): %s\n", port, service->descr, Modes.aneterr);
+            exit(1);
+        }
+
+        for (i = 0; i < nfds; ++i)
+            createGenericClient(service, fds[i])->udp = 1;
+    }
+}
+
+// Send n datagrams to one destination. A full socket buffer or an ICMP
+// error from an earlier datagram just costs the datagram it hits.
+#ifdef HAVE_SENDMMSG
+static void udpSendTo(int fd, struct mmsghdr *msgs, unsigned n)
+{
+    unsigned i = 0;
+
+    while (i < n) {
+        int sent = sendmmsg(fd, msgs + i, n - i, 0);
+
+        if (sent < 0) {
+            ++net_udp_send_errors;
+            ++i;
+        } else {
+            net_udp_sent += sent;
+            i += sent;
+        }
+    }
+}
+#else
+static void udpSendTo(int fd, struct msghdr *msgs, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; ++i) {
+        if (sendmsg(fd, &msgs[i], 0) < 0)
+            ++net_udp_send_errors;
+        else
+            ++net_udp_sent;
+    }
+}
+#endif
+
+// Send the datagrams a writer has queued to each of its destinations
+static void udpSendQueued(struct net_udp_output *udp)
+{
+    struct net_udp_datagram batch[NET_UDP_QUEUE];
+    unsigned char headers[NET_UDP_QUEUE][NET_UDP_HEADER];
+    struct iovec iov[NET_UDP_QUEUE][2];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[NET_UDP_QUEUE];
+#else
+    struct msghdr msgs[NET_UDP_QUEUE];
+#endif
+    unsigned i, n;
+    int d;
+
+    pthread_mutex_lock(&udp->send_lock);
+
+    pthread_mutex_lock(&udp->queue_lock);
+    n = udp->queued;
+    memcpy(batch, udp->queue, n * sizeof(batch[0]));
+    udp->queued = 0;
+    pthread_mutex_unlock(&udp->queue_lock);
+
+    if (!n) {
+        pthread_mutex_unlock(&udp->send_lock);
+        return;
+    }
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for (i = 0; i < n; ++i) {
+        uint32_t seq = udp->seq++;
+
+        headers[i][0] = seq >> 24;
+        headers[i][1] = seq >> 16;
+        headers[i][2] = seq >> 8;
+        headers[i][3] = seq;
+        iov[i][0].iov_base = headers[i];
+        iov[i][0].iov_len = NET_UDP_HEADER;
+        iov[i][1].iov_base = batch[i].seg->data + batch[i].offset;
+        iov[i][1].iov_len = batch[i].len;
+#ifdef HAVE_SENDMMSG
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+#else
+        msgs[i].msg_iov = iov[i];
+        msgs[i].msg_iovlen = 2;
+#endif
+    }
+
+    for (d = 0; d < udp->ndest; ++d)
+        udpSendTo(udp->fds[d], msgs, n);
+
+    pthread_mutex_unlock(&udp->send_lock);
+
+    for (i = 0; i < n; ++i)
+        segmentRelease(batch[i].seg);
+}
+
+// Main thread: queue output just published by a writer (len bytes at
+// offset in seg) to be sent as datagrams
+static void udpQueue(struct net_udp_output *udp, struct net_segment *seg, int offset, int len)
+{
+    pthread_mutex_lock(&udp->queue_lock);
+
+    if (udp->queued) {
+        struct net_udp_datagram *last = &udp->queue[udp->queued - 1];
+
+        if (last->seg == seg &&
+            last->offset + last->len == offset &&
+            last->len + len <= NET_UDP_MAX_PAYLOAD) {
+            last->len += len;
+            pthread_mutex_unlock(&udp->queue_lock);
+            return;
+        }
+    }
+
+    while (udp->queued == NET_UDP_QUEUE) {
+        // the sender hasn't got to these yet, so send them ourselves
+        pthread_mutex_unlock(&udp->queue_lock);
+        udpSendQueued(udp);
+        pthread_mutex_lock(&udp->queue_lock);
+    }
+
+    seg->refs++;
+    udp->queue[udp->queued].seg = seg;
+    udp->queue[udp->queued].offset = offset;
+    udp->queue[udp->queued].len = len;
+    udp->queued++;
+
+    // in a busy pass, get the network thread going before the queue fills
+    if (net_thread_running && udp->queued == NET_UDP_QUEUE / 2)
+        netThreadWakeup();
+
+    pthread_mutex_unlock(&udp->queue_lock);
+}
+
+// Send everything queued this pass; done by the network thread, if there
+// is one
+static void netSendDatagrams(void)
+{
+    struct net_service *s;
+
+    for (s = Modes.services; s; s = s->next) {
+        if (s->writer && s->writer->udp)
+            udpSendQueued(s->writer->udp);
+    }
+}
+
+// Handle one datagram received by a UDP input client. Returns -1 if the
+// client was closed.
+static int clientDatagram(struct client *c, const char *data, int len)
+{
+    const unsigned char *header = (const unsigned char *) data;
+    uint32_t seq;
+
+    if (len < NET_UDP_HEADER)
+        return 0; // not one of ours
+
+    seq = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) | ((uint32_t) header[2] << 8) | header[3];
+    net_udp_received++;
+    // a sequence number that went backwards means a reordered datagram or
+    // a restarted sender, rather than a loss
+    if (c->udp_synced && seq != c->udp_seq && seq - c->udp_seq < 0x80000000U)
+        net_udp_lost += seq - c->udp_seq;
+    c->udp_seq = seq + 1;
+    c->udp_synced = 1;
+
+    // Datagrams hold whole messages, so anything left over from the
+    // previous one is garbage
+    data += NET_UDP_HEADER;
+    len -= NET_UDP_HEADER;
+    if (len > c->bufsize)
+        len = c->bufsize;
+    memmove(c->buf, data, len);
+    c->bufstart = 0;
+    c->buflen = len;
+
+    return (clientProcessInput(c) < 0 ? -1 : 0);
+}
+
+// modesReadFromClient() for a UDP input client
+static void clientReadDatagrams(struct client *c)
+{
+    int i;
+
+    for (i = 0; i < NET_UDP_MAX_READS; ++i) {
+        ssize_t nread = recv(c->fd, c->buf, c->bufsize, 0);
+
+        if (nread < 0)
+            return; // nothing more for now (a UDP socket never reaches end of file)
+
+        if (clientDatagram(c, c->buf, nread) < 0)
+            return;
+    }
+}
+
+//
+//=========================================================================
+//
+// Publish the write buffer for the specified writer to all connected
+// clients. The data is actually sent at the end of the current pass by
+// modesNetPeriodicWork, so that each client gets one write per pass.
+//
+static void flushWrites(struct net_writer *writer) {
+    writerPublish(writer);
+    writer->lastWrite = mstime();
+}
+
+// Prepare to write up to 'len' bytes to the given net_writer.
+// Returns a pointer to write to, or NULL to skip this write.
+static void *prepareWrite(struct net_writer *writer, int len) {
+    if (!writer ||
+        !writer->service ||
+        !writer->service->connections ||
+        !writer->data)
+        return NULL;
+
+    // each flush has to fit in a datagram for UDP output
+    int limit = (writer->udp ? NET_UDP_MAX_PAYLOAD : MODES_OUT_BUF_SIZE);
+
+    if (len > limit)
+        return NULL;
+
+    if (writer->dataUsed + len >= limit) {
+        // Flush now to free some space
+        flushWrites(writer);
+    }
+
+    return writer->data + writer->dataUsed;
+}
+
+// Complete a write previously begun by prepareWrite.
+// endptr should point one byte past the last byte written
+// to the buffer returned from prepareWrite.
+static void completeWrite(struct net_writer *writer, void *endptr) {
+    writer->dataUsed = endptr - writer->data;
+
+    if (writer->dataUsed >= Modes.net_output_flush_size) {
+        flushWrites(writer);
+    }
+}
+
+//
+//=========================================================================
+//
+// Write raw output in Beast Binary format with Timestamp to TCP clients
+//
+static void modesSendBeastVerbatimOutput(struct net_writer *writer, struct modesMessage *mm, struct aircraft __attribute__((unused)) *a) {
+    // Don't forward mlat messages, unless --forward-mlat is set
+    if (mm->source == SOURCE_MLAT && !Modes.forward_mlat)
+        return;
+
+    // Do verbatim output for all messages
+    writeBeastMessage(writer, mm->timestampMsg, mm->signalLevel, mm->verbatim, mm->msgbits / 8);
+}
+
+static void modesSendBeastCookedOutput(struct net_writer *writer, struct modesMessage *mm, struct aircraft *a) {
+    // Don't forward mlat messages, unless --forward-mlat is set
+    if (mm->source == SOURCE_MLAT && !Modes.forward_mlat)
+        return;
+
+    // Filter some messages from cooked output
+    // Don't forward 2-bit-corrected messages
+    if (mm->correctedbits >= 2)
+        return;
+
+    // Don't forward unreliable messages
+    if ((a && !a->reliable) && !mm->reliable)
+        return;
+
+    writeBeastMessage(writer, mm->timestampMsg, mm->signalLevel, mm->msg, mm->msgbits / 8);
+}
+
+static void writeBeastMessage(struct net_writer *writer, uint64_t timestamp, double signalLevel, unsigned char *msg, int msgLen) {
+    char ch;
+    int  j;
+    int sig;
+
+    char *p = prepareWrite(writer, 2 + 2 * (7 + msgLen));
+    if (!p)
+        return;
+
+    *p++ = 0x1a;
+    if      (msgLen == MODES_SHORT_MSG_BYTES)
+      {*p++ = '2';}
+    else if (msgLen == MODES_LONG_MSG_BYTES)
+      {*p++ = '3';}
+    else if (msgLen == MODEAC_MSG_BYTES)
+      {*p++ = '1';}
+    else
+      {return;}
+
+    /* timestamp, big-endian */
+    *p++ = (ch = (timestamp >> 40));
+    if (0x1A == ch) {*p++ = ch; }
+    *p++ = (ch = (timestamp >> 32));
+    if (0x1A == ch) {*p++ = ch; }
+    *p++ = (ch = (timestamp >> 24));
+    if (0x1A == ch) {*p++ = ch; }
+    *p++ = (ch = (timestamp >> 16));
+    if (0x1A == ch) {*p++ = ch; }
+    *p++ = (ch = (timestamp >> 8));
+    if (0x1A == ch) {*p++ = ch; }
+    *p++ = (ch = (timestamp));
+    if (0x1A == ch) {*p++ = ch; }
+
+    sig = round(sqrt(signalLevel) * 255);
+    if (signalLevel > 0 && sig < 1)
+        sig = 1;
+    if (sig > 255)
+        sig = 255;
+    *p++ = ch = (char)sig;
+    if (0x1A == ch) {*p++ = ch; }
+
+    for (j = 0; j < msgLen; j++) {
+        *p++ = (ch = msg[j]);
+        if (0x1A == ch) {*p++ = ch; }
+    }
+
+    completeWrite(writer, p);
+}
+
+static void send_beast_heartbeat(struct net_service *service)
+{
+    static char heartbeat_message[] = { 0x1a, '1', 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    char *data;
+
+    if (!service->writer)
+        return;
+
+    data = prepareWrite(service->writer, sizeof(heartbeat_message));
+    if (!data)
+        return;
+
+    memcpy(data, heartbeat_message, sizeof(heartbeat_message));
+    completeWrite(service->writer, data + sizeof(heartbeat_message));
+}
+
+//
+//=========================================================================
+//
+// Write raw output to TCP clients
+//
+static void modesSendRawOutput(struct net_writer *writer, struct modesMessage *mm, struct aircraft *a) {
+    // Don't ever forward mlat messages via raw output.
     if (mm->source == SOURCE_MLAT)
         return;
 
@@ -504,7 +2658,7 @@ static void modesSendRawOutput(struct modesMessage *mm, struct aircraft *a) {
         return;
 
     int msgLen = mm->msgbits / 8;
-    char *p = prepareWrite(&Modes.raw_out, msgLen*2 + 15);
+    char *p = prepareWrite(writer, msgLen*2 + 15);
     if (!p)
         return;
 
@@ -525,7 +2679,7 @@ static void modesSendRawOutput(struct modesMessage *mm, struct aircraft *a) {
     *p++ = ';';
     *p++ = '\n';
 
-    completeWrite(&Modes.raw_out, p);
+    completeWrite(writer, p);
 }
 
 static void send_raw_heartbeat(struct net_service *service)
@@ -550,7 +2704,7 @@ static void send_raw_heartbeat(struct net_service *service)
 //
 // Write SBS output to TCP clients
 //
-static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
+static void modesSendSBSOutput(struct net_writer *writer, struct modesMessage *mm, struct aircraft *a) {
     char *p;
     struct timespec now;
     struct tm    stTime_receive, stTime_now;
@@ -576,7 +2730,7 @@ static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
     if (mm->addr & MODES_NON_ICAO_ADDRESS)
         return;
 
-    p = prepareWrite(&Modes.sbs_out, 200);
+    p = prepareWrite(writer, 200);
     if (!p)
         return;
 
@@ -765,7 +2919,7 @@ static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
 
     p += sprintf(p, "\r\n");
 
-    completeWrite(&Modes.sbs_out, p);
+    completeWrite(writer, p);
 }
 
 static void send_sbs_heartbeat(struct net_service *service)
@@ -792,7 +2946,7 @@ static void send_sbs_heartbeat(struct net_service *service)
 //
 
 #define STRATUX_MAX_PACKET_SIZE 1000
-static void modesSendStratuxOutput(struct modesMessage *mm, struct aircraft *a) {
+static void modesSendStratuxOutput(struct net_writer *writer, struct modesMessage *mm, struct aircraft *a) {
     char *p;
 
     // We require a tracked aircraft for Stratux output
@@ -807,7 +2961,7 @@ static void modesSendStratuxOutput(struct modesMessage *mm, struct aircraft *a)
     if (!mm->reliable && !a->reliable)
         return;
 
-    p = prepareWrite(&Modes.stratux_out, STRATUX_MAX_PACKET_SIZE); // larger buffer size needed vs SBS
+    p = prepareWrite(writer, STRATUX_MAX_PACKET_SIZE); // larger buffer size needed vs SBS
     if (!p)
         return;
 
@@ -847,161 +3001,673 @@ static void modesSendStratuxOutput(struct modesMessage *mm, struct aircraft *a)
     else
         p = safe_snprintf(p, end, "\"Tail\":null,");
 
-    //// altitude & gnss
-    bool alt_is_geom;
-    if (mm->altitude_baro_valid) {
-        p = safe_snprintf(p, end, "\"Alt\":%d,",mm->altitude_baro);
-        alt_is_geom = false;
-    } else if (mm->altitude_geom_valid) {
-        p = safe_snprintf(p, end, "\"Alt\":%d,",mm->altitude_geom);
-        alt_is_geom = true;
-    } else {
-        p = safe_snprintf(p, end, "\"Alt\":null,");
-        alt_is_geom = false;
+    //// altitude & gnss
+    bool alt_is_geom;
+    if (mm->altitude_baro_valid) {
+        p = safe_snprintf(p, end, "\"Alt\":%d,",mm->altitude_baro);
+        alt_is_geom = false;
+    } else if (mm->altitude_geom_valid) {
+        p = safe_snprintf(p, end, "\"Alt\":%d,",mm->altitude_geom);
+        alt_is_geom = true;
+    } else {
+        p = safe_snprintf(p, end, "\"Alt\":null,");
+        alt_is_geom = false;
+    }
+
+    // altitude source
+    if (alt_is_geom)
+        p = safe_snprintf(p, end, "\"AltIsGNSS\":true,");
+    else
+        p = safe_snprintf(p, end, "\"AltIsGNSS\":false,");
+
+    // GNSS alt. delta From baro alt.
+    if (trackDataValid(&a->geom_delta_valid))
+        p = safe_snprintf(p, end, "\"GnssDiffFromBaroAlt\":%d,",a->geom_delta);
+    else
+        p = safe_snprintf(p, end, "\"GnssDiffFromBaroAlt\":null,");
+    ////
+
+    //// ground speed and track
+    if (mm->gs_valid)
+        p = safe_snprintf(p, end, "\"Speed_valid\":true,\"Speed\":%.0f,", mm->gs.selected);
+    else
+        p = safe_snprintf(p, end, "\"Speed_valid\":false,\"Speed\":null,");
+
+    //// ground heading
+    if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK)
+        p = safe_snprintf(p, end, "\"Track\":%.0f,", mm->heading);
+    else
+        p = safe_snprintf(p, end, "\"Track\":null,");
+
+    //// position
+    if (mm->cpr_decoded)
+        p = safe_snprintf(p, end, "\"Lat\":%.6f,\"Lng\":%.6f,\"Position_valid\":true,",
+                    mm->decoded_lat, mm->decoded_lon);
+    else
+        p = safe_snprintf(p, end, "\"Lat\":null,\"Lng\":null,\"Position_valid\":false,");
+
+    //// vrate (use barometric if possible)
+    if (mm->baro_rate_valid)
+        p = safe_snprintf(p, end, "\"Vvel\":%d,", mm->baro_rate);
+    else if (mm->geom_rate_valid)
+        p = safe_snprintf(p, end, "\"Vvel\":%d,", mm->geom_rate);
+    else
+        p = safe_snprintf(p, end, "\"Vvel\":null,");
+
+    //// squawk
+    if (mm->squawk_valid)
+        p = safe_snprintf(p, end, "\"Squawk\":%x,", mm->squawk);
+    else
+        p = safe_snprintf(p, end, "\"Squawk\":null,");
+
+    // TODO: squawk changing alert support in stratux?
+    // TODO: squawk emergency flag?
+    // TODO: squawk ident flag?
+
+    // airground
+    switch (mm->airground) {
+        case AG_GROUND:
+            p = safe_snprintf(p, end, "\"OnGround\":true,");
+            break;
+        case AG_AIRBORNE:
+            p = safe_snprintf(p, end, "\"OnGround\":false,");
+            break;
+        default:
+            p = safe_snprintf(p, end, "\"OnGround\":null,");
+    }
+
+    // navigation accuracy category - position
+    if (mm->accuracy.nac_p_valid) {
+        p = safe_snprintf(p, end, "\"NACp\":%d,", mm->accuracy.nac_p);
+    } else {
+        p = safe_snprintf(p, end, "\"NACp\":null,");
+    }
+
+    // emitter type
+    int emitter = -1;
+    if ((mm->msgtype ==  17) || (mm->msgtype == 18)) {
+        switch (mm->metype) {
+            case 1:
+                emitter = ((mm->mesub) | 0x18);
+                break;
+            case 2:
+                emitter = ((mm->mesub) | 0x10);
+                break;
+            case 3:
+                emitter = ((mm->mesub) | 0x08);
+                break;
+            case 4:
+                emitter = (mm->mesub);
+                break;
+        }
+    }
+
+    if (emitter >= 0)
+        p = safe_snprintf(p, end, "\"Emitter_category\":%d,", emitter);
+    else
+        p = safe_snprintf(p, end, "\"Emitter_category\":null,");
+
+    // Time message received (based on system clock). Format is 2016-02-20T06:35:43.155Z
+    struct tm stTime_receive;
+    time_t received = (time_t) (mm->sysTimestampMsg / 1000);
+    gmtime_r(&received, &stTime_receive);
+    p = safe_snprintf(p, end, "\"Timestamp\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\"",
+            (stTime_receive.tm_year+1900),(stTime_receive.tm_mon+1),
+            stTime_receive.tm_mday, stTime_receive.tm_hour,
+            stTime_receive.tm_min, stTime_receive.tm_sec,
+            (unsigned)(mm->sysTimestampMsg % 1000));
+
+    p = safe_snprintf(p, end, "}\r\n");
+
+    if (p < end)
+        completeWrite(writer, p);
+    else
+        fprintf(stderr, "stratux: output too large (max %d, overran by %d)\n", STRATUX_MAX_PACKET_SIZE, (int) (p - end));
+}
+
+static void send_stratux_heartbeat(struct net_service *service)
+{
+    static char *heartbeat_message = "{\"Icao_addr\":134217727}\r\n";  // 0x07FFFFFF. Overflows 24-bit ICAO to signal invalic #, need to validate that this won't cause problems with traffic.go
+    char *data;
+    int len = strlen(heartbeat_message);
+
+    if (!service->writer)
+        return;
+
+    data = prepareWrite(service->writer, len);
+    if (!data)
+        return;
+
+    memcpy(data, heartbeat_message, len);
+    completeWrite(service->writer, data + len);
+}
+
+//
+//=========================================================================
+//
+// Output filters.
+//
+// A client can ask for just part of an output: some address ranges, some
+// downlink formats, ADS-B only, or aircraft within a box. Each distinct
+// filter gets its own variant of the output service, with its own writer,
+// so clients that want the same thing still share one encoded stream; each
+// message is checked against each distinct filter once, and only written to
+// the variants that want it.
+//
+// Filters are given as terms separated by spaces or semicolons, all of
+// which must match:
+//
+//   icao=<hex>[-<hex>][,...]     address, or range of addresses
+//   df=<n>[,...]                 downlink format
+//   adsb                         ADS-B messages only
+//   bbox=<s>,<w>,<n>,<e>         aircraft with a known position in this box
+//
+// They are set per listening port with --net-filter <port>:<filter>, or by
+// a Beast output client sending 0x1a 'F' <c> for each character of the
+// filter followed by 0x1a 'F' 0x00 (an empty filter removes it again).
+//
+// Filtered services are created on demand by the thread that handles the
+// clients (the network thread, if there is one), and are only linked into
+// the service and writer lists once they are complete. A service for a
+// filter that came from a client is unlinked again by that thread when its
+// last client leaves, and freed by the main thread at the start of its next
+// modesNetPeriodicWork(), when it can't be part way through walking those
+// lists. Services for --net-filter ports last as long as their listeners.
+//
+// Only NET_MAX_CLIENT_FILTERS distinct client filters can be in use at
+// once; a client asking for another one is left as it was.
+//
+
+#define NET_FILTER_MAX_RANGES 16
+#define NET_FILTER_MAX_SPEC 512
+#define NET_MAX_CLIENT_FILTERS 64
+
+struct net_filter {
+    struct net_filter *next;    // all distinct filters in use (or, once unused, waiting to be freed)
+    int permanent;              // used by a --net-filter port, so never freed
+    int users;                  // filtered writers using this
+    uint32_t df_mask;           // bit n set: accept DF n (0: any DF)
+    int adsb_only;
+    int icao_count;             // number of address ranges (0: any address)
+    struct {
+        uint32_t lo, hi;
+    } icao[NET_FILTER_MAX_RANGES];
+    int bbox;                   // if set, only aircraft inside south..north, west..east
+    double south, west, north, east;
+
+    uint64_t checked;           // message number this was last checked against..
+    int matched;                // ..and the result
+};
+
+struct net_port_filter {
+    struct net_port_filter *next;
+    char *port;
+    struct net_filter *filter;
+};
+
+static struct net_filter *net_filters;
+static int net_client_filters;      // entries in net_filters that aren't permanent
+static struct net_port_filter *net_port_filters;
+
+// Unlinked, waiting for the main thread to free them
+static _Atomic(struct net_service *) net_retired_services;
+static _Atomic(struct net_filter *) net_retired_filters;
+static uint64_t net_output_messages;
+
+static const char *filterParseDF(const char *p, struct net_filter *filter)
+{
+    for (;;) {
+        char *end;
+        long df = strtol(p, &end, 10);
+
+        if (end == p || df < 0 || df > 31)
+            return "bad downlink format";
+        filter->df_mask |= (1U << df);
+
+        if (*end == '\0')
+            return NULL;
+        if (*end != ',')
+            return "bad downlink format";
+        p = end + 1;
+    }
+}
+
+static const char *filterParseICAO(const char *p, struct net_filter *filter)
+{
+    for (;;) {
+        char *end;
+        unsigned long lo, hi;
+
+        lo = hi = strtoul(p, &end, 16);
+        if (end == p)
+            return "bad address";
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul(p, &end, 16);
+            if (end == p)
+                return "bad address";
+        }
+
+        if (lo > hi || hi > 0xFFFFFF)
+            return "bad address range";
+        if (filter->icao_count == NET_FILTER_MAX_RANGES)
+            return "too many address ranges";
+        filter->icao[filter->icao_count].lo = lo;
+        filter->icao[filter->icao_count].hi = hi;
+        filter->icao_count++;
+
+        if (*end == '\0')
+            return NULL;
+        if (*end != ',')
+            return "bad address";
+        p = end + 1;
+    }
+}
+
+// Parse "south,west,north,east" into v[0..3]. Returns NULL on success, or a
+// description of what's wrong with it.
+static const char *parseBBox(const char *p, double *v)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        char *end;
+
+        v[i] = strtod(p, &end);
+        if (end == p || *end != (i == 3 ? '\0' : ','))
+            return "bad bounding box (expected south,west,north,east)";
+        p = end + 1;
+    }
+
+    if (v[0] < -90 || v[2] > 90 || v[0] > v[2] || v[1] < -180 || v[1] > 180 || v[3] < -180 || v[3] > 180)
+        return "bad bounding box (expected south,west,north,east)";
+
+    return NULL;
+}
+
+static const char *filterParseBBox(const char *p, struct net_filter *filter)
+{
+    double v[4];
+    const char *err;
+
+    if ((err = parseBBox(p, v)))
+        return err;
+
+    filter->bbox = 1;
+    filter->south = v[0];
+    filter->west = v[1];
+    filter->north = v[2];
+    filter->east = v[3];
+    return NULL;
+}
+
+// Parse a filter spec. Returns NULL on success, or a description of what's
+// wrong with it.
+static const char *filterParse(const char *spec, struct net_filter *filter)
+{
+    char *copy, *term, *save;
+    const char *err = NULL;
+
+    memset(filter, 0, sizeof(*filter));
+
+    if (!(copy = strdup(spec))) {
+        fprintf(stderr, "Out of memory parsing an output filter\n");
+        exit(1);
+    }
+
+    for (term = strtok_r(copy, " ;", &save); term && !err; term = strtok_r(NULL, " ;", &save)) {
+        if (!strcmp(term, "adsb"))
+            filter->adsb_only = 1;
+        else if (!strncmp(term, "df=", 3))
+            err = filterParseDF(term + 3, filter);
+        else if (!strncmp(term, "icao=", 5))
+            err = filterParseICAO(term + 5, filter);
+        else if (!strncmp(term, "bbox=", 5))
+            err = filterParseBBox(term + 5, filter);
+        else
+            err = "unknown filter term";
+    }
+
+    free(copy);
+    return err;
+}
+
+static int filterEqual(const struct net_filter *f1, const struct net_filter *f2)
+{
+    int i;
+
+    if (f1->df_mask != f2->df_mask || f1->adsb_only != f2->adsb_only ||
+        f1->icao_count != f2->icao_count || f1->bbox != f2->bbox)
+        return 0;
+
+    for (i = 0; i < f1->icao_count; ++i) {
+        if (f1->icao[i].lo != f2->icao[i].lo || f1->icao[i].hi != f2->icao[i].hi)
+            return 0;
+    }
+
+    return (!f1->bbox ||
+            (f1->south == f2->south && f1->west == f2->west && f1->north == f2->north && f1->east == f2->east));
+}
+
+static int filterEmpty(const struct net_filter *filter)
+{
+    return !filter->df_mask && !filter->adsb_only && !filter->icao_count && !filter->bbox;
+}
+
+// The shared copy of a parsed filter, or NULL if it doesn't filter anything.
+// Also NULL for a new client (not permanent) filter if there are already
+// NET_MAX_CLIENT_FILTERS of them.
+static struct net_filter *filterIntern(const struct net_filter *filter, int permanent)
+{
+    struct net_filter *f;
+
+    if (filterEmpty(filter))
+        return NULL;
+
+    for (f = net_filters; f; f = f->next) {
+        if (filterEqual(f, filter)) {
+            if (permanent && !f->permanent) {
+                f->permanent = 1;
+                --net_client_filters;
+            }
+            return f;
+        }
+    }
+
+    if (!permanent && net_client_filters >= NET_MAX_CLIENT_FILTERS)
+        return NULL;
+
+    if (!(f = malloc(sizeof(*f)))) {
+        fprintf(stderr, "Out of memory allocating an output filter\n");
+        exit(1);
+    }
+
+    *f = *filter;
+    f->permanent = permanent;
+    f->users = 0;
+    f->checked = 0;
+    f->next = net_filters;
+    net_filters = f;
+    if (!permanent)
+        ++net_client_filters;
+    return f;
+}
+
+// Unlink a client filter that is no longer used, and leave it to be freed
+// along with the services that used it
+static void filterRelease(struct net_filter *filter)
+{
+    struct net_filter **fp;
+
+    if (--filter->users || filter->permanent)
+        return;
+
+    for (fp = &net_filters; *fp != filter; fp = &(*fp)->next)
+        ;
+    *fp = filter->next;
+    --net_client_filters;
+
+    filter->next = net_retired_filters;
+    while (!atomic_compare_exchange_weak(&net_retired_filters, &filter->next, filter))
+        ;
+}
+
+static int filterMatches(struct net_filter *filter, struct modesMessage *mm, struct aircraft *a)
+{
+    int i;
+
+    if (filter->checked == net_output_messages)
+        return filter->matched;
+
+    filter->checked = net_output_messages;
+    filter->matched = 0;
+
+    if (filter->df_mask && (mm->msgtype > 31 || !(filter->df_mask & (1U << mm->msgtype))))
+        return 0;
+
+    if (filter->adsb_only && mm->source != SOURCE_ADSB)
+        return 0;
+
+    if (filter->icao_count) {
+        // non-ICAO addresses (Mode A/C, anonymous TIS-B) have bit 24 set,
+        // so they never match
+        for (i = 0; i < filter->icao_count; ++i) {
+            if (mm->addr >= filter->icao[i].lo && mm->addr <= filter->icao[i].hi)
+                break;
+        }
+        if (i == filter->icao_count)
+            return 0;
     }
 
-    // altitude source
-    if (alt_is_geom)
-        p = safe_snprintf(p, end, "\"AltIsGNSS\":true,");
-    else
-        p = safe_snprintf(p, end, "\"AltIsGNSS\":false,");
+    if (filter->bbox) {
+        if (!a || !trackDataValid(&a->position_valid))
+            return 0;
+        if (!trackInBox(a->lat, a->lon, filter->south, filter->west, filter->north, filter->east))
+            return 0;
+    }
 
-    // GNSS alt. delta From baro alt.
-    if (trackDataValid(&a->geom_delta_valid))
-        p = safe_snprintf(p, end, "\"GnssDiffFromBaroAlt\":%d,",a->geom_delta);
-    else
-        p = safe_snprintf(p, end, "\"GnssDiffFromBaroAlt\":null,");
-    ////
+    return (filter->matched = 1);
+}
 
-    //// ground speed and track
-    if (mm->gs_valid)
-        p = safe_snprintf(p, end, "\"Speed_valid\":true,\"Speed\":%.0f,", mm->gs.selected);
-    else
-        p = safe_snprintf(p, end, "\"Speed_valid\":false,\"Speed\":null,");
+int netAddPortFilter(const char *arg)
+{
+    struct net_port_filter *pf;
+    struct net_filter filter;
+    const char *colon = strchr(arg, ':');
+    const char *err;
+
+    if (!colon || colon == arg) {
+        fprintf(stderr, "Bad --net-filter '%s' (expected <port>:<filter>)\n", arg);
+        return -1;
+    }
 
-    //// ground heading
-    if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK)
-        p = safe_snprintf(p, end, "\"Track\":%.0f,", mm->heading);
-    else
-        p = safe_snprintf(p, end, "\"Track\":null,");
+    if ((err = filterParse(colon + 1, &filter))) {
+        fprintf(stderr, "Bad --net-filter '%s': %s\n", arg, err);
+        return -1;
+    }
 
-    //// position
-    if (mm->cpr_decoded)
-        p = safe_snprintf(p, end, "\"Lat\":%.6f,\"Lng\":%.6f,\"Position_valid\":true,",
-                    mm->decoded_lat, mm->decoded_lon);
-    else
-        p = safe_snprintf(p, end, "\"Lat\":null,\"Lng\":null,\"Position_valid\":false,");
+    if (!(pf = malloc(sizeof(*pf))) || !(pf->port = strndup(arg, colon - arg))) {
+        fprintf(stderr, "Out of memory allocating an output filter\n");
+        exit(1);
+    }
 
-    //// vrate (use barometric if possible)
-    if (mm->baro_rate_valid)
-        p = safe_snprintf(p, end, "\"Vvel\":%d,", mm->baro_rate);
-    else if (mm->geom_rate_valid)
-        p = safe_snprintf(p, end, "\"Vvel\":%d,", mm->geom_rate);
-    else
-        p = safe_snprintf(p, end, "\"Vvel\":null,");
+    pf->filter = filterIntern(&filter, 1);
+    pf->next = net_port_filters;
+    net_port_filters = pf;
+    return 0;
+}
 
-    //// squawk
-    if (mm->squawk_valid)
-        p = safe_snprintf(p, end, "\"Squawk\":%x,", mm->squawk);
-    else
-        p = safe_snprintf(p, end, "\"Squawk\":null,");
+int netSetJsonRegion(const char *arg)
+{
+    double v[4];
+    const char *err;
 
-    // TODO: squawk changing alert support in stratux?
-    // TODO: squawk emergency flag?
-    // TODO: squawk ident flag?
+    if ((err = parseBBox(arg, v))) {
+        fprintf(stderr, "Bad --write-json-region '%s': %s\n", arg, err);
+        return -1;
+    }
 
-    // airground
-    switch (mm->airground) {
-        case AG_GROUND:
-            p = safe_snprintf(p, end, "\"OnGround\":true,");
-            break;
-        case AG_AIRBORNE:
-            p = safe_snprintf(p, end, "\"OnGround\":false,");
-            break;
-        default:
-            p = safe_snprintf(p, end, "\"OnGround\":null,");
+    Modes.json_region = 1;
+    Modes.json_region_south = v[0];
+    Modes.json_region_west = v[1];
+    Modes.json_region_north = v[2];
+    Modes.json_region_east = v[3];
+    return 0;
+}
+
+// The filter for clients of a listening port, or NULL if there isn't one
+static struct net_filter *portFilter(const char *port)
+{
+    struct net_port_filter *pf;
+
+    for (pf = net_port_filters; pf; pf = pf->next) {
+        if (!strcmp(pf->port, port))
+            return pf->filter;
     }
 
-    // navigation accuracy category - position
-    if (mm->accuracy.nac_p_valid) {
-        p = safe_snprintf(p, end, "\"NACp\":%d,", mm->accuracy.nac_p);
-    } else {
-        p = safe_snprintf(p, end, "\"NACp\":null,");
+    return NULL;
+}
+
+// The variant of an output service that only carries messages matching
+// the given filter (or the unfiltered service, if filter is NULL),
+// created on first use
+static struct net_service *filteredService(struct net_service *service, struct net_filter *filter)
+{
+    struct net_writer *base, *writer;
+    struct net_service *s;
+    char *descr;
+
+    if (service->unfiltered)
+        service = service->unfiltered;
+    if (!filter)
+        return service;
+
+    base = service->writer;
+    for (writer = base->filtered; writer; writer = writer->filtered) {
+        if (writer->filter == filter)
+            return writer->service;
     }
 
-    // emitter type
-    int emitter = -1;
-    if ((mm->msgtype ==  17) || (mm->msgtype == 18)) {
-        switch (mm->metype) {
-            case 1:
-                emitter = ((mm->mesub) | 0x18);
-                break;
-            case 2:
-                emitter = ((mm->mesub) | 0x10);
-                break;
-            case 3:
-                emitter = ((mm->mesub) | 0x08);
-                break;
-            case 4:
-                emitter = (mm->mesub);
-                break;
-        }
+    if (!(writer = calloc(1, sizeof(*writer))) || !(descr = malloc(strlen(service->descr) + 12))) {
+        fprintf(stderr, "Out of memory allocating a filtered %s service\n", service->descr);
+        exit(1);
     }
 
-    if (emitter >= 0)
-        p = safe_snprintf(p, end, "\"Emitter_category\":%d,", emitter);
-    else
-        p = safe_snprintf(p, end, "\"Emitter_category\":null,");
+    sprintf(descr, "%s (filtered)", service->descr);
+    writer->overflow = base->overflow;
+    writer->filter = filter;
+    ++filter->users;
+
+    // serviceInit publishes the service itself; publish the writer after it
+    s = serviceInit(descr, writer, base->send_heartbeat, service->read_mode, service->read_sep, service->read_handler);
+    s->unfiltered = service;
+    writer->filtered = base->filtered;
+    base->filtered = writer;
+    return s;
+}
 
-    // Time message received (based on system clock). Format is 2016-02-20T06:35:43.155Z
-    struct tm stTime_receive;
-    time_t received = (time_t) (mm->sysTimestampMsg / 1000);
-    gmtime_r(&received, &stTime_receive);
-    p = safe_snprintf(p, end, "\"Timestamp\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\"",
-            (stTime_receive.tm_year+1900),(stTime_receive.tm_mon+1),
-            stTime_receive.tm_mday, stTime_receive.tm_hour,
-            stTime_receive.tm_min, stTime_receive.tm_sec,
-            (unsigned)(mm->sysTimestampMsg % 1000));
+// Called by the thread that handles clients when a client leaves a
+// service: if it was the last client of a service for a client filter,
+// unlink the service so that nothing new can find it, and leave it for
+// filteredServicesFree()
+static void filteredServiceRelease(struct net_service *service)
+{
+    struct net_writer *writer = service->writer;
+    _Atomic(struct net_writer *) *wp;
+    _Atomic(struct net_service *) *sp;
 
-    p = safe_snprintf(p, end, "}\r\n");
+    if (!service->unfiltered || service->connections || writer->filter->permanent)
+        return;
 
-    if (p < end)
-        completeWrite(&Modes.stratux_out, p);
-    else
-        fprintf(stderr, "stratux: output too large (max %d, overran by %d)\n", STRATUX_MAX_PACKET_SIZE, (int) (p - end));
+    // anyone walking these lists right now can still step past it
+    for (wp = &service->unfiltered->writer->filtered; *wp != writer; wp = &(*wp)->filtered)
+        ;
+    *wp = writer->filtered;
+    for (sp = &Modes.services; *sp != service; sp = &(*sp)->next)
+        ;
+    *sp = service->next;
+
+    filterRelease(writer->filter);
+
+    service->retired = net_retired_services;
+    while (!atomic_compare_exchange_weak(&net_retired_services, &service->retired, service))
+        ;
 }
 
-static void send_stratux_heartbeat(struct net_service *service)
+// Free the services and filters unlinked by filteredServiceRelease(). Only
+// the main thread walks the lists outside of the client-handling thread,
+// and this is called from it between walks.
+static void filteredServicesFree(void)
 {
-    static char *heartbeat_message = "{\"Icao_addr\":134217727}\r\n";  // 0x07FFFFFF. Overflows 24-bit ICAO to signal invalic #, need to validate that this won't cause problems with traffic.go
-    char *data;
-    int len = strlen(heartbeat_message);
+    struct net_service *service = atomic_exchange(&net_retired_services, NULL);
+    struct net_filter *filter = atomic_exchange(&net_retired_filters, NULL);
 
-    if (!service->writer)
-        return;
+    while (service) {
+        struct net_service *next = service->retired;
 
-    data = prepareWrite(service->writer, len);
-    if (!data)
-        return;
+        segmentRelease(service->writer->tail);
+        free(service->writer);
+        free((char *) service->descr);
+        free(service);
+        service = next;
+    }
 
-    memcpy(data, heartbeat_message, len);
-    completeWrite(service->writer, data + len);
+    while (filter) {
+        struct net_filter *next = filter->next;
+
+        free(filter);
+        filter = next;
+    }
+}
+
+static int writerHasClients(struct net_writer *writer)
+{
+    return writer->service && writer->service->connections;
+}
+
+typedef void (*output_fn)(struct net_writer *, struct modesMessage *, struct aircraft *);
+
+// Pass a message to an output's writer, and to each of its filtered
+// variants that has clients and wants the message
+static void queueFilteredOutput(struct net_writer *writer, output_fn send, int verbatim, struct modesMessage *mm, struct aircraft *a)
+{
+    for (; writer; writer = writer->filtered) {
+        if (!writerHasClients(writer))
+            continue;
+
+        // Tracking, and with it decoding, is skipped when nothing needed it
+        // at the time the decision was made (see trackingNeeded() in mode_s.c).
+        // A client that connected since then must still see a decoded message;
+        // only unfiltered verbatim Beast output can do without.
+        if (!verbatim || writer->filter)
+            decodeModesMessageFields(mm);
+
+        if (!writer->filter || filterMatches(writer->filter, mm, a))
+            send(writer, mm, a);
+    }
 }
 
 //
 //=========================================================================
 //
 void modesQueueOutput(struct modesMessage *mm, struct aircraft *a) {
+    ++net_output_messages;
 
     // Delegate to the format-specific outputs, each of which makes its own decision about filtering messages
-    modesSendSBSOutput(mm, a);
-    modesSendStratuxOutput(mm, a);
-    modesSendRawOutput(mm, a);
-    modesSendBeastVerbatimOutput(mm, a);
-    modesSendBeastCookedOutput(mm, a);
+    queueFilteredOutput(&Modes.sbs_out, modesSendSBSOutput, 0, mm, a);
+    queueFilteredOutput(&Modes.stratux_out, modesSendStratuxOutput, 0, mm, a);
+    queueFilteredOutput(&Modes.raw_out, modesSendRawOutput, 0, mm, a);
+    queueFilteredOutput(&Modes.beast_verbatim_out, modesSendBeastVerbatimOutput, 1, mm, a);
+    queueFilteredOutput(&Modes.beast_cooked_out, modesSendBeastCookedOutput, 0, mm, a);
     writeFATSVEvent(mm, a);
 }
 
+// Returns non-zero if any writer in the list starting at this one (only
+// counting filtered ones, if filtered_only is set) has clients
+static int writersHaveClients(struct net_writer *writer, int filtered_only)
+{
+    for (; writer; writer = writer->filtered) {
+        if ((writer->filter || !filtered_only) && writerHasClients(writer))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Returns non-zero if any connected output client wants data derived from
+// tracked aircraft state. Verbatim Beast output only needs the raw message,
+// so a node that only forwards verbatim data can skip tracking entirely;
+// filters need the decoded message though.
+int modesNetNeedsTracking(void)
+{
+    return writersHaveClients(&Modes.raw_out, 0) ||
+        writersHaveClients(&Modes.beast_cooked_out, 0) ||
+        writersHaveClients(&Modes.beast_verbatim_out, 1) ||
+        writersHaveClients(&Modes.sbs_out, 0) ||
+        writersHaveClients(&Modes.stratux_out, 0) ||
+        writerHasClients(&Modes.fatsv_out);
+}
+
 // Decode a little-endian IEEE754 float (binary32)
 static float ieee754_binary32_le_to_float(uint8_t *data)
 {
@@ -1055,17 +3721,20 @@ static void handle_radarcape_position(float lat, float lon, float alt)
 // recompute global Mode A/C setting
 static void autoset_modeac() {
     struct client *c;
+    int mode_ac = 0;
 
     if (!Modes.mode_ac_auto)
         return;
 
-    Modes.mode_ac = 0;
     for (c = Modes.clients; c; c = c->next) {
         if (c->modeac_requested) {
-            Modes.mode_ac = 1;
+            mode_ac = 1;
             break;
         }
     }
+
+    // the demodulator reads this concurrently, store it just once
+    Modes.mode_ac = mode_ac;
 }
 
 // Send some Beast settings commands to a client
@@ -1089,66 +3758,248 @@ void sendBeastSettings(struct client *c, const char *settings)
 // Move a network client to a new service
 static void moveNetClient(struct client *c, struct net_service *new_service)
 {
+    struct net_service *old_service = c->service;
+    uint64_t pending = 0;
+
     if (c->service == new_service)
         return;
 
+    // Flush to ensure correct message framing. The network thread can't
+    // flush, but it doesn't need to: published output always ends on a
+    // message boundary, and that's all we look at.
     if (c->service) {
-        // Flush to ensure correct message framing
-        if (c->service->writer)
-            flushWrites(c->service->writer);
+        if (c->service->writer) {
+            if (!net_thread_running)
+                flushWrites(c->service->writer);
+            pending = clientBacklog(c);
+        }
         --c->service->connections;
     }
 
     if (new_service) {
-        // Flush to ensure correct message framing
-        if (new_service->writer)
+        if (new_service->writer && !net_thread_running)
             flushWrites(new_service->writer);
         ++new_service->connections;
     }
 
-    c->service = new_service;
+    if (pending && new_service && new_service->writer) {
+        // Send what is already pending on the old stream, up to its current
+        // end, then carry on from here in the new one
+        int old_offset;
+        struct net_segment *old_tail = writerTail(c->service->writer, &old_offset);
+
+        if (c->resume_seg) {
+            clientDropped(c, streamPosition(old_tail, old_offset) - streamPosition(c->resume_seg, c->resume_offset));
+            segmentRelease(c->resume_seg);
+        } else if (c->stop_seg) {
+            clientDropped(c, streamPosition(old_tail, old_offset) - c->skip_from);
+        } else {
+            c->stop_seg = old_tail;
+            c->stop_offset = old_offset;
+        }
+        segmentRelease(old_tail);   // still reachable from the client's cursor
+
+        c->resume_seg = writerTail(new_service->writer, &c->resume_offset);
+        c->service = new_service;
+    } else {
+        clientDetachStream(c);
+        c->service = new_service;
+        clientAttachStream(c);
+    }
+
+    netEventUpdate(c);
+
+    if (old_service)
+        filteredServiceRelease(old_service);
+}
+
+// Handle one character of a filter sent as Beast commands, see "Output
+// filters". An invalid filter, or a new one past NET_MAX_CLIENT_FILTERS, is
+// ignored.
+static void clientFilterCommand(struct client *c, char ch)
+{
+    struct net_filter filter, *f = NULL;
+
+    if (ch) {
+        if (!c->filter_spec && !(c->filter_spec = malloc(NET_FILTER_MAX_SPEC + 1))) {
+            fprintf(stderr, "Out of memory allocating a client filter\n");
+            exit(1);
+        }
+        if (c->filter_len < NET_FILTER_MAX_SPEC)
+            c->filter_spec[c->filter_len] = ch;
+        ++c->filter_len; // if it gets too long, we remember that and ignore it
+        return;
+    }
+
+    if (c->filter_len > NET_FILTER_MAX_SPEC) {
+        c->filter_len = 0;
+        return;
+    }
+
+    if (c->filter_len) {
+        c->filter_spec[c->filter_len] = '\0';
+        c->filter_len = 0;
+        if (filterParse(c->filter_spec, &filter))
+            return;
+        if (!(f = filterIntern(&filter, 0)) && !filterEmpty(&filter))
+            return; // too many filters in use
+    }
+
+    moveNetClient(c, filteredService(c->service, f));
 }
 
 //
 // Handle a Beast command message.
-// Currently, we just look for the Mode A/C command message
-// and ignore everything else.
+// Currently, we just look for the Mode A/C command message and the filter
+// commands, and ignore everything else.
 //
 static int handleBeastCommand(struct client *c, char *p) {
+    if (p[0] == 'F') {
+        clientFilterCommand(c, p[1]);
+        return 0;
+    }
+
     if (p[0] != '1') {
         // huh?
         return 0;
     }
 
-    switch (p[1]) {
-    case 'j':
-        c->modeac_requested = 0;
-        autoset_modeac();
-        break;
-    case 'J':
-        c->modeac_requested = 1;
-        autoset_modeac();
-        break;
-    case 'v':
-        moveNetClient(c, Modes.beast_cooked_service);
-        break;
-    case 'V':
-        moveNetClient(c, Modes.beast_verbatim_service);
-        break;
+    switch (p[1]) {
+    case 'j':
+        c->modeac_requested = 0;
+        autoset_modeac();
+        break;
+    case 'J':
+        c->modeac_requested = 1;
+        autoset_modeac();
+        break;
+    case 'v':
+        moveNetClient(c, filteredService(Modes.beast_cooked_service, c->service->writer->filter));
+        break;
+    case 'V':
+        moveNetClient(c, filteredService(Modes.beast_verbatim_service, c->service->writer->filter));
+        break;
+    }
+
+    return 0;
+}
+
+// The read handlers only parse their input into a net_frame record;
+// decodeNetFrame() does the rest. Without a network thread each record is
+// decoded as soon as it is complete. With one, the network thread parses
+// and the main thread decodes, and the records are passed between them
+// through a single-producer, single-consumer ring.
+
+// Where the next record should be parsed into. Returns NULL if we are
+// shutting down while waiting for room.
+static struct net_frame *netFrameSlot(void)
+{
+    static struct net_frame single;
+    unsigned tail;
+
+    if (!net_frame_ring)
+        return &single;
+
+    tail = atomic_load_explicit(&net_frame_tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&net_frame_head, memory_order_acquire) >= NET_FRAME_RING_SIZE) {
+        // The main thread is behind. Stop reading until it catches up, so
+        // that TCP pushes back on the sender rather than us dropping input.
+        struct timespec slp = { 0, 1000 * 1000 };
+        if (Modes.exit)
+            return NULL;
+        netThreadSignalInput(); // a big read can fill the ring before we get round to this otherwise
+        nanosleep(&slp, NULL);
+    }
+
+    return &net_frame_ring[tail & (NET_FRAME_RING_SIZE - 1)];
+}
+
+// A record returned by netFrameSlot() is complete
+static void netFrameCommit(struct net_frame *frame)
+{
+    if (!net_frame_ring)
+        decodeNetFrame(frame);
+    else
+        ++net_frame_tail;
+}
+
+// Decode the records queued by the network thread (main thread)
+static void netFrameDecodeQueued(void)
+{
+    unsigned head = atomic_load_explicit(&net_frame_head, memory_order_relaxed);
+    unsigned tail = net_frame_tail;
+
+    while (head != tail) {
+        decodeNetFrame(&net_frame_ring[head & (NET_FRAME_RING_SIZE - 1)]);
+        atomic_store_explicit(&net_frame_head, ++head, memory_order_release);
+    }
+}
+
+//
+// Decode a record parsed from network input
+//
+// The message is passed to the higher level layers, so it feeds
+// the selected screen output, the network output and so forth.
+//
+// If the message looks invalid it is silently discarded.
+//
+static void decodeNetFrame(struct net_frame *frame)
+{
+    struct modesMessage mm;
+
+    if (frame->type == '5') {
+        // Special case for Radarcape position messages.
+        float lat, lon, alt;
+
+        lat = ieee754_binary32_le_to_float(frame->msg + 4);
+        lon = ieee754_binary32_le_to_float(frame->msg + 8);
+        alt = ieee754_binary32_le_to_float(frame->msg + 12);
+
+        handle_radarcape_position(lat, lon, alt);
+        return;
+    }
+
+    resetModesMessage(&mm);
+
+    // Mark messages received over the internet as remote so that we don't try to
+    // pass them off as being received by this instance when forwarding them
+    mm.remote      =    1;
+
+    mm.timestampMsg = frame->timestamp;
+    mm.sysTimestampMsg = frame->sysTimestamp;
+    mm.signalLevel = frame->signal / 255.0;
+    mm.signalLevel = mm.signalLevel * mm.signalLevel;
+
+    if (frame->type == '1') { // ModeA or ModeC
+        Modes.stats_current.remote_received_modeac++;
+        decodeModeAMessage(&mm, ((frame->msg[0] << 8) | frame->msg[1]));
+    } else {
+        int result;
+
+        Modes.stats_current.remote_received_modes++;
+        result = decodeModesMessage(&mm, frame->msg);
+        if (result < 0) {
+            if (result == -1)
+                Modes.stats_current.remote_rejected_unknown_icao++;
+            else
+                Modes.stats_current.remote_rejected_bad++;
+            return;
+        } else {
+            Modes.stats_current.remote_accepted[mm.correctedbits]++;
+        }
     }
 
-    return 0;
+    useModesMessage(&mm);
 }
 
 //
 //=========================================================================
 //
-// This function decodes a Beast binary format message
-//
-// The message is passed to the higher level layers, so it feeds
-// the selected screen output, the network output and so forth.
+// This function parses a Beast binary format message, starting at the
+// type byte. Escaped 0x1a bytes have already been undone by the scanner
+// (see clientScanBeast).
 //
-// If the message looks invalid it is silently discarded.
+// The result is handed to decodeNetFrame(), see above.
 //
 // The function always returns 0 (success) to the caller as there is no
 // case where we want broken messages here to close the client connection.
@@ -1157,11 +4008,8 @@ static int decodeBinMessage(struct client *c, char *p) {
     int msgLen = 0;
     int  j;
     char ch;
-    unsigned char msg[MODES_LONG_MSG_BYTES + 7];
-    static struct modesMessage zeroMessage;
-    struct modesMessage mm;
+    struct net_frame *frame;
     MODES_NOTUSED(c);
-    memset(&mm, 0, sizeof(mm));
 
     ch = *p++; /// Get the message type
 
@@ -1173,72 +4021,33 @@ static int decodeBinMessage(struct client *c, char *p) {
         msgLen = MODES_LONG_MSG_BYTES;
     } else if (ch == '5') {
         // Special case for Radarcape position messages.
-        float lat, lon, alt;
-
-        for (j = 0; j < 21; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {p++;}
-        }
-
-        lat = ieee754_binary32_le_to_float(msg + 4);
-        lon = ieee754_binary32_le_to_float(msg + 8);
-        alt = ieee754_binary32_le_to_float(msg + 12);
-
-        handle_radarcape_position(lat, lon, alt);
+        msgLen = sizeof(frame->msg);
     } else {
         // Ignore this.
         return 0;
     }
 
-    if (msgLen) {
-        mm = zeroMessage;
-
-        // Mark messages received over the internet as remote so that we don't try to
-        // pass them off as being received by this instance when forwarding them
-        mm.remote      =    1;
+    if (!(frame = netFrameSlot()))
+        return 0;
+    frame->type = ch;
 
+    if (ch != '5') {
         // Grab the timestamp (big endian format)
-        mm.timestampMsg = 0;
+        frame->timestamp = 0;
         for (j = 0; j < 6; j++) {
             ch = *p++;
-            mm.timestampMsg = mm.timestampMsg << 8 | (ch & 255);
-            if (0x1A == ch) {p++;}
+            frame->timestamp = frame->timestamp << 8 | (ch & 255);
         }
 
         // record reception time as the time we read it.
-        mm.sysTimestampMsg = mstime();
+        frame->sysTimestamp = mstime();
 
-        ch = *p++;  // Grab the signal level
-        mm.signalLevel = ((unsigned char)ch / 255.0);
-        mm.signalLevel = mm.signalLevel * mm.signalLevel;
-        if (0x1A == ch) {p++;}
-
-        for (j = 0; j < msgLen; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {p++;}
-        }
+        frame->signal = (unsigned char) *p++; // Grab the signal level
+    }
 
-        if (msgLen == MODEAC_MSG_BYTES) { // ModeA or ModeC
-            Modes.stats_current.remote_received_modeac++;
-            decodeModeAMessage(&mm, ((msg[0] << 8) | msg[1]));
-        } else {
-            int result;
-
-            Modes.stats_current.remote_received_modes++;
-            result = decodeModesMessage(&mm, msg);
-            if (result < 0) {
-                if (result == -1)
-                    Modes.stats_current.remote_rejected_unknown_icao++;
-                else
-                    Modes.stats_current.remote_rejected_bad++;
-                return 0;
-            } else {
-                Modes.stats_current.remote_accepted[mm.correctedbits]++;
-            }
-        }
+    memcpy(frame->msg, p, msgLen); // and the data
 
-        useModesMessage(&mm);
-    }
+    netFrameCommit(frame);
     return (0);
 }
 //
@@ -1247,20 +4056,26 @@ static int decodeBinMessage(struct client *c, char *p) {
 // Turn an hex digit into its 4 bit decimal value.
 // Returns -1 if the digit is not in the 0-F range.
 //
-static int hexDigitVal(int c) {
-    c = tolower(c);
-    if (c >= '0' && c <= '9') return c-'0';
-    else if (c >= 'a' && c <= 'f') return c-'a'+10;
-    else return -1;
+// The table holds each digit's value plus one, so that everything else
+// is zero.
+//
+static const unsigned char hex_digit_table[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+static inline int hexDigitVal(int c) {
+    return hex_digit_table[(unsigned char) c] - 1;
 }
 //
 //=========================================================================
 //
-// This function decodes a string representing message in raw hex format
+// This function parses a string representing message in raw hex format
 // like: *8D4B969699155600E87406F5B69F; The string is null-terminated.
 //
-// The message is passed to the higher level layers, so it feeds
-// the selected screen output, the network output and so forth.
+// The result is handed to decodeNetFrame(), see above.
 //
 // If the message looks invalid it is silently discarded.
 //
@@ -1269,17 +4084,10 @@ static int hexDigitVal(int c) {
 //
 static int decodeHexMessage(struct client *c, char *hex) {
     int l = strlen(hex), j;
-    unsigned char msg[MODES_LONG_MSG_BYTES];
-    struct modesMessage mm;
-    static struct modesMessage zeroMessage;
+    int signal = 0;
+    struct net_frame *frame;
 
     MODES_NOTUSED(c);
-    mm = zeroMessage;
-
-    // Mark messages received over the internet as remote so that we don't try to
-    // pass them off as being received by this instance when forwarding them
-    mm.remote      =    1;
-    mm.signalLevel =    0;
 
     // Remove spaces on the left and on the right
     while(l && isspace(hex[l-1])) {
@@ -1296,8 +4104,7 @@ static int decodeHexMessage(struct client *c, char *hex) {
 
     switch(hex[0]) {
         case '<': {
-            mm.signalLevel = ((hexDigitVal(hex[13])<<4) | hexDigitVal(hex[14])) / 255.0;
-            mm.signalLevel = mm.signalLevel * mm.signalLevel;
+            signal = (hexDigitVal(hex[13])<<4) | hexDigitVal(hex[14]);
             hex += 15; l -= 16; // Skip <, timestamp and siglevel, and ;
             break;}
 
@@ -1325,37 +4132,34 @@ static int decodeHexMessage(struct client *c, char *hex) {
       && (l == (MODEAC_MSG_BYTES * 2)) )
         {return (0);} // Right length for ModeA/C, but not enabled
 
+    if (!(frame = netFrameSlot()))
+        return 0;
+
+    // Decode all the digits, then check them all at once: a zero in the
+    // table means one wasn't valid
+    unsigned valid = 1;
     for (j = 0; j < l; j += 2) {
-        int high = hexDigitVal(hex[j]);
-        int low  = hexDigitVal(hex[j+1]);
+        unsigned high = hex_digit_table[(unsigned char) hex[j]];
+        unsigned low  = hex_digit_table[(unsigned char) hex[j+1]];
 
-        if (high == -1 || low == -1) return 0;
-        msg[j/2] = (high << 4) | low;
+        valid &= (high != 0) & (low != 0);
+        frame->msg[j/2] = ((high - 1) << 4) | (low - 1);
     }
+    if (!valid) return 0;
 
-    // record reception time as the time we read it.
-    mm.sysTimestampMsg = mstime();
-
-    if (l == (MODEAC_MSG_BYTES * 2)) {  // ModeA or ModeC
-        Modes.stats_current.remote_received_modeac++;
-        decodeModeAMessage(&mm, ((msg[0] << 8) | msg[1]));
-    } else {       // Assume ModeS
-        int result;
+    if (l == (MODEAC_MSG_BYTES * 2))  // ModeA or ModeC
+        frame->type = '1';
+    else if (l == (MODES_SHORT_MSG_BYTES * 2))
+        frame->type = '2';
+    else
+        frame->type = '3';
+    frame->signal = signal;
+    frame->timestamp = 0;
 
-        Modes.stats_current.remote_received_modes++;
-        result = decodeModesMessage(&mm, msg);
-        if (result < 0) {
-            if (result == -1)
-                Modes.stats_current.remote_rejected_unknown_icao++;
-            else
-                Modes.stats_current.remote_rejected_bad++;
-            return 0;
-        } else {
-            Modes.stats_current.remote_accepted[mm.correctedbits]++;
-        }
-    }
+    // record reception time as the time we read it.
+    frame->sysTimestamp = mstime();
 
-    useModesMessage(&mm);
+    netFrameCommit(frame);
     return (0);
 }
 
@@ -1567,15 +4371,16 @@ static const char *nav_altitude_source_enum_string(nav_altitude_source_t src)
     }
 }
 
-char *generateAircraftJson(const char *url_path, int *len) {
+// Generate aircraft.json for 'count' aircraft from 'list', or for every
+// tracked aircraft, walking Modes.aircrafts directly, if 'list' is NULL
+static char *aircraftListJson(struct aircraft **list, unsigned count, int *len) {
     uint64_t now = mstime();
     struct aircraft *a;
     int buflen = 32768; // The initial buffer is resized as needed
     char *buf = (char *) malloc(buflen), *p = buf, *end = buf+buflen;
     char *line_start;
     int first = 1;
-
-    MODES_NOTUSED(url_path);
+    unsigned i;
 
     _messageNow = now;
 
@@ -1586,7 +4391,8 @@ char *generateAircraftJson(const char *url_path, int *len) {
                        now / 1000.0,
                        Modes.stats_current.messages_total + Modes.stats_alltime.messages_total);
 
-    for (a = Modes.aircrafts; a; a = a->next) {
+    a = list ? (count ? list[0] : NULL) : Modes.aircrafts;
+    for (i = 0; a; a = list ? (++i < count ? list[i] : NULL) : a->next) {
         if (!a->reliable) {
             continue;
         }
@@ -1653,7 +4459,7 @@ char *generateAircraftJson(const char *url_path, int *len) {
             p = safe_snprintf(p, end, "]");
         }
         if (trackDataValid(&a->position_valid))
-            p = safe_snprintf(p, end, ",\"lat\":%f,\"lon\":%f,\"nic\":%u,\"rc\":%u,\"seen_pos\":%.1f", a->lat, a->lon, a->pos_nic, a->pos_rc, (now - a->position_valid.updated)/1000.0);
+            p = safe_snprintf(p, end, ",\"lat\":%f,\"lon\":%f,\"nic\":%u,\"rc\":%u,\"seen_pos\":%.1f", a->lat, a->lon, a->pos_nic, a->pos_rc, (now - trackAbsoluteTime(a->position_valid.updated))/1000.0);
         if (a->adsb_version >= 0)
             p = safe_snprintf(p, end, ",\"version\":%d", a->adsb_version);
         if (trackDataValid(&a->nic_baro_valid))
@@ -1702,6 +4508,43 @@ char *generateAircraftJson(const char *url_path, int *len) {
     return buf;
 }
 
+char *generateAircraftJson(const char *url_path, int *len) {
+    MODES_NOTUSED(url_path);
+
+    return aircraftListJson(NULL, 0, len);
+}
+
+// aircraft.json, restricted to the aircraft inside the --write-json-region
+// box. These are found through the tracker's spatial index, so this doesn't
+// walk every tracked aircraft.
+char *generateRegionJson(const char *url_path, int *len) {
+    struct aircraft **list = NULL;
+    unsigned size = 256, count;
+    char *buf;
+
+    MODES_NOTUSED(url_path);
+
+    _messageNow = mstime();
+
+    for (;;) {
+        if (!(list = realloc(list, size * sizeof(*list)))) {
+            fprintf(stderr, "Out of memory generating aircraft_region.json\n");
+            exit(1);
+        }
+
+        count = trackAircraftInBox(Modes.json_region_south, Modes.json_region_west,
+                                   Modes.json_region_north, Modes.json_region_east,
+                                   list, size);
+        if (count < size)
+            break;
+        size *= 2;
+    }
+
+    buf = aircraftListJson(list, count, len);
+    free(list);
+    return buf;
+}
+
 static char * appendStatsJson(char *p,
                               char *end,
                               struct stats *st,
@@ -1763,7 +4606,57 @@ static char * appendStatsJson(char *p,
             else p = safe_snprintf(p, end, ",%u", st->remote_accepted[i]);
         }
 
-        p = safe_snprintf(p, end, "]}");
+        p = safe_snprintf(p, end, "]");
+
+        if (Modes.net_compress_ports) {
+            p = safe_snprintf(p, end,
+                               ",\"decompression\":{\"in\":%" PRIu64
+                               ",\"out\":%" PRIu64
+                               ",\"cpu\":%.1f}",
+                               st->net_decompress_in,
+                               st->net_decompress_out,
+                               st->net_decompress_cpu.tv_sec * 1000.0 + st->net_decompress_cpu.tv_nsec / 1.0e6);
+        }
+
+        if (Modes.net_udp_beast_in || Modes.net_udp_raw_in) {
+            p = safe_snprintf(p, end,
+                               ",\"udp\":{\"received\":%u"
+                               ",\"lost\":%u}",
+                               st->net_udp_received,
+                               st->net_udp_lost);
+        }
+
+        p = safe_snprintf(p, end, "}");
+
+        p = safe_snprintf(p, end,
+                           ",\"net_output\":{\"dropped\":%" PRIu64
+                           ",\"disconnects\":%u",
+                           st->net_output_dropped,
+                           st->net_output_disconnects);
+
+        if (Modes.net_compress_ports) {
+            p = safe_snprintf(p, end,
+                               ",\"compression\":{\"in\":%" PRIu64
+                               ",\"out\":%" PRIu64
+                               ",\"flushes\":%u"
+                               ",\"cpu\":%.1f"
+                               ",\"latency\":%.3f}",
+                               st->net_compress_in,
+                               st->net_compress_out,
+                               st->net_compress_flushes,
+                               st->net_compress_cpu.tv_sec * 1000.0 + st->net_compress_cpu.tv_nsec / 1.0e6,
+                               st->net_compress_flushes ? st->net_compress_latency_ns / 1.0e6 / st->net_compress_flushes : 0.0);
+        }
+
+        if (Modes.net_udp_beast_out || Modes.net_udp_raw_out) {
+            p = safe_snprintf(p, end,
+                               ",\"udp\":{\"sent\":%u"
+                               ",\"errors\":%u}",
+                               st->net_udp_sent,
+                               st->net_udp_send_errors);
+        }
+
+        p = safe_snprintf(p, end, "}");
     }
 
     {
@@ -1791,7 +4684,7 @@ static char * appendStatsJson(char *p,
                            ",\"tracks\":{\"all\":%u"
                            ",\"single_message\":%u"
                            ",\"unreliable\":%u}"
-                           ",\"messages\":%u}",
+                           ",\"messages\":%u",
                            st->cpr_surface,
                            st->cpr_airborne,
                            st->cpr_global_ok,
@@ -1816,12 +4709,28 @@ static char * appendStatsJson(char *p,
                            st->messages_total);
     }
 
+    // Extended squitter types, omitting types that were not seen
+    {
+        int first = 1;
+
+        p = safe_snprintf(p, end, ",\"es_types\":{");
+        for (i = 0; i < 32; ++i) {
+            if (!st->es_type[i])
+                continue;
+            p = safe_snprintf(p, end, "%s\"%d\":%u", first ? "" : ",", i, st->es_type[i]);
+            first = 0;
+        }
+        p = safe_snprintf(p, end, "}");
+    }
+
+    p = safe_snprintf(p, end, "}");
+
     return p;
 }
 
 char *generateStatsJson(const char *url_path, int *len) {
     struct stats add;
-    char *buf = (char *) malloc(4096), *p = buf, *end = buf + 4096;
+    char *buf = (char *) malloc(8192), *p = buf, *end = buf + 8192;
 
     MODES_NOTUSED(url_path);
 
@@ -1960,32 +4869,219 @@ void writeJsonToFile(const char *file, char * (*generator) (const char *,int*))
 //
 //=========================================================================
 //
-// This function polls the clients using read() in order to receive new
-// messages from the net.
+// Make room at the end of a client's read buffer, and return how much
+// there is. Unprocessed data is only moved down to the start of the buffer
+// once the free space is getting short, so with a big buffer the leftover
+// partial message is rarely copied.
+//
+static int clientBufferRoom(struct client *c) {
+    int left = c->bufsize - c->buflen;
+
+    if (left < c->bufsize / 4 && c->bufstart > 0) {
+        memmove(c->buf, c->buf + c->bufstart, c->buflen - c->bufstart);
+        c->buflen -= c->bufstart;
+        c->bufstart = 0;
+        left = c->bufsize - c->buflen;
+    }
+
+    // If our buffer is full discard it, this is some badly formatted shit
+    if (left <= 0) {
+        c->bufstart = c->buflen = 0;
+        left = c->bufsize;
+    }
+
+    return left;
+}
+
+// Length of the rest of a Beast frame (after the type byte, before
+// escaping), or 0 if the type isn't valid in this read mode
+static inline int beastFrameLength(read_mode_t mode, char type) {
+    if (mode == READ_MODE_BEAST_COMMAND)
+        return (type == '1' || type == 'F' ? 1 : 0);
+
+    switch (type) {
+    case '1':
+        return MODEAC_MSG_BYTES + 7;        // timestamp, signal level, message
+    case '2':
+        return MODES_SHORT_MSG_BYTES + 7;
+    case '3':
+    case '4':
+    case '5':
+        return MODES_LONG_MSG_BYTES + 7;
+    default:
+        return 0;
+    }
+}
+
+#define BEAST_MAX_FRAME (1 + MODES_LONG_MSG_BYTES + 7)
+
 //
-// The message is supposed to be separated from the next message by the
-// separator 'sep', which is a null-terminated C string.
+// Find the Beast frames in som..eod and pass each complete one, from its
+// type byte and with escaped 0x1a bytes undone, to the service's handler.
 //
-// Every full message received is decoded and passed to the higher layers
-// calling the function's 'handler'.
+// Most frames contain no 0x1a at all, so each one is checked with a single
+// memchr() (which libc vectorizes) and then handled in place; only the
+// rest are copied out to be unescaped.
+//
+// Returns where the unprocessed data starts, or NULL if the client was
+// closed.
+//
+static char *clientScanBeast(struct client *c, char *som, char *eod) {
+    read_mode_t mode = c->service->read_mode;
+    char unescaped[BEAST_MAX_FRAME];
+
+    while (som < eod) {
+        char *p, *body, *frame, *eom;
+        int len, j;
+
+        if (!(p = memchr(som, 0x1a, eod - som)))
+            return eod; // no frame start, all garbage
+
+        som = p; // consume garbage up to the 0x1a
+        if (som + 1 >= eod)
+            break; // Incomplete message in buffer, retry later
+
+        if (!(len = beastFrameLength(mode, som[1]))) {
+            // Not a valid beast message, skip 0x1a and try again
+            ++som;
+            continue;
+        }
+
+        body = som + 2;
+        if (eod - body < len)
+            break; // Incomplete message in buffer, retry later
+
+        if (!memchr(body, 0x1a, len)) {
+            frame = som + 1;
+            eom = body + len;
+        } else {
+            // we need to be careful of double escape characters in the message body
+            unescaped[0] = som[1];
+            for (p = body, j = 1; j <= len && p < eod; ++j) {
+                unescaped[j] = *p;
+                if (*p++ == 0x1a)
+                    ++p;
+            }
+
+            if (j <= len || p > eod)
+                break; // Incomplete message in buffer, retry later
+
+            frame = unescaped;
+            eom = p;
+        }
+
+        // Have a complete frame - pass it to handler.
+        if (c->service->read_handler(c, frame)) {
+            modesCloseClient(c);
+            return NULL;
+        }
+
+        // advance to next message
+        som = eom;
+    }
+
+    return som;
+}
+
+//
+//=========================================================================
+//
+// Pass every complete message in a client's buffer to the service's
+// handler, and keep whatever is left over for next time.
+//
+// In ASCII mode messages are separated by the service's separator 'sep',
+// which is a null-terminated C string; otherwise they are Beast frames.
 //
 // The handler returns 0 on success, or 1 to signal this function we should
 // close the connection with the client in case of non-recoverable errors.
 //
+// Returns 1 if anything was consumed, 0 if not, or -1 if the client was
+// closed.
+//
+static int clientProcessInput(struct client *c) {
+    char *start = c->buf + c->bufstart;
+    char *som = start;                // first byte of next message
+    char *eod = c->buf + c->buflen;   // one byte past end of data
+    char *p;
+
+    switch (c->service->read_mode) {
+    case READ_MODE_IGNORE:
+        // drop the bytes on the floor
+        som = eod;
+        break;
+
+    case READ_MODE_BEAST:
+    case READ_MODE_BEAST_COMMAND:
+        if (!(som = clientScanBeast(c, som, eod)))
+            return -1;
+        break;
+
+    case READ_MODE_ASCII: {
+        //
+        // This is the ASCII scanning case, AVR RAW at present
+        // If there is a complete message still in the buffer, there must be the separator 'sep'
+        // in the buffer. Each search starts where the last message ended, so every
+        // byte is looked at once however many messages a read brought in.
+        const char *sep = c->service->read_sep;
+        size_t seplen = strlen(sep);
+
+        // NUL-terminate so that longer separators can be found with strstr();
+        // a single character separator is found with memchr() instead
+        // nb: the buffer has one byte more than we ever read into, so this is safe
+        *eod = '\0';
+
+        while (som < eod && (p = (seplen == 1 ? memchr(som, sep[0], eod - som) : strstr(som, sep))) != NULL) { // end of first message if found
+            *p = '\0';                         // The handler expects null terminated strings
+            if (c->service->read_handler(c, som)) {         // Pass message to handler.
+                modesCloseClient(c);           // Handler returns 1 on error to signal we .
+                return -1;                     // should close the client connection
+            }
+            som = p + seplen;                  // Move to start of next message
+        }
+
+        break;
+    }
+    }
+
+    if (som == eod) {
+        c->bufstart = c->buflen = 0;           // all used up, start again at the beginning
+    } else {
+        c->bufstart = som - c->buf;            // keep the rest, see clientBufferRoom()
+    }
+
+    return (som > start);
+}
+
+//
+//=========================================================================
+//
+// This function polls the clients using read() in order to receive new
+// messages from the net.
+//
+// Every full message received is decoded and passed to the higher layers
+// calling the function's 'handler', see clientProcessInput().
+//
 static void modesReadFromClient(struct client *c) {
     int left;
     int nread;
     int bContinue = 1;
 
-    while (bContinue) {
-        left = MODES_CLIENT_BUF_SIZE - c->buflen - 1; // leave 1 extra byte for NUL termination in the ASCII case
+    if (c->udp) {
+        clientReadDatagrams(c);
+        return;
+    }
 
-        // If our buffer is full discard it, this is some badly formatted shit
-        if (left <= 0) {
-            c->buflen = 0;
-            left = MODES_CLIENT_BUF_SIZE;
-            // If there is garbage, read more to discard it ASAP
-        }
+#ifdef ENABLE_ZLIB
+    // commands from a compressed output client are not compressed, and
+    // must not be read into the compressor's buffer
+    if (c->zstream && !c->zstream->output) {
+        clientReadCompressed(c);
+        return;
+    }
+#endif
+
+    while (bContinue) {
+        left = clientBufferRoom(c);
 #ifndef _WIN32
         nread = read(c->fd, c->buf+c->buflen, left);
 #else
@@ -2019,141 +5115,9 @@ static void modesReadFromClient(struct client *c) {
 
         c->buflen += nread;
 
-        char *som = c->buf;           // first byte of next message
-        char *eod = som + c->buflen;  // one byte past end of data
-        char *p;
-
-        switch (c->service->read_mode) {
-        case READ_MODE_IGNORE:
-            // drop the bytes on the floor
-            som = eod;
-            break;
-
-        case READ_MODE_BEAST:
-            // This is the Beast Binary scanning case.
-            // If there is a complete message still in the buffer, there must be the separator 'sep'
-            // in the buffer, note that we full-scan the buffer at every read for simplicity.
-
-            while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
-                som = p; // consume garbage up to the 0x1a
-                ++p; // skip 0x1a
-
-                if (p >= eod) {
-                    // Incomplete message in buffer, retry later
-                    break;
-                }
-
-                char *eom; // one byte past end of message
-                if        (*p == '1') {
-                    eom = p + MODEAC_MSG_BYTES      + 8;         // point past remainder of message
-                } else if (*p == '2') {
-                    eom = p + MODES_SHORT_MSG_BYTES + 8;
-                } else if (*p == '3') {
-                    eom = p + MODES_LONG_MSG_BYTES  + 8;
-                } else if (*p == '4') {
-                    eom = p + MODES_LONG_MSG_BYTES  + 8;
-                } else if (*p == '5') {
-                    eom = p + MODES_LONG_MSG_BYTES  + 8;
-                } else {
-                    // Not a valid beast message, skip 0x1a and try again
-                    ++som;
-                    continue;
-                }
-
-                // we need to be careful of double escape characters in the message body
-                for (p = som + 1; p < eod && p < eom; p++) {
-                    if (0x1A == *p) {
-                        p++;
-                        eom++;
-                    }
-                }
-
-                if (eom > eod) { // Incomplete message in buffer, retry later
-                    break;
-                }
-
-                // Have a 0x1a followed by 1/2/3/4/5 - pass message to handler.
-                if (c->service->read_handler(c, som + 1)) {
-                    modesCloseClient(c);
-                    return;
-                }
-
-                // advance to next message
-                som = eom;
-            }
-            break;
-
-        case READ_MODE_BEAST_COMMAND:
-            while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
-                char *eom; // one byte past end of message
-
-                som = p; // consume garbage up to the 0x1a
-                ++p; // skip 0x1a
-
-                if (p >= eod) {
-                    // Incomplete message in buffer, retry later
-                    break;
-                }
-
-                if (*p == '1') {
-                    eom = p + 2;
-                } else {
-                    // Not a valid beast command, skip 0x1a and try again
-                    ++som;
-                    continue;
-                }
-
-                // we need to be careful of double escape characters in the message body
-                for (p = som + 1; p < eod && p < eom; p++) {
-                    if (0x1A == *p) {
-                        p++;
-                        eom++;
-                    }
-                }
-
-                if (eom > eod) { // Incomplete message in buffer, retry later
-                    break;
-                }
-
-                // Have a 0x1a followed by 1 - pass message to handler.
-                if (c->service->read_handler(c, som + 1)) {
-                    modesCloseClient(c);
-                    return;
-                }
-
-                // advance to next message
-                som = eom;
-            }
-            break;
-
-        case READ_MODE_ASCII:
-            //
-            // This is the ASCII scanning case, AVR RAW or HTTP at present
-            // If there is a complete message still in the buffer, there must be the separator 'sep'
-            // in the buffer, note that we full-scan the buffer at every read for simplicity.
-
-            // Always NUL-terminate so we are free to use strstr()
-            // nb: we never fill the last byte of the buffer with read data (see above) so this is safe
-            *eod = '\0';
-
-            while (som < eod && (p = strstr(som, c->service->read_sep)) != NULL) { // end of first message if found
-                *p = '\0';                         // The handler expects null terminated strings
-                if (c->service->read_handler(c, som)) {         // Pass message to handler.
-                    modesCloseClient(c);           // Handler returns 1 on error to signal we .
-                    return;                        // should close the client connection
-                }
-                som = p + strlen(c->service->read_sep);               // Move to start of next message
-            }
-
-            break;
-        }
-
-        if (som > c->buf) {                        // We processed something - so
-            c->buflen = eod - som;                 //     Update the unprocessed buffer length
-            memmove(c->buf, som, c->buflen);       //     Move what's remaining to the start of the buffer
-        } else {                                   // If no message was decoded process the next client
+        // If no message was decoded process the next client
+        if (clientProcessInput(c) <= 0)
             return;
-        }
     }
 }
 
@@ -2242,7 +5206,7 @@ static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a)
         return; // not enabled or no active connections
     }
 
-    if (!a || mm->source == SOURCE_MLAT || (!a->reliable && !mm->reliable))
+    if (!a || !a->fatsv || mm->source == SOURCE_MLAT || (!a->reliable && !mm->reliable))
         return;
 
     switch (mm->msgtype) {
@@ -2252,16 +5216,16 @@ static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a)
         switch (mm->commb_format) {
         case COMMB_DATALINK_CAPS:
             // BDS 1,0: data link capability report
-            if (memcmp(mm->MB, a->fatsv_emitted_bds_10, 7) != 0) {
-                memcpy(a->fatsv_emitted_bds_10, mm->MB, 7);
+            if (memcmp(mm->MB, a->fatsv->emitted_bds_10, 7) != 0) {
+                memcpy(a->fatsv->emitted_bds_10, mm->MB, 7);
                 writeFATSVEventMessage(mm, "datalink_caps", mm->MB, 7);
             }
             break;
 
         case COMMB_ACAS_RA:
             // BDS 3,0: ACAS RA report
-            if (memcmp(mm->MB, a->fatsv_emitted_bds_30, 7) != 0) {
-                memcpy(a->fatsv_emitted_bds_30, mm->MB, 7);
+            if (memcmp(mm->MB, a->fatsv->emitted_bds_30, 7) != 0) {
+                memcpy(a->fatsv->emitted_bds_30, mm->MB, 7);
                 writeFATSVEventMessage(mm, "commb_acas_ra", mm->MB, 7);
             }
             break;
@@ -2275,14 +5239,14 @@ static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a)
     case 17:
     case 18:
         // DF 17/18: extended squitter
-        if (mm->metype == 28 && mm->mesub == 2 && memcmp(mm->ME, &a->fatsv_emitted_es_acas_ra, 7) != 0) {
+        if (mm->metype == 28 && mm->mesub == 2 && memcmp(mm->ME, &a->fatsv->emitted_es_acas_ra, 7) != 0) {
             // type 28 subtype 2: ACAS RA report
             // first byte has the type/subtype, remaining bytes match the BDS 3,0 format
-            memcpy(a->fatsv_emitted_es_acas_ra, mm->ME, 7);
+            memcpy(a->fatsv->emitted_es_acas_ra, mm->ME, 7);
             writeFATSVEventMessage(mm, "es_acas_ra", mm->ME, 7);
-        } else if (mm->metype == 31 && (mm->mesub == 0 || mm->mesub == 1) && memcmp(mm->ME, a->fatsv_emitted_es_status, 7) != 0) {
+        } else if (mm->metype == 31 && (mm->mesub == 0 || mm->mesub == 1) && memcmp(mm->ME, a->fatsv->emitted_es_status, 7) != 0) {
             // aircraft operational status
-            memcpy(a->fatsv_emitted_es_status, mm->ME, 7);
+            memcpy(a->fatsv->emitted_es_status, mm->ME, 7);
             writeFATSVEventMessage(mm, "es_op_status", mm->ME, 7);
         }
         break;
@@ -2329,17 +5293,18 @@ static inline float heading_difference(float h1, float h2)
         return p;
     }
 
-    if (source->updated > messageNow()) {
+    uint64_t updated = trackAbsoluteTime(source->updated);
+    if (updated > messageNow()) {
         // data in the future
         return p;
     }
 
-    if (source->updated < a->fatsv_last_emitted) {
+    if (updated < a->fatsv->last_emitted) {
         // not updated since last time
         return p;
     }
 
-    uint64_t age = (messageNow() - source->updated) / 1000;
+    uint64_t age = (messageNow() - updated) / 1000;
     if (age > 255) {
         // too old
         return p;
@@ -2386,11 +5351,11 @@ static void writeFATSV()
     next_update = now + 1000;
 
     for (a = Modes.aircrafts; a; a = a->next) {
-        if (!a->reliable)
+        if (!a->reliable || !a->fatsv)
             continue;
 
         // don't emit if it hasn't updated since last time
-        if (a->seen < a->fatsv_last_emitted) {
+        if (a->seen < a->fatsv->last_emitted) {
             continue;
         }
 
@@ -2415,32 +5380,32 @@ static void writeFATSV()
         // if it hasn't changed altitude, heading, or speed much,
         // don't update so often
         int changed =
-            (altValid && abs(a->altitude_baro - a->fatsv_emitted_altitude_baro) >= 50) ||
-            (trackDataValid(&a->altitude_geom_valid) && abs(a->altitude_geom - a->fatsv_emitted_altitude_geom) >= 50) ||
-            (trackDataValid(&a->baro_rate_valid) && abs(a->baro_rate - a->fatsv_emitted_baro_rate) > 500) ||
-            (trackDataValid(&a->geom_rate_valid) && abs(a->geom_rate - a->fatsv_emitted_geom_rate) > 500) ||
-            (trackDataValid(&a->track_valid) && heading_difference(a->track, a->fatsv_emitted_track) >= 2) ||
-            (trackDataValid(&a->track_rate_valid) && fabs(a->track_rate - a->fatsv_emitted_track_rate) >= 0.5) ||
-            (trackDataValid(&a->roll_valid) && fabs(a->roll - a->fatsv_emitted_roll) >= 5.0) ||
-            (trackDataValid(&a->mag_heading_valid) && heading_difference(a->mag_heading, a->fatsv_emitted_mag_heading) >= 2) ||
-            (trackDataValid(&a->true_heading_valid) && heading_difference(a->true_heading, a->fatsv_emitted_true_heading) >= 2) ||
-            (gsValid && fabs(a->gs - a->fatsv_emitted_gs) >= 25) ||
-            (trackDataValid(&a->ias_valid) && unsigned_difference(a->ias, a->fatsv_emitted_ias) >= 25) ||
-            (trackDataValid(&a->tas_valid) && unsigned_difference(a->tas, a->fatsv_emitted_tas) >= 25) ||
-            (trackDataValid(&a->mach_valid) && fabs(a->mach - a->fatsv_emitted_mach) >= 0.02);
+            (altValid && abs(a->altitude_baro - a->fatsv->emitted_altitude_baro) >= 50) ||
+            (trackDataValid(&a->altitude_geom_valid) && abs(a->altitude_geom - a->fatsv->emitted_altitude_geom) >= 50) ||
+            (trackDataValid(&a->baro_rate_valid) && abs(a->baro_rate - a->fatsv->emitted_baro_rate) > 500) ||
+            (trackDataValid(&a->geom_rate_valid) && abs(a->geom_rate - a->fatsv->emitted_geom_rate) > 500) ||
+            (trackDataValid(&a->track_valid) && heading_difference(a->track, a->fatsv->emitted_track) >= 2) ||
+            (trackDataValid(&a->track_rate_valid) && fabs(a->track_rate - a->fatsv->emitted_track_rate) >= 0.5) ||
+            (trackDataValid(&a->roll_valid) && fabs(a->roll - a->fatsv->emitted_roll) >= 5.0) ||
+            (trackDataValid(&a->mag_heading_valid) && heading_difference(a->mag_heading, a->fatsv->emitted_mag_heading) >= 2) ||
+            (trackDataValid(&a->true_heading_valid) && heading_difference(a->true_heading, a->fatsv->emitted_true_heading) >= 2) ||
+            (gsValid && fabs(a->gs - a->fatsv->emitted_gs) >= 25) ||
+            (trackDataValid(&a->ias_valid) && unsigned_difference(a->ias, a->fatsv->emitted_ias) >= 25) ||
+            (trackDataValid(&a->tas_valid) && unsigned_difference(a->tas, a->fatsv->emitted_tas) >= 25) ||
+            (trackDataValid(&a->mach_valid) && fabs(a->mach - a->fatsv->emitted_mach) >= 0.02);
 
         int immediate =
-            (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->nav_altitude_mcp, a->fatsv_emitted_nav_altitude_mcp) > 50) ||
-            (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->nav_altitude_fms, a->fatsv_emitted_nav_altitude_fms) > 50) ||
-            (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv_emitted_nav_altitude_src) ||
-            (trackDataValid(&a->nav_heading_valid) && heading_difference(a->nav_heading, a->fatsv_emitted_nav_heading) > 2) ||
-            (trackDataValid(&a->nav_modes_valid) && a->nav_modes != a->fatsv_emitted_nav_modes) ||
-            (trackDataValid(&a->nav_qnh_valid) && fabs(a->nav_qnh - a->fatsv_emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
-            (callsignValid && strcmp(a->callsign, a->fatsv_emitted_callsign) != 0) ||
-            (airgroundValid && a->airground == AG_AIRBORNE && a->fatsv_emitted_airground == AG_GROUND) ||
-            (airgroundValid && a->airground == AG_GROUND && a->fatsv_emitted_airground == AG_AIRBORNE) ||
-            (squawkValid && a->squawk != a->fatsv_emitted_squawk) ||
-            (trackDataValid(&a->emergency_valid) && a->emergency != a->fatsv_emitted_emergency);
+            (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->nav_altitude_mcp, a->fatsv->emitted_nav_altitude_mcp) > 50) ||
+            (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->nav_altitude_fms, a->fatsv->emitted_nav_altitude_fms) > 50) ||
+            (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv->emitted_nav_altitude_src) ||
+            (trackDataValid(&a->nav_heading_valid) && heading_difference(a->nav_heading, a->fatsv->emitted_nav_heading) > 2) ||
+            (trackDataValid(&a->nav_modes_valid) && a->nav_modes != a->fatsv->emitted_nav_modes) ||
+            (trackDataValid(&a->nav_qnh_valid) && fabs(a->nav_qnh - a->fatsv->emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
+            (callsignValid && strcmp(a->callsign, a->fatsv->emitted_callsign) != 0) ||
+            (airgroundValid && a->airground == AG_AIRBORNE && a->fatsv->emitted_airground == AG_GROUND) ||
+            (airgroundValid && a->airground == AG_GROUND && a->fatsv->emitted_airground == AG_AIRBORNE) ||
+            (squawkValid && a->squawk != a->fatsv->emitted_squawk) ||
+            (trackDataValid(&a->emergency_valid) && a->emergency != a->fatsv->emitted_emergency);
 
         uint64_t minAge;
         if (immediate) {
@@ -2462,7 +5427,7 @@ static void writeFATSV()
             minAge = (changed ? 10000 : 30000);
         }
 
-        if ((now - a->fatsv_last_emitted) < minAge)
+        if ((now - a->fatsv->last_emitted) < minAge)
             continue;
 
         char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
@@ -2476,31 +5441,31 @@ static void writeFATSV()
 
         // for fields we only emit on change,
         // occasionally re-emit them all
-        int forceEmit = (now - a->fatsv_last_force_emit) > 600000;
+        int forceEmit = (now - a->fatsv->last_force_emit) > 600000;
 
         // these don't change often / at all, only emit when they change
-        if (forceEmit || a->addrtype != a->fatsv_emitted_addrtype) {
+        if (forceEmit || a->addrtype != a->fatsv->emitted_addrtype) {
             p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(a->addrtype));
         }
-        if (forceEmit || a->adsb_version != a->fatsv_emitted_adsb_version) {
+        if (forceEmit || a->adsb_version != a->fatsv->emitted_adsb_version) {
             p = appendFATSV(p, end, "adsb_version", "%d", a->adsb_version);
         }
-        if (forceEmit || a->category != a->fatsv_emitted_category) {
+        if (forceEmit || a->category != a->fatsv->emitted_category) {
             p = appendFATSV(p, end, "category", "%02X", a->category);
         }
-        if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->nac_p != a->fatsv_emitted_nac_p)) {
+        if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->nac_p != a->fatsv->emitted_nac_p)) {
             p = appendFATSVMeta(p, end, "nac_p",       a, &a->nac_p_valid,         "%u",       a->nac_p);
         }
-        if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->nac_v != a->fatsv_emitted_nac_v)) {
+        if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->nac_v != a->fatsv->emitted_nac_v)) {
             p = appendFATSVMeta(p, end, "nac_v",       a, &a->nac_v_valid,         "%u",       a->nac_v);
         }
-        if (trackDataValid(&a->sil_valid) && (forceEmit || a->sil != a->fatsv_emitted_sil)) {
+        if (trackDataValid(&a->sil_valid) && (forceEmit || a->sil != a->fatsv->emitted_sil)) {
             p = appendFATSVMeta(p, end, "sil",         a, &a->sil_valid,           "%u",       a->sil);
         }
-        if (trackDataValid(&a->sil_valid) && (forceEmit || a->sil_type != a->fatsv_emitted_sil_type)) {
+        if (trackDataValid(&a->sil_valid) && (forceEmit || a->sil_type != a->fatsv->emitted_sil_type)) {
             p = appendFATSVMeta(p, end, "sil_type",    a, &a->sil_valid,           "%s",       sil_type_enum_string(a->sil_type));
         }
-        if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->nic_baro != a->fatsv_emitted_nic_baro)) {
+        if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->nic_baro != a->fatsv->emitted_nic_baro)) {
             p = appendFATSVMeta(p, end, "nic_baro",    a, &a->nic_baro_valid,      "%u",       a->nic_baro);
         }
 
@@ -2556,40 +5521,92 @@ static void writeFATSV()
         else
             fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
 
-        a->fatsv_emitted_altitude_baro = a->altitude_baro;
-        a->fatsv_emitted_altitude_geom = a->altitude_geom;
-        a->fatsv_emitted_baro_rate = a->baro_rate;
-        a->fatsv_emitted_geom_rate = a->geom_rate;
-        a->fatsv_emitted_gs = a->gs;
-        a->fatsv_emitted_ias = a->ias;
-        a->fatsv_emitted_tas = a->tas;
-        a->fatsv_emitted_mach = a->mach;
-        a->fatsv_emitted_track = a->track;
-        a->fatsv_emitted_track_rate = a->track_rate;
-        a->fatsv_emitted_roll = a->roll;
-        a->fatsv_emitted_mag_heading = a->mag_heading;
-        a->fatsv_emitted_true_heading = a->true_heading;
-        a->fatsv_emitted_airground = a->airground;
-        a->fatsv_emitted_nav_altitude_mcp = a->nav_altitude_mcp;
-        a->fatsv_emitted_nav_altitude_fms = a->nav_altitude_fms;
-        a->fatsv_emitted_nav_altitude_src = a->nav_altitude_src;
-        a->fatsv_emitted_nav_heading = a->nav_heading;
-        a->fatsv_emitted_nav_modes = a->nav_modes;
-        a->fatsv_emitted_nav_qnh = a->nav_qnh;
-        memcpy(a->fatsv_emitted_callsign, a->callsign, sizeof(a->fatsv_emitted_callsign));
-        a->fatsv_emitted_addrtype = a->addrtype;
-        a->fatsv_emitted_adsb_version = a->adsb_version;
-        a->fatsv_emitted_category = a->category;
-        a->fatsv_emitted_squawk = a->squawk;
-        a->fatsv_emitted_nac_p = a->nac_p;
-        a->fatsv_emitted_nac_v = a->nac_v;
-        a->fatsv_emitted_sil = a->sil;
-        a->fatsv_emitted_sil_type = a->sil_type;
-        a->fatsv_emitted_nic_baro = a->nic_baro;
-        a->fatsv_emitted_emergency = a->emergency;
-        a->fatsv_last_emitted = now;
+        a->fatsv->emitted_altitude_baro = a->altitude_baro;
+        a->fatsv->emitted_altitude_geom = a->altitude_geom;
+        a->fatsv->emitted_baro_rate = a->baro_rate;
+        a->fatsv->emitted_geom_rate = a->geom_rate;
+        a->fatsv->emitted_gs = a->gs;
+        a->fatsv->emitted_ias = a->ias;
+        a->fatsv->emitted_tas = a->tas;
+        a->fatsv->emitted_mach = a->mach;
+        a->fatsv->emitted_track = a->track;
+        a->fatsv->emitted_track_rate = a->track_rate;
+        a->fatsv->emitted_roll = a->roll;
+        a->fatsv->emitted_mag_heading = a->mag_heading;
+        a->fatsv->emitted_true_heading = a->true_heading;
+        a->fatsv->emitted_airground = a->airground;
+        a->fatsv->emitted_nav_altitude_mcp = a->nav_altitude_mcp;
+        a->fatsv->emitted_nav_altitude_fms = a->nav_altitude_fms;
+        a->fatsv->emitted_nav_altitude_src = a->nav_altitude_src;
+        a->fatsv->emitted_nav_heading = a->nav_heading;
+        a->fatsv->emitted_nav_modes = a->nav_modes;
+        a->fatsv->emitted_nav_qnh = a->nav_qnh;
+        memcpy(a->fatsv->emitted_callsign, a->callsign, sizeof(a->fatsv->emitted_callsign));
+        a->fatsv->emitted_addrtype = a->addrtype;
+        a->fatsv->emitted_adsb_version = a->adsb_version;
+        a->fatsv->emitted_category = a->category;
+        a->fatsv->emitted_squawk = a->squawk;
+        a->fatsv->emitted_nac_p = a->nac_p;
+        a->fatsv->emitted_nac_v = a->nac_v;
+        a->fatsv->emitted_sil = a->sil;
+        a->fatsv->emitted_sil_type = a->sil_type;
+        a->fatsv->emitted_nic_baro = a->nic_baro;
+        a->fatsv->emitted_emergency = a->emergency;
+        a->fatsv->last_emitted = now;
         if (forceEmit) {
-            a->fatsv_last_force_emit = now;
+            a->fatsv->last_force_emit = now;
+        }
+    }
+}
+
+//
+// Send everything published since the last call, one write per client;
+// clients whose socket is full wait until epoll says it has drained
+//
+static void netSendAll(void)
+{
+    struct client *c;
+
+#ifdef HAVE_IO_URING
+    if (net_uring) {
+        // Sends complete asynchronously, so start them all and collect what
+        // has completed before judging anyone's backlog
+        for (c = Modes.clients; c; c = c->next) {
+            if (c->service && c->out_seg)
+                uringSendPending(c);
+        }
+        uringPoll(0);
+    }
+#endif
+
+    for (c = Modes.clients; c; c = c->next) {
+        if (!c->service || !c->out_seg)
+            continue;
+        if (!c->blocked)
+            clientSendPending(c);
+        if (c->service && clientBacklog(c) > (uint64_t) Modes.net_output_backlog)
+            clientOverflow(c);
+    }
+}
+
+// Unlink and free closed clients
+static void netPruneClients(void)
+{
+    struct client *c, **prev;
+
+    for (prev = &Modes.clients, c = *prev; c; c = *prev) {
+        if (c->fd == -1 && !c->io_pending) {
+            // Recently closed, prune from list
+            *prev = c->next;
+#ifdef ENABLE_ZLIB
+            clientFreeCompression(c);
+#endif
+            free(c->io_send);
+            free(c->filter_spec);
+            free(c->buf);
+            free(c);
+        } else {
+            prev = &c->next;
         }
     }
 }
@@ -2598,20 +5615,20 @@ static void writeFATSV()
 // Perform periodic network work
 //
 void modesNetPeriodicWork(void) {
-    struct client *c, **prev;
     struct net_service *s;
     uint64_t now = mstime();
     int need_flush = 0;
 
-    // Accept new connections
-    modesAcceptClients();
+    filteredServicesFree();
 
-    // Read from clients
-    for (c = Modes.clients; c; c = c->next) {
-        if (!c->service)
-            continue;
-        if (c->service->read_handler)
-            modesReadFromClient(c);
+    if (net_thread_running) {
+        // Decode whatever the network thread has read
+        netFrameDecodeQueued();
+    } else {
+        // Accept new connections and read from clients that have data waiting;
+        // keep going while the event buffer keeps coming back full
+        while (netEventPoll(0))
+            ;
     }
 
     // Generate FATSV output
@@ -2640,16 +5657,29 @@ void modesNetPeriodicWork(void) {
         }
     }
 
-    // Unlink and free closed clients
-    for (prev = &Modes.clients, c = *prev; c; c = *prev) {
-        if (c->fd == -1) {
-            // Recently closed, prune from list
-            *prev = c->next;
-            free(c);
-        } else {
-            prev = &c->next;
+    if (net_thread_running) {
+        // the network thread sends it
+        if (net_output_pending) {
+            net_output_pending = 0;
+            netThreadWakeup();
         }
+    } else {
+        net_output_pending = 0;
+        netSendDatagrams();
+        netSendAll();
+        netPruneClients();
+        netUpdateBacklogs();
     }
+
+    Modes.stats_current.net_output_dropped += atomic_exchange(&net_output_dropped, 0);
+    Modes.stats_current.net_output_disconnects += atomic_exchange(&net_output_disconnects, 0);
+    Modes.stats_current.net_udp_received += atomic_exchange(&net_udp_received, 0);
+    Modes.stats_current.net_udp_lost += atomic_exchange(&net_udp_lost, 0);
+    Modes.stats_current.net_udp_sent += atomic_exchange(&net_udp_sent, 0);
+    Modes.stats_current.net_udp_send_errors += atomic_exchange(&net_udp_send_errors, 0);
+#ifdef ENABLE_ZLIB
+    netCompressStats(&Modes.stats_current);
+#endif
 }
 
 //
@@ -26,6 +26,11 @@ struct aircraft;
 struct modesMessage;
 struct client;
 struct net_service;
+struct net_segment;
+struct net_filter;
+struct net_uring_send;
+struct net_zstream;
+struct net_udp_output;
 typedef int (*read_fn)(struct client *, char *);
 typedef void (*heartbeat_fn)(struct net_service *);
 
@@ -36,20 +41,37 @@ typedef enum {
     READ_MODE_ASCII
 } read_mode_t;
 
+// What to do when a client falls further behind than --net-backlog allows
+typedef enum {
+    OVERFLOW_DROP_OLDEST = 0,   // discard the oldest pending output
+    OVERFLOW_DROP_NEWEST,       // discard the output that didn't fit
+    OVERFLOW_DISCONNECT         // close the connection
+} overflow_policy_t;
+
 // Describes one network service (a group of clients with common behaviour)
 struct net_service {
-    struct net_service* next;
+    _Atomic(struct net_service *) next;
     const char *descr;
     int listener_count;  // number of listeners
     int *listener_fds;   // listening FDs
 
-    int connections;     // number of active clients
+    atomic_int connections; // number of active clients (and UDP destinations)
+
+    // Output queued and dropped for this service's clients, refreshed by
+    // the thread that sends (see netUpdateBacklogs) and shown by --stats
+    atomic_ullong backlog;      // bytes queued for all clients
+    atomic_ullong backlog_max;  // ..and the most for any one client
+    atomic_ullong dropped;      // bytes dropped for clients since startup
+    atomic_int dropping;        // connected clients that have had output dropped
 
     struct net_writer *writer; // shared writer state
 
     const char *read_sep;      // hander details for input data
     read_mode_t read_mode;
     read_fn read_handler;
+
+    struct net_service *unfiltered; // for a filtered output service, the service it is a variant of
+    struct net_service *retired;    // next filtered service waiting to be freed (see net_io.c)
 };
 
 // Structure used to describe a networking client
@@ -57,18 +79,45 @@ struct client {
     struct client*  next;                // Pointer to next client
     int    fd;                           // File descriptor
     struct net_service *service;         // Service this client is part of
-    int    buflen;                       // Amount of data on buffer
-    char   buf[MODES_CLIENT_BUF_SIZE+1]; // Read buffer
+    char  *buf;                          // Read buffer (bufsize bytes, plus one for NUL termination)
+    int    bufsize;
+    int    bufstart;                     // unprocessed data is buf[bufstart] .. buf[buflen-1]
+    int    buflen;
     int    modeac_requested;             // 1 if this Beast output connection has asked for A/C
+    char  *filter_spec;                  // filter being received through Beast commands, see net_io.c
+    int    filter_len;
+
+    // Position in the service's shared output stream (see net_io.c)
+    struct net_segment *out_seg;         // next byte to send is out_seg->data[out_offset]
+    int    out_offset;
+    struct net_segment *stop_seg;        // if set, stop sending here..
+    int    stop_offset;
+    struct net_segment *resume_seg;      // ..and carry on from here (NULL: from the end of the stream)
+    int    resume_offset;
+    uint64_t skip_from;                  // stream position of the data being skipped when resume_seg is NULL
+    int    blocked;                      // socket is full, waiting for it to become writable
+    uint64_t dropped;                    // bytes discarded because the backlog was full
+    int    io_pending;                   // io_uring requests still referring to this client
+    int    io_sending;                   // an io_uring send is in flight
+    struct net_uring_send *io_send;      // its state, kept for reuse (see net_io.c)
+    struct net_zstream *zstream;         // --net-compress state, or NULL (see net_io.c)
+    int    udp;                          // a UDP input socket, which gets datagrams (see net_io.c)..
+    int    udp_synced;                   // ..and has seen one, so
+    uint32_t udp_seq;                    // ..this is the next sequence number expected
 };
 
 // Common writer state for all output sockets of one type
 struct net_writer {
     struct net_service *service; // owning service
-    void *data;          // shared write buffer, sized MODES_OUT_BUF_SIZE
-    int dataUsed;        // number of bytes of write buffer currently used
+    void *data;          // where output is written, at least MODES_OUT_BUF_SIZE free in the tail segment
+    int dataUsed;        // number of bytes written there but not yet published
+    struct net_segment *tail; // segment currently being filled
     uint64_t lastWrite;  // time of last write to clients
     heartbeat_fn send_heartbeat; // function that queues a heartbeat if needed
+    overflow_policy_t overflow;  // what to do with clients that fall behind
+    struct net_filter *filter;   // if set, only messages matching this are written
+    _Atomic(struct net_writer *) filtered; // next filtered variant of the same output
+    struct net_udp_output *udp;  // UDP destinations, if any
 };
 
 struct net_service *serviceInit(const char *descr, struct net_writer *writer, heartbeat_fn hb_handler, read_mode_t mode, const char *sep, read_fn read_handler);
@@ -83,12 +132,25 @@ struct net_service *makeFatsvOutputService(void);
 
 void sendBeastSettings(struct client *c, const char *settings);
 
+// Apply an output filter to the clients of one listening port; the
+// argument is "<port>:<filter>". Returns -1 (after reporting why) if it
+// isn't valid.
+int netAddPortFilter(const char *arg);
+int netSetJsonRegion(const char *arg);
+
+// Print the backlog and drops of each output service, for --stats
+void netDisplayBacklogs(void);
+
 void modesInitNet(void);
 void modesQueueOutput(struct modesMessage *mm, struct aircraft *a);
+int modesNetNeedsTracking(void);
 void modesNetPeriodicWork(void);
+void modesNetWait(int max_ms);
+void modesNetShutdown(void);
 
 // TODO: move these somewhere else
 char *generateAircraftJson(const char *url_path, int *len);
+char *generateRegionJson(const char *url_path, int *len);
 char *generateStatsJson(const char *url_path, int *len);
 char *generateReceiverJson(const char *url_path, int *len);
 char *generateHistoryJson(const char *url_path, int *len);
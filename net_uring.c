@@ -0,0 +1,304 @@
+// Part of dump1090, a Mode S message decoder for RTLSDR devices.
+//
+// net_uring.c: minimal io_uring support for the networking code
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 2 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// This talks to the kernel directly rather than through liburing: we only
+// need one ring, a handful of operations and one group of provided
+// buffers, and it saves a build dependency.
+
+#ifdef HAVE_IO_URING
+
+#include "net_uring.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int ring_fd = -1;
+
+// submission queue
+static _Atomic unsigned *sq_head;
+static _Atomic unsigned *sq_tail;
+static unsigned sq_mask;
+static unsigned sq_entries;
+static struct io_uring_sqe *sqes;
+static unsigned sq_queued;         // entries added since the last submit
+
+// completion queue
+static _Atomic unsigned *cq_head;
+static _Atomic unsigned *cq_tail;
+static unsigned cq_mask;
+static struct io_uring_cqe *cqes;
+
+// provided receive buffers
+static struct io_uring_buf_ring *buf_ring;
+static unsigned buf_mask;
+static unsigned buf_size;
+static char *buf_data;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+// Check for an operation that first appeared in Linux 6.0, which is also
+// when multishot receive arrived
+static int uringProbe(void)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe;
+    int ok;
+
+    if (!(probe = calloc(1, len)))
+        return 0;
+
+    ok = (uring_register(IORING_REGISTER_PROBE, probe, 256) == 0 &&
+          probe->last_op >= IORING_OP_SEND_ZC &&
+          (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED));
+
+    free(probe);
+    return ok;
+}
+
+// Mappings made by uringInit, so that a failure part way through can undo them
+static void *sq_ptr = MAP_FAILED;
+static size_t sq_len;
+static size_t sqes_len;
+static size_t buf_ring_len;
+
+static void uringCleanup(void)
+{
+    int saved_errno = errno;
+
+    if (buf_ring != MAP_FAILED && buf_ring)
+        munmap(buf_ring, buf_ring_len);
+    if (sqes != MAP_FAILED && sqes)
+        munmap(sqes, sqes_len);
+    if (sq_ptr != MAP_FAILED)
+        munmap(sq_ptr, sq_len);
+    free(buf_data);
+    if (ring_fd >= 0)
+        close(ring_fd);
+
+    ring_fd = -1;
+    sq_ptr = MAP_FAILED;
+    sqes = NULL;
+    buf_ring = NULL;
+    buf_data = NULL;
+    errno = saved_errno;
+}
+
+int uringInit(unsigned entries, unsigned nbufs, unsigned bufsize)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned i;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 8;
+
+    if ((ring_fd = uring_setup(entries, &p)) < 0)
+        return -1;
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG) || !uringProbe()) {
+        uringCleanup();
+        errno = ENOSYS;
+        return -1;
+    }
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > sq_len)
+        sq_len = cq_len;
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        uringCleanup();
+        return -1;
+    }
+    cq_ptr = sq_ptr;
+
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        uringCleanup();
+        return -1;
+    }
+
+    sq_head = (_Atomic unsigned *) ((char *) sq_ptr + p.sq_off.head);
+    sq_tail = (_Atomic unsigned *) ((char *) sq_ptr + p.sq_off.tail);
+    sq_mask = *(unsigned *) ((char *) sq_ptr + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+
+    // we always submit in order, so the index array is the identity
+    for (i = 0; i < p.sq_entries; ++i)
+        ((unsigned *) ((char *) sq_ptr + p.sq_off.array))[i] = i;
+
+    cq_head = (_Atomic unsigned *) ((char *) cq_ptr + p.cq_off.head);
+    cq_tail = (_Atomic unsigned *) ((char *) cq_ptr + p.cq_off.tail);
+    cq_mask = *(unsigned *) ((char *) cq_ptr + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((char *) cq_ptr + p.cq_off.cqes);
+
+    // Provided buffers: the ring of buffer descriptors must be page
+    // aligned, so mmap it rather than malloc it
+    buf_ring_len = nbufs * sizeof(struct io_uring_buf);
+    buf_ring = mmap(NULL, buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        uringCleanup();
+        return -1;
+    }
+
+    if (!(buf_data = malloc((size_t) nbufs * bufsize))) {
+        uringCleanup();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) buf_ring;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (uring_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uringCleanup();
+        return -1;
+    }
+
+    buf_mask = nbufs - 1;
+    buf_size = bufsize;
+    for (i = 0; i < nbufs; ++i) {
+        buf_ring->bufs[i].addr = (uint64_t) (uintptr_t) (buf_data + (size_t) i * bufsize);
+        buf_ring->bufs[i].len = bufsize;
+        buf_ring->bufs[i].bid = i;
+    }
+    atomic_store_explicit((_Atomic uint16_t *) &buf_ring->tail, (uint16_t) nbufs, memory_order_release);
+
+    return 0;
+}
+
+struct io_uring_sqe *uringGetSqe(void)
+{
+    unsigned tail = atomic_load_explicit(sq_tail, memory_order_relaxed);
+    struct io_uring_sqe *sqe;
+
+    if (tail - atomic_load_explicit(sq_head, memory_order_acquire) >= sq_entries) {
+        uringSubmit();
+        while (tail - atomic_load_explicit(sq_head, memory_order_acquire) >= sq_entries) {
+            // the kernel couldn't take them all (completion queue backed
+            // up); let it make progress
+            uring_enter(0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            uringSubmit();
+        }
+    }
+
+    sqe = &sqes[tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    atomic_store_explicit(sq_tail, tail + 1, memory_order_release);
+    ++sq_queued;
+    return sqe;
+}
+
+void uringSubmit(void)
+{
+    int n;
+
+    while (sq_queued) {
+        if ((n = uring_enter(sq_queued, 0, 0, NULL, 0)) <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return; // EBUSY/EAGAIN: try again next time
+        }
+        sq_queued -= n;
+    }
+}
+
+void uringWait(int timeout_ms)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    int n;
+
+    if (timeout_ms <= 0 || atomic_load_explicit(cq_head, memory_order_relaxed) != atomic_load_explicit(cq_tail, memory_order_acquire)) {
+        uringSubmit();
+        return;
+    }
+
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    n = uring_enter(sq_queued, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (n > 0)
+        sq_queued -= n;
+}
+
+struct io_uring_cqe *uringPeekCqe(void)
+{
+    unsigned head = atomic_load_explicit(cq_head, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(cq_tail, memory_order_acquire))
+        return NULL;
+    return &cqes[head & cq_mask];
+}
+
+void uringCqeSeen(void)
+{
+    atomic_store_explicit(cq_head, atomic_load_explicit(cq_head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+unsigned uringCqReady(void)
+{
+    return atomic_load_explicit(cq_tail, memory_order_acquire) - atomic_load_explicit(cq_head, memory_order_relaxed);
+}
+
+char *uringBuffer(unsigned bid)
+{
+    return buf_data + (size_t) bid * buf_size;
+}
+
+void uringRecycleBuffer(unsigned bid)
+{
+    _Atomic uint16_t *tailp = (_Atomic uint16_t *) &buf_ring->tail;
+    uint16_t tail = atomic_load_explicit(tailp, memory_order_relaxed);
+    struct io_uring_buf *buf = &buf_ring->bufs[tail & buf_mask];
+
+    buf->addr = (uint64_t) (uintptr_t) uringBuffer(bid);
+    buf->len = buf_size;
+    buf->bid = bid;
+    atomic_store_explicit(tailp, tail + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,60 @@
+// Part of dump1090, a Mode S message decoder for RTLSDR devices.
+//
+// net_uring.h: minimal io_uring support for the networking code
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 2 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef NET_URING_H
+#define NET_URING_H
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+// Buffer group used for provided-buffer receives
+#define URING_BUFFER_GROUP 0
+
+// Set up the (single, process-wide) ring with a group of 'nbufs' receive
+// buffers of 'bufsize' bytes each. Returns 0 on success, or -1 with errno
+// set if the kernel can't do what we need (io_uring missing or disabled,
+// or older than Linux 6.0).
+int uringInit(unsigned entries, unsigned nbufs, unsigned bufsize);
+
+// Get a cleared submission queue entry to fill in; submits what is
+// already queued first if the queue is full.
+struct io_uring_sqe *uringGetSqe(void);
+
+// Submit everything queued so far
+void uringSubmit(void);
+
+// Submit everything queued so far, then wait up to timeout_ms for at least
+// one completion (don't wait at all if timeout_ms is 0)
+void uringWait(int timeout_ms);
+
+// Get the next completion, or NULL if there are none. The entry must be
+// released with uringCqeSeen() before calling this again.
+struct io_uring_cqe *uringPeekCqe(void);
+void uringCqeSeen(void);
+
+// Number of completions waiting
+unsigned uringCqReady(void);
+
+// Provided receive buffers: the data for a completion that carries
+// IORING_CQE_F_BUFFER, and giving that buffer back afterwards
+char *uringBuffer(unsigned bid);
+void uringRecycleBuffer(unsigned bid);
+
+#endif
+
+#endif
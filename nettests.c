@@ -0,0 +1,371 @@
+// Part of dump1090, a Mode S message decoder for RTLSDR devices.
+//
+// nettests.c - tests for network client handling
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 2 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// A Beast output port is opened on the loopback interface and driven
+// through modesNetPeriodicWork() like the main loop does; a test client
+// connects to it and checks what comes back.
+
+#include "dump1090.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+struct _Modes Modes;
+
+void receiverPositionChanged(float lat, float lon, float alt)
+{
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+#define NUM_MESSAGES 100
+#define NUM_FILTER_CLIENTS 100
+
+// Find a loopback port that nothing is listening on
+static int freePort(void)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int port;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 || getsockname(fd, (struct sockaddr *) &sa, &len) < 0) {
+        fprintf(stderr, "can't find a free port: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    port = ntohs(sa.sin_port);
+    close(fd);
+    return port;
+}
+
+static int connectTo(int port)
+{
+    struct sockaddr_in sa;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "can't connect to port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+
+    anetNonBlock(Modes.aneterr, fd);
+    return fd;
+}
+
+// Run the network work until the kernel has had a chance to deliver
+// anything in flight in either direction
+static void netSettle(void)
+{
+    for (int i = 0; i < 20; ++i) {
+        modesNetPeriodicWork();
+        usleep(2000);
+    }
+}
+
+// The number of filtered output services that currently exist
+static int countFilteredServices(void)
+{
+    struct net_service *s;
+    int n = 0;
+
+    for (s = Modes.services; s; s = s->next) {
+        if (s->unfiltered)
+            ++n;
+    }
+
+    return n;
+}
+
+static void sendFilter(int fd, const char *filter)
+{
+    char buf[256];
+    int len = 0;
+
+    do {
+        buf[len++] = 0x1a;
+        buf[len++] = 'F';
+        buf[len++] = *filter;
+    } while (*filter++);
+
+    if (write(fd, buf, len) != len) {
+        fprintf(stderr, "write: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+// Clients each ask for a filter of their own. Only a limited number of
+// distinct client filters should be created, and their services should go
+// away again once their clients have.
+static int testClientFilters(int port)
+{
+    static int fds[NUM_FILTER_CLIENTS];
+    char filter[32];
+    int n, ok = 1;
+
+    for (int i = 0; i < NUM_FILTER_CLIENTS; ++i) {
+        fds[i] = connectTo(port);
+        snprintf(filter, sizeof(filter), "icao=%06X", 0x400000 + i);
+        sendFilter(fds[i], filter);
+    }
+    netSettle();
+
+    n = countFilteredServices();
+    if (n == 0 || n >= NUM_FILTER_CLIENTS) {
+        fprintf(stderr, "testClientFilters: %d clients with different filters have %d filtered services\n", NUM_FILTER_CLIENTS, n);
+        ok = 0;
+    }
+
+    for (int i = 0; i < NUM_FILTER_CLIENTS; ++i)
+        close(fds[i]);
+    netSettle();
+
+    if ((n = countFilteredServices()) != 0) {
+        fprintf(stderr, "testClientFilters: %d filtered services left after their clients disconnected\n", n);
+        ok = 0;
+    }
+
+    // the filters that were used should be available again
+    fds[0] = connectTo(port);
+    sendFilter(fds[0], "df=17");
+    netSettle();
+
+    if ((n = countFilteredServices()) != 1) {
+        fprintf(stderr, "testClientFilters: a new client filter has %d filtered services\n", n);
+        ok = 0;
+    }
+
+    close(fds[0]);
+    netSettle();
+
+    fprintf(stderr, "testClientFilters: %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Decode a DF17 identification message for 4840D6, callsign KLM1023,
+// leaving junk in the part of the message that is decoded on demand as a
+// stack or reused buffer would
+static void identMessage(struct modesMessage *mm)
+{
+    static unsigned char msg[MODES_LONG_MSG_BYTES] = { 0x8D, 0x48, 0x40, 0xD6, 0x20, 0x2C, 0xC3, 0x71, 0xC3, 0x2C, 0xE0, 0x57, 0x60, 0x98 };
+
+    memset(mm, 0xAA, sizeof(*mm));
+    resetModesMessage(mm);
+    mm->sysTimestampMsg = mstime();
+    if (decodeModesMessage(mm, msg) < 0) {
+        fprintf(stderr, "can't decode test message\n");
+        exit(1);
+    }
+}
+
+// A node that only forwards verbatim data skips tracking and decoding.
+// An SBS client that connects after that decision was made for a batch
+// must still be fed decoded messages, and once it is connected, messages
+// should be tracked again.
+static int testSkippedTracking(int sbs_port)
+{
+    static char out[65536];
+    struct modesMessage mm;
+    ssize_t n, len = 0;
+    int fd, ok = 1;
+
+    if (modesNetNeedsTracking()) {
+        fprintf(stderr, "testSkippedTracking: tracking is needed with no clients connected\n");
+        ok = 0;
+    }
+
+    identMessage(&mm);
+    useModesMessages(&mm, 1);
+    if (mm.decoded) {
+        fprintf(stderr, "testSkippedTracking: message was decoded with no clients connected\n");
+        ok = 0;
+    }
+
+    fd = connectTo(sbs_port);
+    netSettle();
+
+    // as if tracking had been skipped for the batch this message came in
+    identMessage(&mm);
+    modesQueueOutput(&mm, NULL);
+    if (!mm.decoded || !mm.callsign_valid || strcmp(mm.callsign, "KLM1023 ")) {
+        fprintf(stderr, "testSkippedTracking: message was output without being decoded\n");
+        ok = 0;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        identMessage(&mm);
+        useModesMessages(&mm, 1);
+    }
+    netSettle();
+
+    while (len < (ssize_t) sizeof(out) - 1 && (n = read(fd, out + len, sizeof(out) - 1 - len)) > 0)
+        len += n;
+    out[len] = 0;
+
+    if (!strstr(out, "MSG,1,1,1,4840D6,") || !strstr(out, ",KLM1023 ,")) {
+        fprintf(stderr, "testSkippedTracking: no identification in SBS output:\n%s", out);
+        ok = 0;
+    }
+
+    close(fd);
+    netSettle();
+
+    fprintf(stderr, "testSkippedTracking: %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+#ifdef ENABLE_ZLIB
+static void queueMessages(void)
+{
+    struct modesMessage mm;
+
+    for (int i = 0; i < NUM_MESSAGES; ++i) {
+        memset(&mm, 0, sizeof(mm));
+        for (int j = 0; j < MODES_LONG_MSG_BYTES; ++j)
+            mm.msg[j] = rand();
+        mm.msg[0] = (17 << 3) | 5;
+        memcpy(mm.verbatim, mm.msg, sizeof(mm.msg));
+
+        mm.msgtype = 17;
+        mm.msgbits = MODES_LONG_MSG_BITS;
+        mm.timestampMsg = (uint64_t) i * 12000;
+        mm.signalLevel = 0.01;
+        mm.source = SOURCE_ADSB;
+        mm.reliable = 1;
+        modesQueueOutput(&mm, NULL);
+    }
+}
+
+// A client of a compressed Beast output port sends an (uncompressed)
+// command to switch to verbatim mode. The command should be acted on,
+// the client should stay connected, and its output should still be a
+// valid compressed stream of Beast frames.
+static int testCompressedCommand(int port)
+{
+    static unsigned char in[65536], out[NUM_MESSAGES * 64];
+    static const char command[] = { 0x1a, '1', 'V' };
+    z_stream zs;
+    ssize_t n;
+    int fd, ok = 1;
+
+    fd = connectTo(port);
+    netSettle();
+
+    if (write(fd, command, sizeof(command)) != sizeof(command)) {
+        fprintf(stderr, "write: %s\n", strerror(errno));
+        exit(1);
+    }
+    netSettle();
+
+    if (Modes.beast_verbatim_service->connections != 1) {
+        fprintf(stderr, "testCompressedCommand: client was not moved to verbatim mode\n");
+        ok = 0;
+    }
+
+    queueMessages();
+    netSettle();
+
+    memset(&zs, 0, sizeof(zs));
+    inflateInit(&zs);
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+
+    while ((n = read(fd, in, sizeof(in))) > 0) {
+        zs.next_in = in;
+        zs.avail_in = n;
+        if (inflate(&zs, Z_SYNC_FLUSH) < 0) {
+            fprintf(stderr, "testCompressedCommand: bad compressed output: %s\n", zs.msg ? zs.msg : "?");
+            ok = 0;
+            break;
+        }
+    }
+
+    if (n == 0) {
+        fprintf(stderr, "testCompressedCommand: client was disconnected\n");
+        ok = 0;
+    }
+
+    // each message is at least 0x1a '3', a 6 byte timestamp, signal and 14 bytes of data
+    if (zs.total_out < NUM_MESSAGES * 23 || out[0] != 0x1a || out[1] != '3') {
+        fprintf(stderr, "testCompressedCommand: got %lu bytes of output, expected at least %u Beast frames\n", zs.total_out, NUM_MESSAGES);
+        ok = 0;
+    }
+
+    inflateEnd(&zs);
+    close(fd);
+
+    fprintf(stderr, "testCompressedCommand: %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+#endif
+
+int main(int argc, char **argv) {
+    char ports[32];
+    int port, plain_port, sbs_port, ok = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "--uring"))
+        Modes.net_uring = 1;
+
+    srand(1);
+    modesChecksumInit(0);
+    icaoFilterInit();
+    modeACInit();
+
+    // a compressed Beast output port, a plain one, and an SBS port
+    port = freePort();
+    plain_port = freePort();
+    sbs_port = freePort();
+    snprintf(ports, sizeof(ports), "%d", port);
+    Modes.net_compress_ports = strdup(ports);
+    snprintf(ports, sizeof(ports), "%d,%d", port, plain_port);
+    Modes.net_output_beast_ports = strdup(ports);
+    snprintf(ports, sizeof(ports), "%d", sbs_port);
+    Modes.net_output_sbs_ports = strdup(ports);
+
+    // a forward-only node: nothing but output clients needs tracking
+    Modes.quiet = 1;
+    Modes.net = 1;
+    Modes.net_output_backlog = MODES_NET_OUTPUT_BACKLOG;
+    Modes.net_bind_address = strdup("127.0.0.1");
+    modesInitNet();
+
+    ok = testClientFilters(plain_port) && ok;
+    ok = testSkippedTracking(sbs_port) && ok;
+
+#ifdef ENABLE_ZLIB
+    ok = testCompressedCommand(port) && ok;
+#else
+    MODES_NOTUSED(port);
+    fprintf(stderr, "testCompressedCommand: skipped (no zlib)\n");
+#endif
+
+    return ok ? 0 : 1;
+}
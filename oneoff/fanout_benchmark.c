@@ -0,0 +1,172 @@
+// Part of dump1090, a Mode S message decoder for RTLSDR devices.
+//
+// fanout_benchmark.c: benchmark for sending Beast output to many clients
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 2 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../dump1090.h"
+
+#include <inttypes.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+struct _Modes Modes;
+
+void receiverPositionChanged(float lat, float lon, float alt)
+{
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+#define NUM_CLIENTS 500
+#define NUM_MESSAGES 1000
+#define MESSAGES_PER_PASS 100
+
+// Sample results (x86-64, 500 clients, 100 messages per pass):
+//   one write() per client per flush:           206.7 us/message
+//   shared segments, one writev() per pass:       3.0 us/message
+//   the same, with io_uring (--uring):            2.8 us/message
+
+static struct modesMessage *testdata;
+static int consumer_fds[NUM_CLIENTS];
+static uint64_t consumer_bytes[NUM_CLIENTS];
+
+// Build some DF17 messages to send, and connect NUM_CLIENTS consumers to the
+// cooked Beast output over socketpairs. Output settings are dump1090's
+// defaults: every message is flushed as soon as it is written.
+static void prepare()
+{
+    struct rlimit limit;
+
+    srand(1);
+
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < NUM_CLIENTS * 2 + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Modes.net = 1;
+    Modes.net_output_backlog = MODES_NET_OUTPUT_BACKLOG;
+    modesInitNet();
+
+    testdata = calloc(NUM_MESSAGES, sizeof(*testdata));
+    for (int i = 0; i < NUM_MESSAGES; ++i) {
+        struct modesMessage *mm = &testdata[i];
+
+        for (int j = 0; j < MODES_LONG_MSG_BYTES; ++j)
+            mm->msg[j] = rand();
+        mm->msg[0] = (17 << 3) | 5;
+        memcpy(mm->verbatim, mm->msg, sizeof(mm->msg));
+
+        mm->msgtype = 17;
+        mm->msgbits = MODES_LONG_MSG_BITS;
+        mm->timestampMsg = (uint64_t) i * 12000;
+        mm->signalLevel = 0.01;
+        mm->source = SOURCE_ADSB;
+        mm->reliable = 1;
+    }
+
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        int sv[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            fprintf(stderr, "socketpair: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        createSocketClient(Modes.beast_cooked_service, sv[0]);
+        anetNonBlock(Modes.aneterr, sv[1]);
+        consumer_fds[i] = sv[1];
+    }
+}
+
+// Read everything that is waiting for each consumer
+static void consume()
+{
+    static char buf[65536];
+
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        ssize_t n;
+        while ((n = read(consumer_fds[i], buf, sizeof(buf))) > 0)
+            consumer_bytes[i] += n;
+    }
+}
+
+static void test()
+{
+    struct timespec total = { 0, 0 };
+    uint64_t messages = 0;
+    int next = 0;
+
+    fprintf(stderr, "Benchmarking: Beast output to %d clients%s ", NUM_CLIENTS, Modes.net_uring ? " (io_uring)" : "");
+
+    while (total.tv_sec < 5) {
+        struct timespec start;
+
+        if (messages % (MESSAGES_PER_PASS * 100) == 0)
+            fprintf(stderr, ".");
+
+        // one pass of the main loop: queue some output, then do the
+        // periodic network work
+        start_cpu_timing(&start);
+        for (int i = 0; i < MESSAGES_PER_PASS; ++i) {
+            modesQueueOutput(&testdata[next], NULL);
+            next = (next + 1) % NUM_MESSAGES;
+        }
+        modesNetPeriodicWork();
+        end_cpu_timing(&start, &total);
+
+        messages += MESSAGES_PER_PASS;
+        consume();
+    }
+
+    // with io_uring, some sends may still be in flight
+    for (int i = 0; i < 100; ++i) {
+        modesNetPeriodicWork();
+        consume();
+    }
+
+    fprintf(stderr, "\n");
+
+    // every consumer should have seen the same stream
+    for (int i = 1; i < NUM_CLIENTS; ++i) {
+        if (consumer_bytes[i] != consumer_bytes[0]) {
+            fprintf(stderr, "  consumer %d got %" PRIu64 " bytes, consumer 0 got %" PRIu64 "\n",
+                    i, consumer_bytes[i], consumer_bytes[0]);
+            exit(1);
+        }
+    }
+
+    double nanos = total.tv_sec * 1e9 + total.tv_nsec;
+    fprintf(stderr, "  %.2fM messages in %.6f seconds, %.1f MB to each client\n",
+            messages / 1e6, nanos / 1e9, consumer_bytes[0] / 1e6);
+    fprintf(stderr, "  %.1f us/message\n",
+            nanos / messages / 1e3);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "  %ld kB max RSS\n", usage.ru_maxrss);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "--uring"))
+        Modes.net_uring = 1;
+
+    prepare();
+    test();
+}
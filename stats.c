@@ -117,6 +117,32 @@ void display_stats(struct stats *st) {
         printf("    %u accepted with correct CRC\n",              st->remote_accepted[0]);
         for (j = 1; j <= Modes.nfix_crc; ++j)
             printf("    %u accepted with %d-bit error repaired\n", st->remote_accepted[j], j);
+        if (st->net_udp_received) {
+            printf("  %u UDP datagrams received, %u lost\n", st->net_udp_received, st->net_udp_lost);
+        }
+        if (st->net_decompress_in) {
+            printf("  %llu compressed bytes decompressed to %llu, %.1f ms CPU\n",
+                   (unsigned long long) st->net_decompress_in,
+                   (unsigned long long) st->net_decompress_out,
+                   st->net_decompress_cpu.tv_sec * 1000.0 + st->net_decompress_cpu.tv_nsec / 1.0e6);
+        }
+        printf("Network output:\n");
+        printf("  %llu bytes dropped for slow clients\n",        (unsigned long long) st->net_output_dropped);
+        printf("  %u slow clients disconnected\n",               st->net_output_disconnects);
+        netDisplayBacklogs();
+        if (st->net_udp_sent || st->net_udp_send_errors) {
+            printf("  %u UDP datagrams sent, %u send errors\n", st->net_udp_sent, st->net_udp_send_errors);
+        }
+        if (st->net_compress_in) {
+            printf("  %llu bytes compressed to %llu (%.1f%%), %u flushes\n",
+                   (unsigned long long) st->net_compress_in,
+                   (unsigned long long) st->net_compress_out,
+                   100.0 * st->net_compress_out / st->net_compress_in,
+                   st->net_compress_flushes);
+            printf("  %.1f ms CPU compressing, %.3f ms mean delay before a flush\n",
+                   st->net_compress_cpu.tv_sec * 1000.0 + st->net_compress_cpu.tv_nsec / 1.0e6,
+                   st->net_compress_flushes ? st->net_compress_latency_ns / 1.0e6 / st->net_compress_flushes : 0.0);
+        }
     }
 
     printf("%u total usable messages\n",
@@ -302,6 +328,22 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     for (i = 0; i < MODES_MAX_BITERRORS+1; ++i)
         target->remote_accepted[i]  = st1->remote_accepted[i] + st2->remote_accepted[i];
 
+    // network output:
+    target->net_output_dropped = st1->net_output_dropped + st2->net_output_dropped;
+    target->net_output_disconnects = st1->net_output_disconnects + st2->net_output_disconnects;
+    target->net_udp_sent = st1->net_udp_sent + st2->net_udp_sent;
+    target->net_udp_send_errors = st1->net_udp_send_errors + st2->net_udp_send_errors;
+    target->net_udp_received = st1->net_udp_received + st2->net_udp_received;
+    target->net_udp_lost = st1->net_udp_lost + st2->net_udp_lost;
+    target->net_compress_in = st1->net_compress_in + st2->net_compress_in;
+    target->net_compress_out = st1->net_compress_out + st2->net_compress_out;
+    target->net_compress_flushes = st1->net_compress_flushes + st2->net_compress_flushes;
+    target->net_compress_latency_ns = st1->net_compress_latency_ns + st2->net_compress_latency_ns;
+    add_timespecs(&st1->net_compress_cpu, &st2->net_compress_cpu, &target->net_compress_cpu);
+    target->net_decompress_in = st1->net_decompress_in + st2->net_decompress_in;
+    target->net_decompress_out = st1->net_decompress_out + st2->net_decompress_out;
+    add_timespecs(&st1->net_decompress_cpu, &st2->net_decompress_cpu, &target->net_decompress_cpu);
+
     // total messages:
     target->messages_total = st1->messages_total + st2->messages_total;
 
@@ -321,6 +363,10 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->cpr_local_speed_checks = st1->cpr_local_speed_checks + st2->cpr_local_speed_checks;
     target->cpr_filtered = st1->cpr_filtered + st2->cpr_filtered;
 
+    // extended squitter types:
+    for (i = 0; i < 32; ++i)
+        target->es_type[i] = st1->es_type[i] + st2->es_type[i];
+
     target->suppressed_altitude_messages = st1->suppressed_altitude_messages + st2->suppressed_altitude_messages;
 
     // aircraft
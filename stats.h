@@ -92,6 +92,26 @@ struct stats {
     uint32_t remote_rejected_unknown_icao;
     uint32_t remote_accepted[MODES_MAX_BITERRORS+1];
 
+    // network output:
+    uint64_t net_output_dropped;      // bytes discarded because a client's backlog was full
+    uint32_t net_output_disconnects;  // clients disconnected because their backlog was full
+
+    // UDP output and input:
+    uint32_t net_udp_sent;            // datagrams sent (once per destination)
+    uint32_t net_udp_send_errors;     // datagrams that couldn't be sent
+    uint32_t net_udp_received;        // datagrams received
+    uint32_t net_udp_lost;            // gaps in the sequence numbers of datagrams received
+
+    // --net-compress:
+    uint64_t net_compress_in;         // bytes of output passed to the compressor
+    uint64_t net_compress_out;        // compressed bytes it produced
+    uint32_t net_compress_flushes;    // number of times it was flushed
+    uint64_t net_compress_latency_ns; // total time output waited in the compressor before being flushed
+    struct timespec net_compress_cpu;
+    uint64_t net_decompress_in;       // compressed bytes of input received
+    uint64_t net_decompress_out;      // bytes they decompressed to
+    struct timespec net_decompress_cpu;
+
     // total messages:
     uint32_t messages_total;
 
@@ -111,6 +131,9 @@ struct stats {
     unsigned int cpr_local_receiver_relative;
     unsigned int cpr_filtered;
 
+    // extended squitters decoded, by ME type:
+    unsigned int es_type[32];
+
     // number of altitude messages ignored because
     // we had a recent DF17/18 altitude
     unsigned int suppressed_altitude_messages;
@@ -57,17 +57,290 @@ uint32_t modeAC_lastcount[4096];
 uint32_t modeAC_match[4096];
 uint32_t modeAC_age[4096];
 
+// Mode A/C codes with a nonzero count, so the periodic matching only
+// looks at codes that have actually been heard rather than all 4096
+static uint16_t modeAC_active[4096];
+static unsigned modeAC_active_count;
+static unsigned char modeAC_listed[4096];
+
+// Aircraft indexed by the values Mode A/C replies are matched against:
+// by squawk (as a mode A index) and by Mode C altitude (100ft units,
+// offset so that everything within 100ft of a valid Mode C value fits).
+// Maintained as the squawk / altitude change; validity and age are still
+// checked when matching.
+#define MODEC_INDEX_OFFSET 14
+#define MODEC_INDEX_SIZE 4098
+
+static struct aircraft *modeAC_bySquawk[4096];
+static struct aircraft *modeAC_byModeC[MODEC_INDEX_SIZE];
+
+static void modeACUnindexSquawk(struct aircraft *a)
+{
+    if (!a->squawk_pprev)
+        return;
+
+    if (a->squawk_next)
+        a->squawk_next->squawk_pprev = a->squawk_pprev;
+    *a->squawk_pprev = a->squawk_next;
+    a->squawk_pprev = NULL;
+}
+
+static void modeACIndexSquawk(struct aircraft *a)
+{
+    struct aircraft **head = &modeAC_bySquawk[modeAToIndex(a->squawk)];
+
+    modeACUnindexSquawk(a);
+
+    a->squawk_next = *head;
+    if (*head)
+        (*head)->squawk_pprev = &a->squawk_next;
+    a->squawk_pprev = head;
+    *head = a;
+}
+
+static void modeACUnindexModeC(struct aircraft *a)
+{
+    if (!a->modeC_pprev)
+        return;
+
+    if (a->modeC_next)
+        a->modeC_next->modeC_pprev = a->modeC_pprev;
+    *a->modeC_pprev = a->modeC_next;
+    a->modeC_pprev = NULL;
+}
+
+static void modeACIndexModeC(struct aircraft *a, int modeC)
+{
+    struct aircraft **head;
+
+    modeACUnindexModeC(a);
+
+    modeC += MODEC_INDEX_OFFSET;
+    if (modeC < 0 || modeC >= MODEC_INDEX_SIZE)
+        return; // can't match any valid Mode C value
+
+    head = &modeAC_byModeC[modeC];
+    a->modeC_next = *head;
+    if (*head)
+        (*head)->modeC_pprev = &a->modeC_next;
+    a->modeC_pprev = head;
+    *head = a;
+}
+
+//
+// Stale and expire intervals (in ms) for each data_validity member of
+// struct aircraft, indexed by data_validity.field. The table also lists
+// every validity member, which is what trackRebaseEpoch walks.
+//
+
+struct validity_interval {
+    size_t offset;
+    uint32_t stale_interval;
+    uint32_t expire_interval;
+};
+
+#define F(f,s,e) { offsetof(struct aircraft, f##_valid), (s) * 1000, (e) * 1000 }
+static const struct validity_interval validity_intervals[] = {
+    F(callsign,         60, 70),  // ADS-B or Comm-B
+    F(altitude_baro,    15, 70),  // ADS-B or Mode S
+    F(altitude_geom,    60, 70),  // ADS-B only
+    F(geom_delta,       60, 70),  // ADS-B only
+    F(gs,               60, 70),  // ADS-B or Comm-B
+    F(ias,              60, 70),  // ADS-B (rare) or Comm-B
+    F(tas,              60, 70),  // ADS-B (rare) or Comm-B
+    F(mach,             60, 70),  // Comm-B only
+    F(track,            60, 70),  // ADS-B or Comm-B
+    F(track_rate,       60, 70),  // Comm-B only
+    F(roll,             60, 70),  // Comm-B only
+    F(mag_heading,      60, 70),  // ADS-B (rare) or Comm-B
+    F(true_heading,     60, 70),  // ADS-B only (rare)
+    F(baro_rate,        60, 70),  // ADS-B or Comm-B
+    F(geom_rate,        60, 70),  // ADS-B or Comm-B
+    F(squawk,           15, 70),  // ADS-B or Mode S
+    F(emergency,        60, 70),  // ADS-B or Mode S
+    F(airground,        15, 70),  // ADS-B or Mode S
+    F(nav_qnh,          60, 70),  // Comm-B only
+    F(nav_altitude_mcp, 60, 70),  // ADS-B or Comm-B
+    F(nav_altitude_fms, 60, 70),  // ADS-B or Comm-B
+    F(nav_altitude_src, 60, 70),  // ADS-B or Comm-B
+    F(nav_heading,      60, 70),  // ADS-B or Comm-B
+    F(nav_modes,        60, 70),  // ADS-B or Comm-B
+    F(cpr_odd,          60, 70),  // ADS-B only
+    F(cpr_even,         60, 70),  // ADS-B only
+    F(position,         60, 70),  // ADS-B only
+    F(nic_a,            60, 70),  // ADS-B only
+    F(nic_c,            60, 70),  // ADS-B only
+    F(nic_baro,         60, 70),  // ADS-B only
+    F(nac_p,            60, 70),  // ADS-B only
+    F(nac_v,            60, 70),  // ADS-B only
+    F(sil,              60, 70),  // ADS-B only
+    F(gva,              60, 70),  // ADS-B only
+    F(sda,              60, 70),  // ADS-B only
+};
+#undef F
+
+#define VALIDITY_FIELDS (sizeof(validity_intervals) / sizeof(validity_intervals[0]))
+
+uint64_t trackEpoch;
+
+// Move trackEpoch forward so that epoch-relative timestamps stay well inside
+// 32 bits, adjusting every stored validity timestamp to match. Anything from
+// before the new epoch is long expired, so it is simply clamped to zero.
+// The epoch never moves backwards, even if the clock does.
+static void trackRebaseEpoch(uint64_t now)
+{
+    uint64_t newEpoch = (now > TRACK_EPOCH_MARGIN) ? now - TRACK_EPOCH_MARGIN : 0;
+    uint64_t delta;
+    struct aircraft *a;
+    unsigned i;
+
+    if (newEpoch <= trackEpoch)
+        return;
+    delta = newEpoch - trackEpoch;
+
+    for (a = Modes.aircrafts; a; a = a->next) {
+        for (i = 0; i < VALIDITY_FIELDS; ++i) {
+            data_validity *v = (data_validity *) ((char *) a + validity_intervals[i].offset);
+            v->updated = (v->updated > delta) ? v->updated - delta : 0;
+            v->stale = (v->stale > delta) ? v->stale - delta : 0;
+            v->expires = (v->expires > delta) ? v->expires - delta : 0;
+        }
+    }
+
+    trackEpoch = newEpoch;
+}
+
+//
+// Spatial index of aircraft positions: a uniform grid of one-degree cells,
+// hashed into a fixed number of buckets so the memory used doesn't depend
+// on how much of the globe is covered. Each aircraft with a position is
+// linked into the bucket for its cell and moves when it changes cell.
+// Entries whose position has since expired are left in place; the queries
+// check position validity.
+//
+
+#define GRID_CELLS_LAT 180
+#define GRID_CELLS_LON 360
+#define GRID_BUCKET_BITS 12
+#define GRID_BUCKETS (1 << GRID_BUCKET_BITS)
+
+static struct aircraft *grid_buckets[GRID_BUCKETS];
+
+static inline int gridLatCell(double lat)
+{
+    int cell = (int) floor(lat) + 90;
+    return (cell < 0 ? 0 : cell >= GRID_CELLS_LAT ? GRID_CELLS_LAT - 1 : cell);
+}
+
+static inline int gridLonCell(double lon)
+{
+    int cell = (int) floor(lon) + 180;
+    return ((cell % GRID_CELLS_LON) + GRID_CELLS_LON) % GRID_CELLS_LON;
+}
+
+static inline unsigned gridBucket(uint32_t cell)
+{
+    return (uint32_t) (cell * 2654435761U) >> (32 - GRID_BUCKET_BITS);
+}
+
+static void gridRemove(struct aircraft *a)
+{
+    if (!a->grid_pprev)
+        return;
+
+    if (a->grid_next)
+        a->grid_next->grid_pprev = a->grid_pprev;
+    *a->grid_pprev = a->grid_next;
+    a->grid_pprev = NULL;
+}
+
+static void gridUpdate(struct aircraft *a)
+{
+    uint32_t cell = gridLatCell(a->lat) * GRID_CELLS_LON + gridLonCell(a->lon);
+    struct aircraft **head;
+
+    if (a->grid_pprev && a->grid_cell == cell)
+        return;
+
+    gridRemove(a);
+
+    head = &grid_buckets[gridBucket(cell)];
+    a->grid_cell = cell;
+    a->grid_next = *head;
+    if (*head)
+        (*head)->grid_pprev = &a->grid_next;
+    a->grid_pprev = head;
+    *head = a;
+}
+
+//
+// Tracked aircraft and their FATSV state are carved out of slabs and
+// recycled through a free list, rather than going through malloc/free for
+// every aircraft that comes and goes. The free list is threaded through the
+// first word of each free item.
+//
+
+#define POOL_ITEMS_PER_SLAB 256
+
+struct pool {
+    size_t item_size;
+    void *free_list;
+};
+
+static struct pool aircraft_pool = { sizeof(struct aircraft), NULL };
+static struct pool fatsv_pool = { sizeof(struct fatsv_state), NULL };
+
+static void *poolAlloc(struct pool *pool)
+{
+    void *item;
+
+    if (!pool->free_list) {
+        size_t size = (pool->item_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        unsigned char *slab = malloc(size * POOL_ITEMS_PER_SLAB);
+        int i;
+
+        if (!slab) {
+            fprintf(stderr, "Out of memory allocating tracked aircraft\n");
+            exit(1);
+        }
+
+        for (i = POOL_ITEMS_PER_SLAB - 1; i >= 0; --i) {
+            *(void **) (slab + i * size) = pool->free_list;
+            pool->free_list = slab + i * size;
+        }
+    }
+
+    item = pool->free_list;
+    pool->free_list = *(void **) item;
+    return item;
+}
+
+static void poolFree(struct pool *pool, void *item)
+{
+    *(void **) item = pool->free_list;
+    pool->free_list = item;
+}
+
+static void trackFreeAircraft(struct aircraft *a)
+{
+    modeACUnindexSquawk(a);
+    modeACUnindexModeC(a);
+    gridRemove(a);
+    if (a->fatsv)
+        poolFree(&fatsv_pool, a->fatsv);
+    poolFree(&aircraft_pool, a);
+}
+
 //
 // Return a new aircraft structure for the linked list of tracked
 // aircraft
 //
 static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
-    static struct aircraft zeroAircraft;
-    struct aircraft *a = (struct aircraft *) malloc(sizeof(*a));
+    struct aircraft *a = poolAlloc(&aircraft_pool);
     int i;
 
     // Default everything to zero/NULL
-    *a = zeroAircraft;
+    memset(a, 0, sizeof(*a));
 
     // Now initialise things that should not be 0/NULL to their defaults
     a->addr = mm->addr;
@@ -81,57 +354,27 @@ static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
     a->adsb_hrd = HEADING_MAGNETIC;
     a->adsb_tah = HEADING_GROUND_TRACK;
 
-    // prime FATSV defaults we only emit on change
-
-    // start off with the "last emitted" ACAS RA being blank (just the BDS 3,0
-    // or ES type code)
-    a->fatsv_emitted_bds_30[0] = 0x30;
-    a->fatsv_emitted_es_acas_ra[0] = 0xE2;
-    a->fatsv_emitted_adsb_version = -1;
-    a->fatsv_emitted_addrtype = ADDR_UNKNOWN;
-
-    // don't immediately emit, let some data build up
-    a->fatsv_last_emitted = a->fatsv_last_force_emit = messageNow();
-
-    // initialize data validity ages
-#define F(f,s,e) do { a->f##_valid.stale_interval = (s) * 1000; a->f##_valid.expire_interval = (e) * 1000; } while (0)
-    F(callsign,        60, 70);  // ADS-B or Comm-B
-    F(altitude_baro,   15, 70);  // ADS-B or Mode S
-    F(altitude_geom,   60, 70);  // ADS-B only
-    F(geom_delta,      60, 70);  // ADS-B only
-    F(gs,              60, 70);  // ADS-B or Comm-B
-    F(ias,             60, 70);  // ADS-B (rare) or Comm-B
-    F(tas,             60, 70);  // ADS-B (rare) or Comm-B
-    F(mach,            60, 70);  // Comm-B only
-    F(track,           60, 70);  // ADS-B or Comm-B
-    F(track_rate,      60, 70);  // Comm-B only
-    F(roll,            60, 70);  // Comm-B only
-    F(mag_heading,     60, 70);  // ADS-B (rare) or Comm-B
-    F(true_heading,    60, 70);  // ADS-B only (rare)
-    F(baro_rate,       60, 70);  // ADS-B or Comm-B
-    F(geom_rate,       60, 70);  // ADS-B or Comm-B
-    F(squawk,          15, 70);  // ADS-B or Mode S
-    F(airground,       15, 70);  // ADS-B or Mode S
-    F(nav_qnh,         60, 70);  // Comm-B only
-    F(nav_altitude_mcp, 60, 70);  // ADS-B or Comm-B
-    F(nav_altitude_fms, 60, 70);  // ADS-B or Comm-B
-    F(nav_altitude_src, 60, 70); // ADS-B or Comm-B
-    F(nav_heading,     60, 70);  // ADS-B or Comm-B
-    F(nav_modes,       60, 70);  // ADS-B or Comm-B
-    F(cpr_odd,         60, 70);  // ADS-B only
-    F(cpr_even,        60, 70);  // ADS-B only
-    F(position,        60, 70);  // ADS-B only
-    F(nic_a,           60, 70);  // ADS-B only
-    F(nic_c,           60, 70);  // ADS-B only
-    F(nic_baro,        60, 70);  // ADS-B only
-    F(nac_p,           60, 70);  // ADS-B only
-    F(nac_v,           60, 70);  // ADS-B only
-    F(sil,             60, 70);  // ADS-B only
-    F(gva,             60, 70);  // ADS-B only
-    F(sda,             60, 70);  // ADS-B only
-#undef F
+    // FATSV state is only needed if FATSV output is configured (faup1090)
+    if (Modes.fatsv_out.service) {
+        a->fatsv = poolAlloc(&fatsv_pool);
+        memset(a->fatsv, 0, sizeof(*a->fatsv));
+
+        // prime FATSV defaults we only emit on change
+
+        // start off with the "last emitted" ACAS RA being blank (just the BDS 3,0
+        // or ES type code)
+        a->fatsv->emitted_bds_30[0] = 0x30;
+        a->fatsv->emitted_es_acas_ra[0] = 0xE2;
+        a->fatsv->emitted_adsb_version = -1;
+        a->fatsv->emitted_addrtype = ADDR_UNKNOWN;
 
-    Modes.stats_current.unique_aircraft++;
+        // don't immediately emit, let some data build up
+        a->fatsv->last_emitted = a->fatsv->last_force_emit = messageNow();
+    }
+
+    // initialize data validity field indexes (for interval lookups)
+    for (i = 0; i < (int) VALIDITY_FIELDS; ++i)
+        ((data_validity *) ((char *) a + validity_intervals[i].offset))->field = i;
 
     return (a);
 }
@@ -142,30 +385,264 @@ static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
 // Return the aircraft with the specified address, or NULL if no aircraft
 // exists with this address.
 //
+// Lookups go through an open-addressed hash index keyed on the address
+// (including the MODES_NON_ICAO_ADDRESS flag). Modes.aircrafts remains the
+// authoritative list and the only thing that is iterated, so output order
+// doesn't depend on the index layout.
+//
+
+#define AIRCRAFT_INDEX_MIN_SIZE 1024
+
+static struct aircraft **aircraft_index;
+static unsigned aircraft_index_size;   // always a power of two
+static unsigned aircraft_index_count;
+
+static inline unsigned aircraftIndexHash(uint32_t addr)
+{
+    // Fibonacci hashing; low address bits are not well distributed
+    // for non-ICAO / TIS-B addresses
+    return (addr * 2654435761U) >> 8;
+}
+
+static void aircraftIndexResize(unsigned size)
+{
+    struct aircraft **index;
+    struct aircraft *a;
+
+    if (!(index = calloc(size, sizeof(*index)))) {
+        fprintf(stderr, "Out of memory allocating aircraft index\n");
+        exit(1);
+    }
+
+    for (a = Modes.aircrafts; a; a = a->next) {
+        unsigned h = aircraftIndexHash(a->addr) & (size - 1);
+        while (index[h])
+            h = (h + 1) & (size - 1);
+        index[h] = a;
+    }
+
+    free(aircraft_index);
+    aircraft_index = index;
+    aircraft_index_size = size;
+}
+
+// Add a newly created aircraft to the index. It must already be linked
+// into Modes.aircrafts (a resize rebuilds the index from the list).
+static void aircraftIndexInsert(struct aircraft *a)
+{
+    unsigned h;
+
+    if ((aircraft_index_count + 1) * 2 > aircraft_index_size) {
+        aircraftIndexResize(aircraft_index_size ? aircraft_index_size * 2 : AIRCRAFT_INDEX_MIN_SIZE);
+        ++aircraft_index_count;
+        return;
+    }
+
+    h = aircraftIndexHash(a->addr) & (aircraft_index_size - 1);
+    while (aircraft_index[h])
+        h = (h + 1) & (aircraft_index_size - 1);
+    aircraft_index[h] = a;
+    ++aircraft_index_count;
+}
+
+// Remove an aircraft from the index using backward-shift deletion, so
+// the table never accumulates tombstones as aircraft come and go.
+static void aircraftIndexRemove(struct aircraft *a)
+{
+    unsigned mask = aircraft_index_size - 1;
+    unsigned i, j;
+
+    i = aircraftIndexHash(a->addr) & mask;
+    while (aircraft_index[i] != a) {
+        assert(aircraft_index[i] != NULL);
+        i = (i + 1) & mask;
+    }
+
+    for (j = (i + 1) & mask; aircraft_index[j]; j = (j + 1) & mask) {
+        unsigned home = aircraftIndexHash(aircraft_index[j]->addr) & mask;
+        // move j into the hole at i unless its home slot lies
+        // cyclically within (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            aircraft_index[i] = aircraft_index[j];
+            i = j;
+        }
+    }
+
+    aircraft_index[i] = NULL;
+    --aircraft_index_count;
+}
+
 static struct aircraft *trackFindAircraft(uint32_t addr) {
-    struct aircraft *a = Modes.aircrafts;
+    struct aircraft *a;
+    unsigned h;
 
-    while(a) {
+    if (!aircraft_index_count)
+        return (NULL);
+
+    h = aircraftIndexHash(addr) & (aircraft_index_size - 1);
+    while ((a = aircraft_index[h])) {
         if (a->addr == addr) return (a);
-        a = a->next;
+        h = (h + 1) & (aircraft_index_size - 1);
     }
     return (NULL);
 }
 
+//
+//=========================================================================
+//
+// Expiry of aircraft and of their data is driven by a hashed timer wheel.
+// Each aircraft sits in the slot for the next time it needs attention:
+// the earlier of when it would be reaped as stale and when its first valid
+// field expires. Periodic work is then proportional to what is actually
+// coming due, not to the number of aircraft. Deadlines only move later as
+// messages arrive, so they are left where they are and simply recomputed
+// when the slot comes round; the exception is newly accepted data that
+// expires before the current deadline, which reschedules the aircraft.
+//
+// All deadlines are within TRACK_AIRCRAFT_TTL, so a single level of
+// 256ms slots that spans more than that is sufficient. Anything found
+// in a slot before its deadline (a later revolution) is just reinserted.
+//
+
+#define EXPIRY_TICK_SHIFT 8
+#define EXPIRY_WHEEL_SIZE 2048
+
+static struct aircraft *expiry_wheel[EXPIRY_WHEEL_SIZE];
+static uint64_t expiry_tick;             // next tick to be processed
+
+// Earliest expiry (epoch-relative) of data accepted while processing the
+// current message
+static uint32_t pending_expiry;
+
+static void trackScheduleExpiry(struct aircraft *a, uint64_t deadline)
+{
+    uint64_t tick = deadline >> EXPIRY_TICK_SHIFT;
+    struct aircraft **slot;
+
+    if (a->expiry_pprev) {
+        if (a->expiry_next)
+            a->expiry_next->expiry_pprev = a->expiry_pprev;
+        *a->expiry_pprev = a->expiry_next;
+    }
+
+    if (tick < expiry_tick)
+        tick = expiry_tick;
+
+    slot = &expiry_wheel[tick & (EXPIRY_WHEEL_SIZE - 1)];
+    a->expiry_deadline = deadline;
+    a->expiry_next = *slot;
+    a->expiry_pprev = slot;
+    if (*slot)
+        (*slot)->expiry_pprev = &a->expiry_next;
+    *slot = a;
+}
+
+//
+//=========================================================================
+//
+// Addresses that we have only seen in unreliable messages (corrected CRCs,
+// nonzero IID, Address/Parity messages that happened to pass the ICAO
+// filter) are mostly noise. Until such an address either sends a reliable
+// message or reaches TRACK_RELIABLE_ANY_MESSAGES, none of its messages
+// update any tracked state, so it is kept in a small fixed-size candidate
+// table holding only what is needed to create the aircraft later. A full
+// struct aircraft is only allocated on promotion.
+//
+
+#define CANDIDATE_SETS 512    // power of two
+#define CANDIDATE_WAYS 4
+
+struct candidate {
+    uint32_t addr;            // 0 = free entry
+    addrtype_t addrtype;      // address type of the first message
+    unsigned messages;        // number of messages seen (all discarded)
+    unsigned signalCount;     // number of valid entries in signalLevel
+    uint64_t seen;            // time of the last message
+    double signalLevel[TRACK_RELIABLE_ANY_MESSAGES - 1];
+};
+
+static struct candidate candidates[CANDIDATE_SETS][CANDIDATE_WAYS];
+
+// Returned by trackUpdateFromMessage for messages from an address that is
+// still only a candidate, so that output filters treat the message the same
+// as one from an unreliable aircraft. Never modified.
+static struct aircraft candidateAircraft;
+
+// Account for a candidate that is being dropped without being promoted,
+// in the same way as an unreliable aircraft that was reaped.
+static void trackDropCandidate(struct candidate *c)
+{
+    if (c->messages == 1)
+        Modes.stats_current.single_message_aircraft++;
+    Modes.stats_current.unreliable_aircraft++;
+    c->addr = 0;
+}
+
+// Find the candidate entry for an address, or NULL
+static struct candidate *trackFindCandidate(uint32_t addr)
+{
+    struct candidate *set = candidates[aircraftIndexHash(addr) & (CANDIDATE_SETS - 1)];
+    int i;
+
+    for (i = 0; i < CANDIDATE_WAYS; ++i) {
+        if (set[i].addr == addr)
+            return &set[i];
+    }
+    return NULL;
+}
+
+// Get a free entry for a new candidate, evicting the least recently seen
+// candidate in the set if needed.
+static struct candidate *trackNewCandidate(uint32_t addr)
+{
+    struct candidate *set = candidates[aircraftIndexHash(addr) & (CANDIDATE_SETS - 1)];
+    struct candidate *oldest = &set[0];
+    int i;
+
+    for (i = 0; i < CANDIDATE_WAYS; ++i) {
+        if (!set[i].addr)
+            return &set[i];
+        if (set[i].seen < oldest->seen)
+            oldest = &set[i];
+    }
+
+    trackDropCandidate(oldest);
+    return oldest;
+}
+
+// Remove candidates that have not been heard from for
+// TRACK_AIRCRAFT_UNRELIABLE_TTL
+static void trackExpireCandidates(uint64_t now)
+{
+    int i, j;
+
+    for (i = 0; i < CANDIDATE_SETS; ++i) {
+        for (j = 0; j < CANDIDATE_WAYS; ++j) {
+            struct candidate *c = &candidates[i][j];
+            if (c->addr && (now - c->seen) > TRACK_AIRCRAFT_UNRELIABLE_TTL)
+                trackDropCandidate(c);
+        }
+    }
+}
+
 // Should we accept some new data from the given source?
 // If so, update the validity and return 1
 static int accept_data(data_validity *d, datasource_t source)
 {
-    if (messageNow() < d->updated)
+    uint32_t now = trackRelativeTime(messageNow());
+
+    if (now < d->updated)
         return 0;
 
-    if (source < d->source && messageNow() < d->stale)
+    if (source < d->source && now < d->stale)
         return 0;
 
     d->source = source;
-    d->updated = messageNow();
-    d->stale = messageNow() + (d->stale_interval ? d->stale_interval : 60000);
-    d->expires = messageNow() + (d->expire_interval ? d->expire_interval : 70000);
+    d->updated = now;
+    d->stale = now + validity_intervals[d->field].stale_interval;
+    d->expires = now + validity_intervals[d->field].expire_interval;
+    if (d->expires < pending_expiry)
+        pending_expiry = d->expires;
     return 1;
 }
 
@@ -188,9 +665,11 @@ static void combine_validity(data_validity *to, const data_validity *from1, cons
 }
 
 static int compare_validity(const data_validity *lhs, const data_validity *rhs) {
-    if (messageNow() < lhs->stale && lhs->source > rhs->source)
+    uint32_t now = trackRelativeTime(messageNow());
+
+    if (now < lhs->stale && lhs->source > rhs->source)
         return 1;
-    else if (messageNow() < rhs->stale && lhs->source < rhs->source)
+    else if (now < rhs->stale && lhs->source < rhs->source)
         return -1;
     else if (lhs->updated > rhs->updated)
         return 1;
@@ -229,27 +708,274 @@ static double greatcircle(double lat0, double lon0, double lat1, double lon1)
     return 6371e3 * acos(sin(lat0) * sin(lat1) + cos(lat0) * cos(lat1) * cos(dlon));
 }
 
+// Cheaper distance for nearby points, using a local equirectangular
+// projection around their mean latitude. Only used for points up to 10
+// degrees apart in latitude and longitude and no nearer than 5 degrees to
+// a pole; returns -1 for anything else.
+//
+// The error relative to greatcircle() grows with the square of the
+// separation: for points s degrees apart it stays under 1e-5 + 4e-5 * s^2
+// (0.4% at 10 degrees). *margin is set to a relative error bound with
+// some headroom over that, for callers that need the same answer
+// greatcircle() would give.
+static double localDistance(double lat0, double lon0, double lat1, double lon1, double *margin)
+{
+    double dlat, dlon, s;
+
+    if (fabs(lat0) > 85.0 || fabs(lat1) > 85.0)
+        return -1;
+
+    dlat = lat1 - lat0;
+    dlon = lon1 - lon0;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+
+    s = fmax(fabs(dlat), fabs(dlon));
+    if (s > 10.0)
+        return -1;
+
+    *margin = 1e-5 + 1e-4 * s * s;
+
+    dlon *= cos((lat0 + lat1) * M_PI / 360.0);
+    return 6371e3 * M_PI / 180.0 * sqrt(dlat * dlat + dlon * dlon);
+}
+
+// Return true if two points are no more than 'limit' meters apart.
+// Only falls back to greatcircle() when the cheap estimate is too close
+// to the limit to decide, so the outcome is the same as comparing
+// greatcircle() against the limit directly.
+static int withinDistance(double lat0, double lon0, double lat1, double lon1, double limit)
+{
+    double margin;
+    double distance = localDistance(lat0, lon0, lat1, lon1, &margin);
+
+    if (distance >= 0) {
+        if (distance < limit * (1 - margin))
+            return 1;
+        if (distance > limit * (1 + margin))
+            return 0;
+    }
+
+    return greatcircle(lat0, lon0, lat1, lon1) <= limit;
+}
+
+static int rangeBucket(double range)
+{
+    int bucket = round(range / Modes.maxRange * RANGE_BUCKET_COUNT);
+
+    if (bucket < 0)
+        bucket = 0;
+    else if (bucket >= RANGE_BUCKET_COUNT)
+        bucket = RANGE_BUCKET_COUNT-1;
+
+    return bucket;
+}
+
 static void update_range_histogram(double lat, double lon)
 {
     if (Modes.stats_range_histo && (Modes.bUserFlags & MODES_USER_LATLON_VALID)) {
-        double range = greatcircle(Modes.fUserLat, Modes.fUserLon, lat, lon);
-        int bucket = round(range / Modes.maxRange * RANGE_BUCKET_COUNT);
-
+        double margin;
+        double range = localDistance(Modes.fUserLat, Modes.fUserLon, lat, lon, &margin);
+        int bucket = -1;
+
+        // the estimate will do if its whole error margin falls in one bucket
+        if (range >= 0) {
+            bucket = rangeBucket(range * (1 - margin));
+            if (bucket != rangeBucket(range * (1 + margin)))
+                bucket = -1;
+        }
         if (bucket < 0)
-            bucket = 0;
-        else if (bucket >= RANGE_BUCKET_COUNT)
-            bucket = RANGE_BUCKET_COUNT-1;
+            bucket = rangeBucket(greatcircle(Modes.fUserLat, Modes.fUserLon, lat, lon));
 
         ++Modes.stats_current.range_histogram[bucket];
     }
 }
 
+//
+// Spatial queries over the grid
+//
+
+typedef void (*grid_visit_fn)(struct aircraft *a, void *ctx);
+
+// Call fn for each aircraft with a valid position in the grid cells
+// covering the given box. west > east means the box crosses the
+// antimeridian. Cells are coarser than the box, so callers still
+// need to check the actual position.
+static void gridScan(double south, double west, double north, double east, grid_visit_fn fn, void *ctx)
+{
+    int lat0 = gridLatCell(south), lat1 = gridLatCell(north);
+    int lon0 = gridLonCell(west), lon1 = gridLonCell(east);
+    double span = east - west;
+    unsigned lon_cells;
+    struct aircraft *a;
+
+    if (span < 0)
+        span += 360.0;
+    lon_cells = (span >= 359.0) ? GRID_CELLS_LON : (unsigned) ((lon1 - lon0 + GRID_CELLS_LON) % GRID_CELLS_LON) + 1;
+    if (lon_cells == GRID_CELLS_LON)
+        lon0 = 0;
+
+    if (lat1 < lat0)
+        return;
+
+    // for large areas, walking the aircraft list is cheaper than the cells
+    if ((unsigned) (lat1 - lat0 + 1) * lon_cells > GRID_BUCKETS) {
+        for (a = Modes.aircrafts; a; a = a->next) {
+            if (a->grid_pprev && trackDataValid(&a->position_valid))
+                fn(a, ctx);
+        }
+        return;
+    }
+
+    for (int lat = lat0; lat <= lat1; ++lat) {
+        for (unsigned n = 0; n < lon_cells; ++n) {
+            uint32_t cell = lat * GRID_CELLS_LON + (lon0 + n) % GRID_CELLS_LON;
+
+            for (a = grid_buckets[gridBucket(cell)]; a; a = a->grid_next) {
+                if (a->grid_cell == cell && trackDataValid(&a->position_valid))
+                    fn(a, ctx);
+            }
+        }
+    }
+}
+
+struct grid_query {
+    double lat, lon;            // query point (radius / nearest)
+    double south, west, north, east;
+    double radius;
+    struct aircraft **out;      // results (box / radius)
+    struct track_neighbour *nearest; // results, closest first (nearest)
+    unsigned max;
+    unsigned count;
+};
+
+static void gridCollectBox(struct aircraft *a, void *ctx)
+{
+    struct grid_query *q = ctx;
+
+    if (q->count < q->max && trackInBox(a->lat, a->lon, q->south, q->west, q->north, q->east))
+        q->out[q->count++] = a;
+}
+
+static void gridCollectRadius(struct aircraft *a, void *ctx)
+{
+    struct grid_query *q = ctx;
+
+    if (q->count < q->max && withinDistance(q->lat, q->lon, a->lat, a->lon, q->radius))
+        q->out[q->count++] = a;
+}
+
+// Fill in the bounding box of a circle of 'radius' meters around lat/lon
+static void gridRadiusBox(struct grid_query *q)
+{
+    double d = q->radius / 6371e3;
+    double dlat = d * 180.0 / M_PI;
+    double coslat = cos(q->lat * M_PI / 180.0);
+
+    q->south = q->lat - dlat;
+    q->north = q->lat + dlat;
+
+    if (q->south <= -90.0 || q->north >= 90.0 || sin(d) >= coslat) {
+        // reaches a pole, so covers every longitude
+        q->west = -180.0;
+        q->east = 180.0;
+    } else {
+        // widest point is where the circle touches a meridian
+        double dlon = asin(sin(d) / coslat) * 180.0 / M_PI;
+        q->west = q->lon - dlon;
+        q->east = q->lon + dlon;
+        if (q->west < -180.0)
+            q->west += 360.0;
+        if (q->east > 180.0)
+            q->east -= 360.0;
+    }
+}
+
+// Find aircraft with a valid position inside a lat/lon box. If west > east
+// the box crosses the antimeridian. Stores up to 'max' aircraft in 'out'
+// and returns how many were stored.
+unsigned trackAircraftInBox(double south, double west, double north, double east, struct aircraft **out, unsigned max)
+{
+    struct grid_query q = { .south = south, .west = west, .north = north, .east = east, .out = out, .max = max };
+
+    gridScan(south, west, north, east, gridCollectBox, &q);
+    return q.count;
+}
+
+// Find aircraft with a valid position within 'radius' meters of lat/lon.
+// Stores up to 'max' aircraft in 'out' and returns how many were stored.
+unsigned trackAircraftInRadius(double lat, double lon, double radius, struct aircraft **out, unsigned max)
+{
+    struct grid_query q = { .lat = lat, .lon = lon, .radius = radius, .out = out, .max = max };
+
+    gridRadiusBox(&q);
+    gridScan(q.south, q.west, q.north, q.east, gridCollectRadius, &q);
+    return q.count;
+}
+
+// Does a neighbour at 'distance' sort before 'n'? Ties are broken by
+// address so that results don't depend on the order of the scan.
+static int gridNeighbourBefore(struct aircraft *a, double distance, const struct track_neighbour *n)
+{
+    if (distance != n->distance)
+        return distance < n->distance;
+    return a->addr < n->a->addr;
+}
+
+// Keep the closest q->max aircraft in q->nearest, sorted by distance
+static void gridCollectNeighbour(struct aircraft *a, void *ctx)
+{
+    struct grid_query *q = ctx;
+    double distance = greatcircle(q->lat, q->lon, a->lat, a->lon);
+    unsigned i;
+
+    if (distance > q->radius)
+        return;
+    if (q->count == q->max && !gridNeighbourBefore(a, distance, &q->nearest[q->max - 1]))
+        return;
+
+    i = (q->count < q->max) ? q->count++ : q->max - 1;
+    for (; i > 0 && gridNeighbourBefore(a, distance, &q->nearest[i - 1]); --i)
+        q->nearest[i] = q->nearest[i - 1];
+
+    q->nearest[i].a = a;
+    q->nearest[i].distance = distance;
+}
+
+// Find the 'n' aircraft with a valid position nearest to lat/lon, closest
+// first. Stores up to 'n' aircraft and their distances in 'out' and returns
+// how many were stored. Meant for small n: each aircraft found is inserted
+// into the sorted results.
+//
+// Searches a growing radius until it holds at least n aircraft; anything
+// outside that radius must then be further away than the n-th nearest.
+unsigned trackNearestAircraft(double lat, double lon, struct track_neighbour *out, unsigned n)
+{
+    struct grid_query q = { .lat = lat, .lon = lon, .radius = 100e3, .nearest = out, .max = n };
+
+    if (!n)
+        return 0;
+
+    for (;;) {
+        q.count = 0;
+        gridRadiusBox(&q);
+        gridScan(q.south, q.west, q.north, q.east, gridCollectNeighbour, &q);
+
+        if (q.count >= n || q.radius >= M_PI * 6371e3)
+            break;
+        q.radius *= 4;
+    }
+
+    return q.count;
+}
+
 // return true if it's OK for the aircraft to have travelled from its last known position
 // to a new position at (lat,lon,surface) at a time of now.
 static int speed_check(struct aircraft *a, double lat, double lon, int surface)
 {
     uint64_t elapsed;
-    double distance;
     double range;
     int speed;
     int inrange;
@@ -287,14 +1013,11 @@ static int speed_check(struct aircraft *a, double lat, double lon, int surface)
     // plus distance covered at the given speed for the elapsed time + 1 second.
     range = (surface ? 0.1e3 : 0.5e3) + ((elapsed + 1000.0) / 1000.0) * (speed * 1852.0 / 3600.0);
 
-    // find actual distance
-    distance = greatcircle(a->lat, a->lon, lat, lon);
-
-    inrange = (distance <= range);
+    inrange = withinDistance(a->lat, a->lon, lat, lon, range);
 #ifdef DEBUG_CPR_CHECKS
     if (!inrange) {
         fprintf(stderr, "Speed check failed: %06x: %.3f,%.3f -> %.3f,%.3f in %.1f seconds, max speed %d kt, range %.1fkm, actual %.1fkm\n",
-                a->addr, a->lat, a->lon, lat, lon, elapsed/1000.0, speed, range/1000.0, distance/1000.0);
+                a->addr, a->lat, a->lon, lat, lon, elapsed/1000.0, speed, range/1000.0, greatcircle(a->lat, a->lon, lat, lon)/1000.0);
     }
 #endif
 
@@ -366,11 +1089,10 @@ static int doGlobalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check max range
     if (Modes.maxRange > 0 && (Modes.bUserFlags & MODES_USER_LATLON_VALID)) {
-        double range = greatcircle(Modes.fUserLat, Modes.fUserLon, *lat, *lon);
-        if (range > Modes.maxRange) {
+        if (!withinDistance(Modes.fUserLat, Modes.fUserLon, *lat, *lon, Modes.maxRange)) {
 #ifdef DEBUG_CPR_CHECKS
             fprintf(stderr, "Global range check failed: %06x: %.3f,%.3f, max range %.1fkm, actual %.1fkm\n",
-                    a->addr, *lat, *lon, Modes.maxRange/1000.0, range/1000.0);
+                    a->addr, *lat, *lon, Modes.maxRange/1000.0, greatcircle(Modes.fUserLat, Modes.fUserLon, *lat, *lon)/1000.0);
 #endif
 
             Modes.stats_current.cpr_global_range_checks++;
@@ -457,8 +1179,7 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check range limit
     if (range_limit > 0) {
-        double range = greatcircle(reflat, reflon, *lat, *lon);
-        if (range > range_limit) {
+        if (!withinDistance(reflat, reflon, *lat, *lon, range_limit)) {
             Modes.stats_current.cpr_local_range_checks++;
             return (-1);
         }
@@ -575,6 +1296,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm)
         a->lon = new_lon;
         a->pos_nic = new_nic;
         a->pos_rc = new_rc;
+        gridUpdate(a);
 
         update_range_histogram(new_lat, new_lon);
     }
@@ -896,10 +1618,16 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
     struct aircraft *a;
     unsigned int cpr_new = 0;
 
+    decodeModesMessageFields(mm);
 
     if (mm->msgtype == 32) {
         // Mode A/C, just count it (we ignore SPI)
-        modeAC_count[modeAToIndex(mm->squawk)]++;
+        unsigned i = modeAToIndex(mm->squawk);
+        modeAC_count[i]++;
+        if (!modeAC_listed[i]) {
+            modeAC_listed[i] = 1;
+            modeAC_active[modeAC_active_count++] = i;
+        }
         return NULL;
     }
 
@@ -909,13 +1637,56 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
     }
 
     _messageNow = mm->sysTimestampMsg;
+    if (messageNow() > trackEpoch + TRACK_EPOCH_REBASE)
+        trackRebaseEpoch(messageNow());
+    pending_expiry = UINT32_MAX;
 
     // Lookup our aircraft or create a new one
     a = trackFindAircraft(mm->addr);
     if (!a) {                              // If it's a currently unknown aircraft....
+        struct candidate *c = trackFindCandidate(mm->addr);
+
+        if (!c)
+            Modes.stats_current.unique_aircraft++;
+
+        if (!mm->reliable && (!c || c->messages + 1 < TRACK_RELIABLE_ANY_MESSAGES)) {
+            // Not enough to make a real aircraft yet, just remember
+            // the address as a candidate
+            if (!c) {
+                c = trackNewCandidate(mm->addr);
+                c->addr = mm->addr;
+                c->addrtype = mm->addrtype;
+                c->messages = 0;
+                c->signalCount = 0;
+            }
+
+            if (mm->signalLevel > 0)
+                c->signalLevel[c->signalCount++] = mm->signalLevel;
+            c->seen = messageNow();
+            c->messages++;
+            return &candidateAircraft;
+        }
+
         a = trackCreateAircraft(mm);       // ., create a new record for it,
         a->next = Modes.aircrafts;         // .. and put it at the head of the list
+        a->pprev = &Modes.aircrafts;
+        if (a->next)
+            a->next->pprev = &a->next;
         Modes.aircrafts = a;
+        aircraftIndexInsert(a);
+        trackScheduleExpiry(a, messageNow() + TRACK_AIRCRAFT_UNRELIABLE_TTL + 1);
+
+        if (c) {
+            // Promoted from a candidate: carry over what it has seen so far
+            unsigned i;
+
+            a->addrtype = c->addrtype;
+            a->messages = a->discarded = c->messages;
+            for (i = 0; i < c->signalCount; ++i)
+                a->signalLevel[i] = c->signalLevel[i];
+            a->signalNext = c->signalCount;
+            c->addr = 0;
+        }
     }
 
     if (mm->signalLevel > 0) {
@@ -1009,12 +1780,13 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
 
     if (mm->altitude_baro_valid && accept_data(&a->altitude_baro_valid, mm->source)) {
         int alt = altitude_to_feet(mm->altitude_baro, mm->altitude_baro_unit);
-        if (a->modeC_hit) {
-            int new_modeC = (a->altitude_baro + 49) / 100;
-            int old_modeC = (alt + 49) / 100;
-            if (new_modeC != old_modeC) {
-                a->modeC_hit = 0;
-            }
+        int new_modeC = (alt + 49) / 100;
+        int old_modeC = (a->altitude_baro + 49) / 100;
+        if (new_modeC != old_modeC) {
+            a->modeC_hit = 0;
+        }
+        if (new_modeC != old_modeC || !a->modeC_pprev) {
+            modeACIndexModeC(a, new_modeC);
         }
 
         a->altitude_baro = alt;
@@ -1024,7 +1796,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
         if (mm->squawk != a->squawk) {
             a->modeA_hit = 0;
         }
-        a->squawk = mm->squawk;
+        if (mm->squawk != a->squawk || !a->squawk_pprev) {
+            a->squawk = mm->squawk;
+            modeACIndexSquawk(a);
+        }
 
 #if 0   // Disabled for now as it obscures the origin of the data
         // Handle 7x00 without a corresponding emergency status
@@ -1227,6 +2002,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
         updatePosition(a, mm);
     }
 
+    // Pull the expiry deadline in if we accepted data that expires sooner
+    if (pending_expiry != UINT32_MAX && trackAbsoluteTime(pending_expiry) < a->expiry_deadline)
+        trackScheduleExpiry(a, trackAbsoluteTime(pending_expiry));
+
     return (a);
 }
 
@@ -1235,64 +2014,71 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm)
 //
 
 // Periodically match up mode A/C results with mode S results
+//
+// Only codes on the active list are examined. For each code heard often
+// enough in the last period, the aircraft with a matching squawk, or a
+// Mode C altitude within 100ft, are found via the indexes. A code matched
+// more than once (by several aircraft, or by both the squawk and the
+// altitude of one aircraft) is marked as ambiguous.
 static void trackMatchAC(uint64_t now)
 {
+    unsigned n, kept;
+
     // clear match flags
-    for (unsigned i = 0; i < 4096; ++i) {
-        modeAC_match[i] = 0;
+    for (n = 0; n < modeAC_active_count; ++n) {
+        modeAC_match[modeAC_active[n]] = 0;
     }
 
-    // scan aircraft list, look for matches
-    for (struct aircraft *a = Modes.aircrafts; a; a = a->next) {
-        if ((now - a->seen) > 5000) {
+    // look for aircraft matching each live code
+    for (n = 0; n < modeAC_active_count; ++n) {
+        unsigned i = modeAC_active[n];
+        struct aircraft *a;
+        int modeC, delta;
+
+        if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES)
             continue;
-        }
 
         // match on Mode A
-        if (trackDataValid(&a->squawk_valid)) {
-            unsigned i = modeAToIndex(a->squawk);
-            if ((modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                a->modeA_hit = 1;
-                modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-            }
+        for (a = modeAC_bySquawk[i]; a; a = a->squawk_next) {
+            if ((now - a->seen) > 5000 || !trackDataValid(&a->squawk_valid))
+                continue;
+
+            a->modeA_hit = 1;
+            modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
         }
 
         // match on Mode C (+/- 100ft)
-        if (trackDataValid(&a->altitude_baro_valid)) {
-            int modeC = (a->altitude_baro + 49) / 100;
+        modeC = modeAToModeC(indexToModeA(i));
+        if (modeC == INVALID_ALTITUDE)
+            continue;
 
-            unsigned modeA = modeCToModeA(modeC);
-            unsigned i = modeAToIndex(modeA);
-            if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                a->modeC_hit = 1;
-                modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-            }
+        for (delta = -1; delta <= 1; ++delta) {
+            for (a = modeAC_byModeC[modeC + delta + MODEC_INDEX_OFFSET]; a; a = a->modeC_next) {
+                if ((now - a->seen) > 5000 || !trackDataValid(&a->altitude_baro_valid))
+                    continue;
 
-            modeA = modeCToModeA(modeC + 1);
-            i = modeAToIndex(modeA);
-            if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                a->modeC_hit = 1;
-                modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-            }
-
-            modeA = modeCToModeA(modeC - 1);
-            i = modeAToIndex(modeA);
-            if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
                 a->modeC_hit = 1;
                 modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
             }
         }
     }
 
-    // reset counts for next time
-    for (unsigned i = 0; i < 4096; ++i) {
-        if (!modeAC_count[i])
+    // reset counts for next time, dropping codes that have aged out
+    kept = 0;
+    for (n = 0; n < modeAC_active_count; ++n) {
+        unsigned i = modeAC_active[n];
+
+        if (!modeAC_count[i]) {
+            modeAC_listed[i] = 0;
             continue;
+        }
 
         if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES) {
             if (++modeAC_age[i] > 15) {
                 // not heard from for a while, clear it out
                 modeAC_lastcount[i] = modeAC_count[i] = modeAC_age[i] = 0;
+                modeAC_listed[i] = 0;
+                continue;
             }
         } else {
             // this one is live
@@ -1307,79 +2093,126 @@ static void trackMatchAC(uint64_t now)
         }
 
         modeAC_lastcount[i] = modeAC_count[i];
+        modeAC_active[kept++] = i;
     }
+    modeAC_active_count = kept;
 }
 
 //
 //=========================================================================
 //
+// Expiry processing for one aircraft whose deadline has come due.
 // If we don't receive new nessages within TRACK_AIRCRAFT_TTL
-// we remove the aircraft from the list.
+// we remove the aircraft from the list; otherwise expire any data
+// that is past its expiry time, and schedule the next deadline.
 //
-static void trackRemoveStaleAircraft(uint64_t now)
+static void trackExpireAircraft(struct aircraft *a, uint64_t now)
+{
+    uint32_t relnow = trackRelativeTime(now);
+    uint32_t next;
+
+    if ((now - a->seen) > TRACK_AIRCRAFT_TTL || (!a->reliable && (now - a->seen) > TRACK_AIRCRAFT_UNRELIABLE_TTL)) {
+        // Count aircraft where we saw only one message before reaping them.
+        // These are likely to be due to messages with bad addresses.
+        if (a->messages == 1)
+            Modes.stats_current.single_message_aircraft++;
+        if (!a->reliable)
+            Modes.stats_current.unreliable_aircraft++;
+
+        aircraftIndexRemove(a);
+
+        // Remove the element from the linked list
+        if (a->next)
+            a->next->pprev = a->pprev;
+        *a->pprev = a->next;
+
+        trackFreeAircraft(a);
+        return;
+    }
+
+    next = trackRelativeTime(a->seen + (a->reliable ? TRACK_AIRCRAFT_TTL : TRACK_AIRCRAFT_UNRELIABLE_TTL) + 1);
+
+#define EXPIRE(_f) do {                                                 \
+        if (a->_f##_valid.source != SOURCE_INVALID) {                   \
+            if (relnow >= a->_f##_valid.expires)                        \
+                a->_f##_valid.source = SOURCE_INVALID;                  \
+            else if (a->_f##_valid.expires < next)                      \
+                next = a->_f##_valid.expires;                           \
+        }                                                               \
+    } while (0)
+    EXPIRE(callsign);
+    EXPIRE(altitude_baro);
+    EXPIRE(altitude_geom);
+    EXPIRE(geom_delta);
+    EXPIRE(gs);
+    EXPIRE(ias);
+    EXPIRE(tas);
+    EXPIRE(mach);
+    EXPIRE(track);
+    EXPIRE(track_rate);
+    EXPIRE(roll);
+    EXPIRE(mag_heading);
+    EXPIRE(true_heading);
+    EXPIRE(baro_rate);
+    EXPIRE(geom_rate);
+    EXPIRE(squawk);
+    EXPIRE(airground);
+    EXPIRE(nav_qnh);
+    EXPIRE(nav_altitude_mcp);
+    EXPIRE(nav_altitude_fms);
+    EXPIRE(nav_altitude_src);
+    EXPIRE(nav_heading);
+    EXPIRE(nav_modes);
+    EXPIRE(cpr_odd);
+    EXPIRE(cpr_even);
+    EXPIRE(position);
+    EXPIRE(nic_a);
+    EXPIRE(nic_c);
+    EXPIRE(nic_baro);
+    EXPIRE(nac_p);
+    EXPIRE(sil);
+    EXPIRE(gva);
+    EXPIRE(sda);
+#undef EXPIRE
+
+    trackScheduleExpiry(a, trackAbsoluteTime(next));
+}
+
+// Process all expiry wheel slots up to the current time
+static void trackRunExpiry(uint64_t now)
 {
-    struct aircraft *a = Modes.aircrafts;
-    struct aircraft *prev = NULL;
-
-    while(a) {
-        if ((now - a->seen) > TRACK_AIRCRAFT_TTL || (!a->reliable && (now - a->seen) > TRACK_AIRCRAFT_UNRELIABLE_TTL)) {
-            // Count aircraft where we saw only one message before reaping them.
-            // These are likely to be due to messages with bad addresses.
-            if (a->messages == 1)
-                Modes.stats_current.single_message_aircraft++;
-            if (!a->reliable)
-                Modes.stats_current.unreliable_aircraft++;
-
-            // Remove the element from the linked list, with care
-            // if we are removing the first element
-            if (!prev) {
-                Modes.aircrafts = a->next; free(a); a = Modes.aircrafts;
+    uint64_t target = now >> EXPIRY_TICK_SHIFT;
+    uint64_t tick = expiry_tick;
+
+    if (target < tick)
+        return;
+
+    // anything rescheduled from here on goes into a future slot
+    expiry_tick = target + 1;
+
+    if (target - tick >= EXPIRY_WHEEL_SIZE)
+        tick = target - EXPIRY_WHEEL_SIZE + 1;
+
+    for (; tick <= target; ++tick) {
+        struct aircraft *a = expiry_wheel[tick & (EXPIRY_WHEEL_SIZE - 1)];
+        expiry_wheel[tick & (EXPIRY_WHEEL_SIZE - 1)] = NULL;
+
+        while (a) {
+            struct aircraft *next = a->expiry_next;
+            a->expiry_pprev = NULL;
+
+            if (a->expiry_deadline > now) {
+                // not due yet (a later revolution of the wheel)
+                trackScheduleExpiry(a, a->expiry_deadline);
             } else {
-                prev->next = a->next; free(a); a = prev->next;
+                trackExpireAircraft(a, now);
             }
-        } else {
 
-#define EXPIRE(_f) do { if (a->_f##_valid.source != SOURCE_INVALID && now >= a->_f##_valid.expires) { a->_f##_valid.source = SOURCE_INVALID; } } while (0)
-            EXPIRE(callsign);
-            EXPIRE(altitude_baro);
-            EXPIRE(altitude_geom);
-            EXPIRE(geom_delta);
-            EXPIRE(gs);
-            EXPIRE(ias);
-            EXPIRE(tas);
-            EXPIRE(mach);
-            EXPIRE(track);
-            EXPIRE(track_rate);
-            EXPIRE(roll);
-            EXPIRE(mag_heading);
-            EXPIRE(true_heading);
-            EXPIRE(baro_rate);
-            EXPIRE(geom_rate);
-            EXPIRE(squawk);
-            EXPIRE(airground);
-            EXPIRE(nav_qnh);
-            EXPIRE(nav_altitude_mcp);
-            EXPIRE(nav_altitude_fms);
-            EXPIRE(nav_altitude_src);
-            EXPIRE(nav_heading);
-            EXPIRE(nav_modes);
-            EXPIRE(cpr_odd);
-            EXPIRE(cpr_even);
-            EXPIRE(position);
-            EXPIRE(nic_a);
-            EXPIRE(nic_c);
-            EXPIRE(nic_baro);
-            EXPIRE(nac_p);
-            EXPIRE(sil);
-            EXPIRE(gva);
-            EXPIRE(sda);
-#undef EXPIRE
-            prev = a; a = a->next;
+            a = next;
         }
     }
 }
 
-
 //
 // Entry point for periodic updates
 //
@@ -1389,10 +2222,15 @@ void trackPeriodicUpdate()
     static uint64_t next_update;
     uint64_t now = mstime();
 
-    // Only do updates once per second
+    // Expiry is driven by per-aircraft deadlines, so can run on every call
+    trackRunExpiry(now);
+
+    // Only do other updates once per second
     if (now >= next_update) {
         next_update = now + 1000;
-        trackRemoveStaleAircraft(now);
+        if (now > trackEpoch + TRACK_EPOCH_REBASE)
+            trackRebaseEpoch(now);
+        trackExpireCandidates(now);
         trackMatchAC(now);
     }
 }
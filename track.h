@@ -80,20 +80,90 @@
 //  fresh: data is valid. Updates from a less reliable source are not accepted.
 //  stale: data is valid. Updates from a less reliable source are accepted.
 //  expired: data is not valid.
+//
+// Times are stored as milliseconds relative to trackEpoch, and the stale /
+// expire intervals come from a per-field table in track.c indexed by field.
 typedef struct {
-    uint64_t stale_interval;  /* how long after an update until the data is stale */
-    uint64_t expire_interval; /* how long after an update until the data expires */
-
-    datasource_t source;     /* where the data came from */
-    uint64_t updated;        /* when it arrived */
-    uint64_t stale;          /* when it goes stale */
-    uint64_t expires;        /* when it expires */
+    uint32_t updated;        /* when it arrived */
+    uint32_t stale;          /* when it goes stale */
+    uint32_t expires;        /* when it expires */
+    uint8_t  source;         /* where the data came from (datasource_t) */
+    uint8_t  field;          /* which aircraft field this is, for interval lookups */
 } data_validity;
 
-/* Structure used to describe the state of one tracked aircraft */
+/* Base time for data_validity timestamps; rebased once it is more than
+ * TRACK_EPOCH_REBASE ms in the past, to TRACK_EPOCH_MARGIN ms before now
+ */
+extern uint64_t trackEpoch;
+#define TRACK_EPOCH_REBASE  (1ULL << 31)
+#define TRACK_EPOCH_MARGIN  3600000ULL
+
+/* Convert between absolute and epoch-relative times */
+static inline uint32_t trackRelativeTime(uint64_t t)
+{
+    return (t > trackEpoch) ? (uint32_t) (t - trackEpoch) : 0;
+}
+
+static inline uint64_t trackAbsoluteTime(uint32_t t)
+{
+    return trackEpoch + t;
+}
+
+/* Per-aircraft state used only by FATSV output (faup1090) */
+struct fatsv_state {
+    int           emitted_altitude_baro;    // last FA emitted altitude
+    int           emitted_altitude_geom;    //      -"-         GNSS altitude
+    int           emitted_baro_rate;        //      -"-         barometric rate
+    int           emitted_geom_rate;        //      -"-         geometric rate
+    float         emitted_track;            //      -"-         true track
+    float         emitted_track_rate;       //      -"-         track rate of change
+    float         emitted_mag_heading;      //      -"-         magnetic heading
+    float         emitted_true_heading;     //      -"-         true heading
+    float         emitted_roll;             //      -"-         roll angle
+    float         emitted_gs;               //      -"-         groundspeed
+    unsigned      emitted_ias;              //      -"-         IAS
+    unsigned      emitted_tas;              //      -"-         TAS
+    float         emitted_mach;             //      -"-         Mach number
+    airground_t   emitted_airground;        //      -"-         air/ground state
+    unsigned      emitted_nav_altitude_mcp; //      -"-         MCP altitude
+    unsigned      emitted_nav_altitude_fms; //      -"-         FMS altitude
+    unsigned      emitted_nav_altitude_src; //      -"-         automation altitude source
+    float         emitted_nav_heading;      //      -"-         target heading
+    nav_modes_t   emitted_nav_modes;        //      -"-         enabled navigation modes
+    float         emitted_nav_qnh;          //      -"-         altimeter setting
+    unsigned char emitted_bds_10[7];        //      -"-         BDS 1,0 message
+    unsigned char emitted_bds_30[7];        //      -"-         BDS 3,0 message
+    unsigned char emitted_es_status[7];     //      -"-         ES operational status message
+    unsigned char emitted_es_acas_ra[7];    //      -"-         ES ACAS RA report message
+    char          emitted_callsign[9];      //      -"-         callsign
+    addrtype_t    emitted_addrtype;         //      -"-         address type (assumed ADSB_ICAO initially)
+    int           emitted_adsb_version;     //      -"-         ADS-B version (assumed non-ADS-B initially)
+    unsigned      emitted_category;         //      -"-         ADS-B emitter category (assumed A0 initially)
+    unsigned      emitted_squawk;           //      -"-         squawk
+    unsigned      emitted_nac_p;            //      -"-         NACp
+    unsigned      emitted_nac_v;            //      -"-         NACv
+    unsigned      emitted_sil;              //      -"-         SIL
+    sil_type_t    emitted_sil_type;         //      -"-         SIL supplement
+    unsigned      emitted_nic_baro;         //      -"-         NICbaro
+    emergency_t   emitted_emergency;        //      -"-         emergency/priority status
+
+    uint64_t      last_emitted;             // time (millis) aircraft was last FA emitted
+    uint64_t      last_force_emit;          // time (millis) we last emitted only-on-change data
+};
+
+/* Structure used to describe the state of one tracked aircraft.
+ * Fields touched on every message (identity, reliability, CPR and position
+ * state) are grouped at the start of the structure.
+ */
 struct aircraft {
     uint32_t      addr;           // ICAO address
     addrtype_t    addrtype;       // highest priority address type seen for this aircraft
+    struct aircraft *next;        // Next aircraft in our linked list
+    struct aircraft **pprev;      // Link that points to this aircraft (previous aircraft's next, or the list head)
+
+    struct aircraft *expiry_next;   // Next aircraft in the same expiry wheel slot
+    struct aircraft **expiry_pprev; // Link that points to this aircraft in its expiry wheel slot, or NULL
+    uint64_t      expiry_deadline;  // Time (millis) at which this aircraft next needs expiry processing
 
     uint64_t      seen;           // Time (millis) at which the last packet was received
     long          messages;       // Number of Mode S messages received
@@ -106,6 +176,25 @@ struct aircraft {
     double        signalLevel[8]; // Last 8 Signal Amplitudes
     int           signalNext;     // next index of signalLevel to use
 
+    data_validity cpr_odd_valid;        // Last seen even CPR message
+    cpr_type_t    cpr_odd_type;
+    unsigned      cpr_odd_lat;
+    unsigned      cpr_odd_lon;
+    unsigned      cpr_odd_nic;
+    unsigned      cpr_odd_rc;
+
+    data_validity cpr_even_valid;       // Last seen odd CPR message
+    cpr_type_t    cpr_even_type;
+    unsigned      cpr_even_lat;
+    unsigned      cpr_even_lon;
+    unsigned      cpr_even_nic;
+    unsigned      cpr_even_rc;
+
+    data_validity position_valid;
+    double        lat, lon;       // Coordinates obtained from CPR encoded data
+    unsigned      pos_nic;        // NIC of last computed position
+    unsigned      pos_rc;         // Rc of last computed position
+
     data_validity callsign_valid;
     char          callsign[9];     // Flight number
 
@@ -180,25 +269,6 @@ struct aircraft {
     data_validity nav_modes_valid;
     nav_modes_t   nav_modes;  // enabled modes (autopilot, vnav, etc)
 
-    data_validity cpr_odd_valid;        // Last seen even CPR message
-    cpr_type_t    cpr_odd_type;
-    unsigned      cpr_odd_lat;
-    unsigned      cpr_odd_lon;
-    unsigned      cpr_odd_nic;
-    unsigned      cpr_odd_rc;
-
-    data_validity cpr_even_valid;       // Last seen odd CPR message
-    cpr_type_t    cpr_even_type;
-    unsigned      cpr_even_lat;
-    unsigned      cpr_even_lon;
-    unsigned      cpr_even_nic;
-    unsigned      cpr_even_rc;
-
-    data_validity position_valid;
-    double        lat, lon;       // Coordinates obtained from CPR encoded data
-    unsigned      pos_nic;        // NIC of last computed position
-    unsigned      pos_rc;         // Rc of last computed position
-
     // data extracted from opstatus etc
     int           adsb_version;   // ADS-B version (from ADS-B operational status); -1 means no ADS-B messages seen
     int           adsr_version;   // As above, for ADS-R messages
@@ -228,46 +298,16 @@ struct aircraft {
     int           modeA_hit;   // did our squawk match a possible mode A reply in the last check period?
     int           modeC_hit;   // did our altitude match a possible mode C reply in the last check period?
 
-    int           fatsv_emitted_altitude_baro;    // last FA emitted altitude
-    int           fatsv_emitted_altitude_geom;    //      -"-         GNSS altitude
-    int           fatsv_emitted_baro_rate;        //      -"-         barometric rate
-    int           fatsv_emitted_geom_rate;        //      -"-         geometric rate
-    float         fatsv_emitted_track;            //      -"-         true track
-    float         fatsv_emitted_track_rate;       //      -"-         track rate of change
-    float         fatsv_emitted_mag_heading;      //      -"-         magnetic heading
-    float         fatsv_emitted_true_heading;     //      -"-         true heading
-    float         fatsv_emitted_roll;             //      -"-         roll angle
-    float         fatsv_emitted_gs;               //      -"-         groundspeed
-    unsigned      fatsv_emitted_ias;              //      -"-         IAS
-    unsigned      fatsv_emitted_tas;              //      -"-         TAS
-    float         fatsv_emitted_mach;             //      -"-         Mach number
-    airground_t   fatsv_emitted_airground;        //      -"-         air/ground state
-    unsigned      fatsv_emitted_nav_altitude_mcp; //      -"-         MCP altitude
-    unsigned      fatsv_emitted_nav_altitude_fms; //      -"-         FMS altitude
-    unsigned      fatsv_emitted_nav_altitude_src; //      -"-         automation altitude source
-    float         fatsv_emitted_nav_heading;      //      -"-         target heading
-    nav_modes_t   fatsv_emitted_nav_modes;        //      -"-         enabled navigation modes
-    float         fatsv_emitted_nav_qnh;          //      -"-         altimeter setting
-    unsigned char fatsv_emitted_bds_10[7];        //      -"-         BDS 1,0 message
-    unsigned char fatsv_emitted_bds_30[7];        //      -"-         BDS 3,0 message
-    unsigned char fatsv_emitted_es_status[7];     //      -"-         ES operational status message
-    unsigned char fatsv_emitted_es_acas_ra[7];    //      -"-         ES ACAS RA report message
-    char          fatsv_emitted_callsign[9];      //      -"-         callsign
-    addrtype_t    fatsv_emitted_addrtype;         //      -"-         address type (assumed ADSB_ICAO initially)
-    int           fatsv_emitted_adsb_version;     //      -"-         ADS-B version (assumed non-ADS-B initially)
-    unsigned      fatsv_emitted_category;         //      -"-         ADS-B emitter category (assumed A0 initially)
-    unsigned      fatsv_emitted_squawk;           //      -"-         squawk
-    unsigned      fatsv_emitted_nac_p;            //      -"-         NACp
-    unsigned      fatsv_emitted_nac_v;            //      -"-         NACv
-    unsigned      fatsv_emitted_sil;              //      -"-         SIL
-    sil_type_t    fatsv_emitted_sil_type;         //      -"-         SIL supplement
-    unsigned      fatsv_emitted_nic_baro;         //      -"-         NICbaro
-    emergency_t   fatsv_emitted_emergency;        //      -"-         emergency/priority status
-
-    uint64_t      fatsv_last_emitted;             // time (millis) aircraft was last FA emitted
-    uint64_t      fatsv_last_force_emit;          // time (millis) we last emitted only-on-change data
+    struct aircraft *squawk_next;   // next aircraft with the same squawk (Mode A/C matching index)
+    struct aircraft **squawk_pprev; // link to this aircraft in that index, or NULL if not indexed
+    struct aircraft *modeC_next;    // next aircraft with the same Mode C altitude
+    struct aircraft **modeC_pprev;  // link to this aircraft in that index, or NULL if not indexed
 
-    struct aircraft *next;        // Next aircraft in our linked list
+    struct aircraft *grid_next;     // next aircraft in the same spatial grid bucket
+    struct aircraft **grid_pprev;   // link to this aircraft in the grid, or NULL if not positioned yet
+    uint32_t      grid_cell;        // grid cell of the last position
+
+    struct fatsv_state *fatsv;    // FATSV emission state, only allocated when FATSV output is active
 };
 
 /* Mode A/C tracking is done separately, not via the aircraft list,
@@ -281,23 +321,25 @@ extern uint32_t modeAC_age[4096];
 /* is this bit of data valid? */
 static inline int trackDataValid(const data_validity *v)
 {
-    return (v->source != SOURCE_INVALID && messageNow() < v->expires);
+    return (v->source != SOURCE_INVALID && trackRelativeTime(messageNow()) < v->expires);
 }
 
 /* is this bit of data fresh? */
 static inline int trackDataFresh(const data_validity *v)
 {
-    return (v->source != SOURCE_INVALID && messageNow() < v->stale);
+    return (v->source != SOURCE_INVALID && trackRelativeTime(messageNow()) < v->stale);
 }
 
 /* what's the age of this data, in milliseconds? */
 static inline uint64_t trackDataAge(const data_validity *v)
 {
+    uint32_t now = trackRelativeTime(messageNow());
+
     if (v->source == SOURCE_INVALID)
         return ~(uint64_t)0;
-    if (v->updated >= messageNow())
+    if (v->updated >= now)
         return 0;
-    return (messageNow() - v->updated);
+    return (now - v->updated);
 }
 
 /* Update aircraft state from data in the provided mesage.
@@ -309,6 +351,27 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm);
 /* Call periodically */
 void trackPeriodicUpdate();
 
+/* Spatial queries over aircraft with a valid position; see track.c */
+struct track_neighbour {
+    struct aircraft *a;
+    double distance;         /* meters */
+};
+
+unsigned trackAircraftInBox(double south, double west, double north, double east, struct aircraft **out, unsigned max);
+unsigned trackAircraftInRadius(double lat, double lon, double radius, struct aircraft **out, unsigned max);
+unsigned trackNearestAircraft(double lat, double lon, struct track_neighbour *out, unsigned n);
+
+/* Is lat/lon inside a box? If west > east the box crosses the antimeridian */
+static inline int trackInBox(double lat, double lon, double south, double west, double north, double east)
+{
+    if (lat < south || lat > north)
+        return 0;
+    if (west <= east)
+        return (lon >= west && lon <= east);
+    else
+        return (lon >= west || lon <= east);
+}
+
 /* Convert from a (hex) mode A value to a 0-4095 index */
 static inline unsigned modeAToIndex(unsigned modeA)
 {
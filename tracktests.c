@@ -0,0 +1,358 @@
+// Part of dump1090, a Mode S message decoder for RTLSDR devices.
+//
+// tracktests.c - tests for the tracker's spatial queries
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 2 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Aircraft are fed to the tracker as pairs of airborne position messages,
+// then the grid queries are checked against a brute-force scan of
+// Modes.aircrafts.
+
+#include "dump1090.h"
+
+struct _Modes Modes;
+
+void receiverPositionChanged(float lat, float lon, float alt)
+{
+    /* nothing */
+    (void) lat;
+    (void) lon;
+    (void) alt;
+}
+
+#define NUM_AIRCRAFT 3000
+#define NUM_QUERIES 300
+
+static struct aircraft *expected[NUM_AIRCRAFT];
+static struct aircraft *found[NUM_AIRCRAFT];
+static struct track_neighbour nearest[NUM_AIRCRAFT];
+static double distances[NUM_AIRCRAFT];
+
+static uint64_t now = 1700000000000ULL;
+
+static double randomIn(double lo, double hi)
+{
+    return lo + (hi - lo) * (rand() / (double) RAND_MAX);
+}
+
+static double wrapLon(double lon)
+{
+    while (lon >= 180.0)
+        lon -= 360.0;
+    while (lon < -180.0)
+        lon += 360.0;
+    return lon;
+}
+
+// A random position; a third are clustered in a few degrees around London,
+// some are near the poles or the antimeridian
+static void randomPosition(double *lat, double *lon)
+{
+    switch (rand() % 6) {
+    case 0:
+    case 1:
+        *lat = randomIn(49.5, 53.5);
+        *lon = randomIn(-2.1, 1.9);
+        break;
+    case 2:
+        *lat = randomIn(-60.0, 60.0);
+        *lon = wrapLon(randomIn(175.0, 185.0));
+        break;
+    case 3:
+        *lat = (rand() & 1) ? randomIn(85.0, 89.9) : randomIn(-89.9, -85.0);
+        *lon = randomIn(-180.0, 180.0);
+        break;
+    default:
+        *lat = randomIn(-85.0, 85.0);
+        *lon = randomIn(-180.0, 180.0);
+        break;
+    }
+}
+
+static double fmodPositive(double x, double y)
+{
+    return x - y * floor(x / y);
+}
+
+// Number of longitude zones at a latitude (see DO-260B A.1.7.2)
+static int cprNL(double lat)
+{
+    lat = fabs(lat);
+    if (lat < 1e-9)
+        return 59;
+    if (lat >= 87.0)
+        return (lat > 87.0 ? 1 : 2);
+    return (int) floor(2 * M_PI / acos(1 - (1 - cos(M_PI / 30)) / pow(cos(M_PI / 180 * lat), 2)));
+}
+
+// Airborne CPR encoding of a position (see DO-260B A.1.7.3)
+static void cprEncodeAirborne(double lat, double lon, int odd, unsigned *cprlat, unsigned *cprlon)
+{
+    double dlat = 360.0 / (odd ? 59 : 60);
+    double yz = floor(131072 * fmodPositive(lat, dlat) / dlat + 0.5);
+    double rlat = dlat * (yz / 131072 + floor(lat / dlat));
+    int nl = cprNL(rlat) - odd;
+    double dlon = 360.0 / (nl > 0 ? nl : 1);
+    double xz = floor(131072 * fmodPositive(lon, dlon) / dlon + 0.5);
+
+    *cprlat = (unsigned) yz & 0x1FFFF;
+    *cprlon = (unsigned) xz & 0x1FFFF;
+}
+
+// Send an even/odd pair of DF17 airborne position messages (ME type 11,
+// no altitude) for an aircraft. The header is filled in directly, as in
+// oneoff/track_benchmark.c; the tracker decodes the rest.
+static void sendPosition(uint32_t addr, double lat, double lon)
+{
+    for (int odd = 0; odd <= 1; ++odd) {
+        struct modesMessage mm;
+        unsigned cprlat, cprlon;
+        uint64_t me;
+
+        cprEncodeAirborne(lat, lon, odd, &cprlat, &cprlon);
+        me = (11ULL << 51) | ((uint64_t) odd << 34) | ((uint64_t) cprlat << 17) | cprlon;
+
+        memset(&mm, 0, sizeof(mm));
+        mm.msg[0] = (17 << 3) | 5;
+        mm.msg[1] = addr >> 16;
+        mm.msg[2] = addr >> 8;
+        mm.msg[3] = addr;
+        for (int i = 0; i < 7; ++i)
+            mm.msg[4 + i] = me >> (48 - 8 * i);
+        memcpy(mm.verbatim, mm.msg, sizeof(mm.msg));
+
+        mm.msgtype = 17;
+        mm.msgbits = MODES_LONG_MSG_BITS;
+        mm.addr = addr;
+        mm.addrtype = ADDR_ADSB_ICAO;
+        mm.source = SOURCE_ADSB;
+        mm.reliable = 1;
+        mm.sysTimestampMsg = now++;
+
+        trackUpdateFromMessage(&mm);
+    }
+}
+
+static double distance(double lat0, double lon0, double lat1, double lon1)
+{
+    double dlat = (lat1 - lat0) * M_PI / 180.0;
+    double dlon = (lon1 - lon0) * M_PI / 180.0;
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+        cos(lat0 * M_PI / 180.0) * cos(lat1 * M_PI / 180.0) * sin(dlon / 2) * sin(dlon / 2);
+
+    return 6371e3 * 2 * atan2(sqrt(a), sqrt(1.0 - a));
+}
+
+static int compareAircraft(const void *left, const void *right)
+{
+    const struct aircraft *l = *(const struct aircraft * const *) left;
+    const struct aircraft *r = *(const struct aircraft * const *) right;
+
+    return (l->addr < r->addr) ? -1 : (l->addr > r->addr);
+}
+
+static int compareDouble(const void *left, const void *right)
+{
+    double l = *(const double *) left, r = *(const double *) right;
+
+    return (l < r) ? -1 : (l > r);
+}
+
+// Count the aircraft that currently have a position
+static unsigned countPositions(void)
+{
+    unsigned count = 0;
+
+    for (struct aircraft *a = Modes.aircrafts; a; a = a->next) {
+        if (trackDataValid(&a->position_valid))
+            ++count;
+    }
+
+    return count;
+}
+
+static int testGridBox(unsigned round)
+{
+    for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+        double south, north, west, east, width;
+        unsigned nexpected = 0, nfound;
+
+        // mostly small boxes, some covering a large part of the globe
+        south = randomIn(-90.0, 90.0);
+        north = south + ((i % 10) ? randomIn(0.0, 8.0) : randomIn(0.0, 180.0));
+        if (north > 90.0)
+            north = 90.0;
+        width = (i % 10) ? randomIn(0.0, 10.0) : randomIn(0.0, 360.0);
+        west = randomIn(-180.0, 180.0);
+        east = wrapLon(west + width);
+        if (i % 50 == 0) {
+            west = -180.0;
+            east = 180.0;
+        }
+
+        for (struct aircraft *a = Modes.aircrafts; a; a = a->next) {
+            if (!trackDataValid(&a->position_valid) || a->lat < south || a->lat > north)
+                continue;
+            if (west <= east ? (a->lon >= west && a->lon <= east) : (a->lon >= west || a->lon <= east))
+                expected[nexpected++] = a;
+        }
+
+        nfound = trackAircraftInBox(south, west, north, east, found, NUM_AIRCRAFT);
+
+        qsort(expected, nexpected, sizeof(*expected), compareAircraft);
+        qsort(found, nfound, sizeof(*found), compareAircraft);
+        if (nfound != nexpected || memcmp(found, expected, nfound * sizeof(*found))) {
+            fprintf(stderr,
+                    "testGridBox[%u]: FAIL: trackAircraftInBox(%.3f,%.3f,%.3f,%.3f) found %u aircraft (expected %u)\n",
+                    round, south, west, north, east, nfound, nexpected);
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "testGridBox[%u]: PASS\n", round);
+    return 1;
+}
+
+static int testGridRadius(unsigned round)
+{
+    for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+        double lat, lon, radius;
+        unsigned nexpected = 0, nfound, j;
+
+        randomPosition(&lat, &lon);
+        radius = (i % 10) ? randomIn(1e3, 500e3) : randomIn(500e3, 20000e3);
+
+        nfound = trackAircraftInRadius(lat, lon, radius, found, NUM_AIRCRAFT);
+
+        // Everything found must be in range, and everything clearly in
+        // range must be found; allow a metre for rounding differences
+        for (j = 0; j < nfound; ++j) {
+            if (!trackDataValid(&found[j]->position_valid) ||
+                distance(lat, lon, found[j]->lat, found[j]->lon) > radius + 1.0) {
+                fprintf(stderr,
+                        "testGridRadius[%u]: FAIL: trackAircraftInRadius(%.3f,%.3f,%.0f) found %06X at %.3f,%.3f\n",
+                        round, lat, lon, radius, found[j]->addr, found[j]->lat, found[j]->lon);
+                return 0;
+            }
+        }
+
+        for (struct aircraft *a = Modes.aircrafts; a; a = a->next) {
+            if (trackDataValid(&a->position_valid) && distance(lat, lon, a->lat, a->lon) < radius - 1.0)
+                expected[nexpected++] = a;
+        }
+
+        qsort(found, nfound, sizeof(*found), compareAircraft);
+        for (j = 0; j < nexpected; ++j) {
+            if (!bsearch(&expected[j], found, nfound, sizeof(*found), compareAircraft)) {
+                fprintf(stderr,
+                        "testGridRadius[%u]: FAIL: trackAircraftInRadius(%.3f,%.3f,%.0f) missed %06X at %.3f,%.3f\n",
+                        round, lat, lon, radius, expected[j]->addr, expected[j]->lat, expected[j]->lon);
+                return 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "testGridRadius[%u]: PASS\n", round);
+    return 1;
+}
+
+static int testGridNearest(unsigned round)
+{
+    static const unsigned counts[] = { 1, 5, 50 };
+
+    for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+        unsigned n = counts[i % 3];
+        unsigned nexpected = 0, nfound, j;
+        double lat, lon;
+
+        randomPosition(&lat, &lon);
+
+        for (struct aircraft *a = Modes.aircrafts; a; a = a->next) {
+            if (trackDataValid(&a->position_valid))
+                distances[nexpected++] = distance(lat, lon, a->lat, a->lon);
+        }
+        qsort(distances, nexpected, sizeof(*distances), compareDouble);
+        if (nexpected > n)
+            nexpected = n;
+
+        nfound = trackNearestAircraft(lat, lon, nearest, n);
+
+        if (nfound != nexpected) {
+            fprintf(stderr,
+                    "testGridNearest[%u]: FAIL: trackNearestAircraft(%.3f,%.3f,%u) found %u aircraft (expected %u)\n",
+                    round, lat, lon, n, nfound, nexpected);
+            return 0;
+        }
+
+        // Compare distances rather than aircraft, so that ties don't matter
+        for (j = 0; j < nfound; ++j) {
+            double actual = distance(lat, lon, nearest[j].a->lat, nearest[j].a->lon);
+
+            if (!trackDataValid(&nearest[j].a->position_valid) ||
+                fabs(actual - nearest[j].distance) > 1.0 ||
+                fabs(actual - distances[j]) > 1.0) {
+                fprintf(stderr,
+                        "testGridNearest[%u]: FAIL: trackNearestAircraft(%.3f,%.3f,%u) result %u is %06X at %.0fm (expected %.0fm)\n",
+                        round, lat, lon, n, j, nearest[j].a->addr, actual, distances[j]);
+                return 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "testGridNearest[%u]: PASS\n", round);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    static uint32_t addrs[NUM_AIRCRAFT];
+    int ok = 1;
+
+    MODES_NOTUSED(argc);
+    MODES_NOTUSED(argv);
+
+    srand(1);
+    modeACInit();
+
+    for (unsigned i = 0; i < NUM_AIRCRAFT; ++i) {
+        double lat, lon;
+
+        addrs[i] = 0x100000 + i * 7;
+        randomPosition(&lat, &lon);
+        sendPosition(addrs[i], lat, lon);
+    }
+
+    fprintf(stderr, "(%u of %u aircraft have a position)\n", countPositions(), NUM_AIRCRAFT);
+    ok = testGridBox(0) && ok;
+    ok = testGridRadius(0) && ok;
+    ok = testGridNearest(0) && ok;
+
+    // Let every position expire, then move two thirds of the aircraft.
+    // The rest stay in the grid with expired positions.
+    now += 100000;
+    for (unsigned i = 0; i < NUM_AIRCRAFT; ++i) {
+        double lat, lon;
+
+        if (i % 3 == 0)
+            continue;
+        randomPosition(&lat, &lon);
+        sendPosition(addrs[i], lat, lon);
+    }
+
+    fprintf(stderr, "(%u of %u aircraft have a position)\n", countPositions(), NUM_AIRCRAFT);
+    ok = testGridBox(1) && ok;
+    ok = testGridRadius(1) && ok;
+    ok = testGridNearest(1) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -60,6 +60,8 @@ static void view1090InitConfig(void) {
     Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
     Modes.interactive             = 1;
     Modes.maxRange                = 1852 * 300; // 300NM default max range
+    Modes.net_output_backlog      = MODES_NET_OUTPUT_BACKLOG;
+    Modes.net_read_buffer         = MODES_NET_READ_BUFFER;
 }
 //
 //=========================================================================
@@ -218,7 +220,6 @@ int main(int argc, char **argv) {
     // Keep going till the user does something that stops us
     interactiveInit();
     while (!Modes.exit) {
-        struct timespec r = { 0, 100 * 1000 * 1000};
         icaoFilterExpire();
         trackPeriodicUpdate();
         modesNetPeriodicWork();
@@ -239,7 +240,7 @@ int main(int argc, char **argv) {
             continue;
         }
 
-        nanosleep(&r, NULL);
+        modesNetWait(100);
     }
 
     interactiveCleanup();